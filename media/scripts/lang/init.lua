@@ -25,6 +25,12 @@ std.package.cond_env = { debug = capi.should_log(1), server = SERVER }
 local compile = std.eval.compile
 M.compile = compile
 M.env = require("octascript.rt").env
+M.reload = std.package.reload
+
+-- lets the engine hand over modules it compiled ahead of time
+M.set_bytecode_cache = function(f)
+    std.package.bcache = f
+end
 
 -- plug in custom allocator for better performance
 local bc = require("octascript.bytecode")
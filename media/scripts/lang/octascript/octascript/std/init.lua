@@ -438,6 +438,11 @@ std.eval.compile = compile
 local io_open, load, error = io.open, load, error
 local spath = package.searchpath
 
+-- hot reload bookkeeping: the file and source text of every module loaded
+-- from a file, the modules importing it and the stack of running modules
+local mod_files, mod_sources, mod_importers = {}, {}, {}
+local mod_running = {}
+
 pkg.loaders = setmt({
     [0] = function(modname)
         local v = pkg.preload[modname]
@@ -457,12 +462,16 @@ pkg.loaders = setmt({
         if fname:sub(#fname - 4) == ".lua" then
             f, err = load(toparse, chunkname)
         else
-            f, err = load(compile(chunkname, toparse), chunkname, "b", rt_env)
+            local bcache = pkg.bcache
+            local bcode = bcache and bcache(chunkname, toparse)
+                or compile(chunkname, toparse)
+            f, err = load(bcode, chunkname, "b", rt_env)
         end
         if not f then
             error("error loading module '" .. modname .. "' from file '"
                 .. fname .. "':\n" .. err, 2)
         end
+        mod_files[modname], mod_sources[modname] = fname, toparse
         return f
     end,
     function(modname, ppath)
@@ -525,15 +534,40 @@ local find_loader = function(modname, env)
     return nil, tconc(err)
 end
 
+local pcall, xpcall = pcall, xpcall
+local traceback = debug.traceback
+
+-- adds the stack of a failing module body once; errors rethrown through
+-- nested imports already carry the traceback of where they were raised
+local trace_err = function(err)
+    if type(err) == "string" and not err:find("\nstack traceback:", 1, true)
+    then
+        return traceback(err, 2)
+    end
+    return err
+end
+
 rt.import = function(modname, loaded)
     loaded = loaded or pkg.loaded
+    local importer = mod_running[#mod_running]
+    if importer then
+        local imp = mod_importers[modname]
+        if not imp then
+            imp = {}
+            mod_importers[modname] = imp
+        end
+        imp[importer] = true
+    end
     local v = loaded[modname]
     if v ~= nil then return v end
     local loader, err = find_loader(modname, rt_env)
     if not loader then
         error(err, 2)
     end
-    local ret = loader(modname)
+    mod_running[#mod_running + 1] = modname
+    local ok, ret = xpcall(loader, trace_err, modname)
+    mod_running[#mod_running] = nil
+    if not ok then error(ret, 0) end
     if ret ~= nil then
         loaded[modname] = ret
         return ret
@@ -544,9 +578,121 @@ rt.import = function(modname, loaded)
     return loaded[modname]
 end
 
-local pcall = pcall
 local io_read = io.read
 
+--[[
+    Re-runs a module whose source changed, in place: the new module table
+    migrates state from the old one through its `__reload(new, old)`
+    function, then its fields are copied into the old table so everything
+    holding the module keeps working with the new code. Importers are told
+    through their `__dependency_reloaded(name, module)`.
+
+    Only modules defining `__reload` are reloaded; re-running any other
+    module would leave its functions closed over fresh, empty local state
+    (and re-register its externals) while the live state stays behind.
+    Modules that keep no state of their own set `__reload` to true, as
+    there is nothing to migrate.
+]]
+local reload_module = function(modname)
+    local old = loaded[modname]
+    if type(old) ~= "table" or not rawget(old, "__reload") then
+        return nil, "module does not support reloading (no __reload)"
+    end
+    local fname = mod_files[modname]
+    local file, err = io_open(fname, "rb")
+    if not file then return nil, err end
+    local src = file:read("*all")
+    file:close()
+    local chunkname = "@" .. fname
+    local f
+    if fname:sub(#fname - 4) == ".lua" then
+        f, err = load(src, chunkname)
+    else
+        local ok, bcode = pcall(compile, chunkname, src)
+        if not ok then return nil, bcode end
+        f, err = load(bcode, chunkname, "b", rt_env)
+    end
+    if not f then return nil, err end
+    mod_running[#mod_running + 1] = modname
+    local ok, ret = xpcall(f, trace_err, modname)
+    mod_running[#mod_running] = nil
+    if not ok then return nil, ret end
+    mod_sources[modname] = src
+    if type(ret) == "table" and old ~= ret then
+        local hook = rawget(ret, "__reload")
+        if type(hook) == "function" then
+            local hok, herr = xpcall(hook, trace_err, ret, old)
+            if not hok then return nil, herr end
+        end
+        for k in pairs(old) do
+            if rawget(ret, k) == nil then old[k] = nil end
+        end
+        for k, v in pairs(ret) do old[k] = v end
+        local mt = getmetatable(ret)
+        if mt then setmt(old, mt) end
+        ret = old
+    elseif ret == nil then
+        ret = true
+    end
+    loaded[modname] = ret
+    for imp in pairs(mod_importers[modname] or {}) do
+        local m = loaded[imp]
+        local hook = type(m) == "table" and rawget(m, "__dependency_reloaded")
+        if hook then hook(modname, ret) end
+    end
+    return true
+end
+
+--[[
+    Reloads the given module, or every file-backed module whose source
+    changed on disk. Modules are reloaded after the modules they import.
+    Returns the number of reloaded modules and an error string or nil;
+    a module that fails to compile or run, or that does not define
+    `__reload`, keeps its old version.
+]]
+pkg.reload = function(modname)
+    mod_running = {}
+    local changed = {}
+    if modname then
+        if not mod_files[modname] then
+            return 0, ("module '%s' was not loaded from a file"):format(modname)
+        end
+        changed[modname] = true
+    else
+        for name, fname in pairs(mod_files) do
+            local file = io_open(fname, "rb")
+            if file then
+                if file:read("*all") ~= mod_sources[name] then
+                    changed[name] = true
+                end
+                file:close()
+            end
+        end
+    end
+    -- a module importing another goes after it
+    local order, visited = {}, {}
+    local visit
+    visit = function(name)
+        if visited[name] then return end
+        visited[name] = true
+        for dep, imp in pairs(mod_importers) do
+            if imp[name] and changed[dep] then visit(dep) end
+        end
+        order[#order + 1] = name
+    end
+    for name in pairs(changed) do visit(name) end
+    local n, errs = 0, {}
+    for i = 1, #order do
+        local ok, err = reload_module(order[i])
+        if ok then
+            n = n + 1
+        else
+            errs[#errs + 1] = ("%s: %s"):format(order[i], tostring(err))
+        end
+    end
+    return n, #errs > 0 and tconc(errs, "\n") or nil
+end
+
 local isbcode = function(s)
     return s:sub(1, 3) == "\x1B\x4C\x4A"
 end
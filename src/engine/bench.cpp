@@ -0,0 +1,357 @@
+// bench.cpp: headless benchmark driver for the shared engine code, built by "make bench"
+// every workload is deterministic and reports throughput plus per-sample latency percentiles
+// as one json object per line, so runs can be diffed and tracked by scripts
+
+#include "engine.h"
+
+static volatile uint benchsink = 0;
+
+struct benchmark
+{
+    const char *name;
+    int samples, ops;              // ops and bytes done per sample
+    int bytes;                     // filled in by setup when only known at runtime
+    bool (*setup)(benchmark &b);
+    void (*run)();
+    void (*cleanup)();
+};
+
+// tools.h containers
+
+static void benchvector()
+{
+    static vector<int> v;
+    v.setsize(0);
+    loopi(4096) v.add(int(randomMT()));
+    v.sort();
+    benchsink += v[v.length()/2];
+}
+
+static void benchhashtable()
+{
+    static hashtable<int, int> ht(1<<12);
+    ht.clear();
+    loopi(2048) ht[i*7919] = i;
+    int sum = 0, notfound = 0;
+    loopi(4096) sum += ht.find(i*7919, notfound);
+    loopi(1024) ht.remove(i*7919);
+    benchsink += sum + ht.numelems;
+}
+
+static void benchhashnameset()
+{
+    static hashtable<const char *, int> ht(1<<10);
+    static char names[512][16];
+    static bool init = false;
+    if(!init) { loopi(512) nformatstring(names[i], sizeof(names[i]), "ident_%d", i); init = true; }
+    ht.clear();
+    loopi(512) ht[names[i]] = i;
+    int sum = 0, notfound = 0;
+    loopj(8) loopi(512) sum += ht.find(names[i], notfound);
+    benchsink += sum;
+}
+
+// geom
+
+static void benchmatrix()
+{
+    matrix4 m, p, r;
+    m.identity();
+    p.perspective(90, 16.0f/9, 1, 1024);
+    vec sum(0, 0, 0);
+    loopi(1024)
+    {
+        m.rotate_around_z(0.01f);
+        m.translate(vec(1, 2, 3));
+        r.mul(p, m);
+        matrix4 inv;
+        if(inv.invert(r)) sum.add(inv.perspectivetransform(vec(i, -i, i*0.5f)));
+    }
+    benchsink += uint(sum.x + sum.y + sum.z);
+}
+
+// stream
+
+static uchar *benchgzdata = NULL;
+static const int BENCHGZSIZE = 1<<16;
+
+static bool setupgz(benchmark &b)
+{
+    benchgzdata = new uchar[BENCHGZSIZE];
+    // mildly compressible data resembling serialized cubes: runs mixed with noise
+    loopi(BENCHGZSIZE) benchgzdata[i] = (i&63) < 48 ? uchar(i>>6) : uchar(randomMT());
+    return true;
+}
+
+static void cleanupgz() { DELETEA(benchgzdata); }
+
+static void benchgz()
+{
+    stream *tmp = opentempfile("bench.tmp", "w+b");
+    if(!tmp) fatal("could not open temporary file");
+    stream *gz = opengzfile(NULL, "wb", tmp, Z_BEST_SPEED);
+    gz->write(benchgzdata, BENCHGZSIZE);
+    delete gz;
+    tmp->seek(0, SEEK_SET);
+    gz = opengzfile(NULL, "rb", tmp);
+    static uchar buf[BENCHGZSIZE];
+    size_t len = gz->read(buf, BENCHGZSIZE);
+    delete gz;
+    delete tmp;
+    if(len != size_t(BENCHGZSIZE) || memcmp(buf, benchgzdata, BENCHGZSIZE)) fatal("gz round trip mismatch");
+    benchsink += buf[len-1];
+}
+
+// crypto
+
+static vector<char> benchprivkey, benchpubkey;
+static void *benchpubkeyparsed = NULL;
+
+static bool setupecc(benchmark &b)
+{
+    genprivkey("octaforge benchmark", benchprivkey, benchpubkey);
+    benchpubkeyparsed = parsepubkey(benchpubkey.getbuf());
+    return benchpubkeyparsed != NULL;
+}
+
+static void cleanupecc()
+{
+    if(benchpubkeyparsed) { freepubkey(benchpubkeyparsed); benchpubkeyparsed = NULL; }
+    benchprivkey.setsize(0);
+    benchpubkey.setsize(0);
+}
+
+static void benchecc()
+{
+    static uint seed = 0;
+    seed++;
+    vector<char> challenge, answer;
+    void *correct = genchallenge(benchpubkeyparsed, &seed, sizeof(seed), challenge);
+    answerchallenge(benchprivkey.getbuf(), challenge.getbuf(), answer);
+    if(!checkchallenge(answer.getbuf(), correct)) fatal("ecc challenge failed");
+    freechallenge(correct);
+}
+
+static void benchtiger()
+{
+    static char text[1024];
+    if(!text[0]) { loopi(sizeof(text)-1) text[i] = 'a' + i%26; }
+    string result;
+    loopi(16)
+    {
+        text[0] = 'a' + i;
+        hashstring(text, result, sizeof(result));
+    }
+    benchsink += uchar(result[0]);
+}
+
+// cubescript
+
+static uint *benchcode = NULL;
+static const char *benchscript =
+    "benchsum = 0\n"
+    "loop i 256 [\n"
+    "    if (< (mod $i 3) 2) [benchsum = (+ $benchsum (* $i 2))] [benchsum = (- $benchsum 1)]\n"
+    "]\n"
+    "result (concat $benchsum (strlen \"octaforge\"))";
+
+static bool setupcubescript(benchmark &b)
+{
+    benchcode = compilecode(benchscript);
+    return benchcode != NULL;
+}
+
+static void cleanupcubescript() { if(benchcode) { freecode(benchcode); benchcode = NULL; } }
+
+static void benchcubescript()
+{
+    char *s = executestr(benchcode);
+    if(s) { benchsink += uchar(s[0]); delete[] s; }
+}
+
+static void benchcubescriptcompile()
+{
+    uint *code = compilecode(benchscript);
+    benchsink += code[0];
+    freecode(code);
+}
+
+// repeated var access from C++ by name against by symbol id
+
+VAR(benchivar, 0, 0, 0x7FFFFFFF);
+FVAR(benchfvar, 0, 0, 1e9f);
+SVAR(benchsvar, "");
+
+static const char *benchvarnames[] = { "benchivar", "benchfvar", "benchsvar" };
+
+static void benchvarbyname()
+{
+    loopi(1024)
+    {
+        setvar(benchvarnames[0], i);
+        setfvar(benchvarnames[1], getvar(benchvarnames[0])*0.5f);
+        benchsink += uint(getfvar(benchvarnames[1])) + uchar(getsvar(benchvarnames[2])[0]);
+    }
+}
+
+static void benchvarbyid()
+{
+    static int syms[3] = { -1, -1, -1 };
+    if(syms[0] < 0) loopi(3) syms[i] = getidentid(benchvarnames[i]);
+    loopi(1024)
+    {
+        setvarbyid(syms[0], i);
+        setfvarbyid(syms[1], getvarbyid(syms[0])*0.5f);
+        benchsink += uint(getfvarbyid(syms[1])) + uchar(getsvarbyid(syms[2])[0]);
+    }
+}
+
+// maps: the bundled test map decompressed through the same gz path load_world uses
+
+static const char *benchmapname = "media/map/test/map.ogz";
+
+static int readbenchmap()
+{
+    stream *f = opengzfile(benchmapname, "rb");
+    if(!f) return -1;
+    static uchar buf[1<<16];
+    int total = 0;
+    for(;;)
+    {
+        size_t len = f->read(buf, sizeof(buf));
+        if(!len) break;
+        total += int(len);
+    }
+    delete f;
+    return total;
+}
+
+static bool setupmap(benchmark &b)
+{
+    b.bytes = readbenchmap();
+    return b.bytes > 0;
+}
+
+static void benchmap()
+{
+    int len = readbenchmap();
+    if(len < 0) fatal("could not read map: %s", benchmapname);
+    benchsink += len;
+}
+
+// network: position-like messages (type, client, coords, yaw, name) encoded into enet packets and decoded again
+
+static void benchpacket()
+{
+    packetbuf p(MAXTRANS, 0);
+    loopi(256)
+    {
+        putint(p, 4);
+        putuint(p, i);
+        putint(p, int(randomMT()&0xFFFF) - 0x8000);
+        putint(p, i*31);
+        putfloat(p, i*0.25f);
+        sendstring("bench", p);
+    }
+    ENetPacket *packet = p.finalize();
+    ucharbuf q(packet->data, packet->dataLength);
+    int sum = 0;
+    string text;
+    while(q.remaining())
+    {
+        sum += getint(q);
+        sum += getuint(q);
+        sum += getint(q) + getint(q);
+        sum += int(getfloat(q));
+        getstring(text, q);
+    }
+    benchsink += sum;
+}
+
+static benchmark benchmarks[] =
+{
+    { "vector_sort",        200, 4096,  0,           NULL,            benchvector,            NULL },
+    { "hashtable_int",      200, 7168,  0,           NULL,            benchhashtable,         NULL },
+    { "hashtable_string",   200, 4608,  0,           NULL,            benchhashnameset,       NULL },
+    { "matrix4",            200, 1024,  0,           NULL,            benchmatrix,            NULL },
+    { "gz_roundtrip",       100, 1,     BENCHGZSIZE, setupgz,         benchgz,                cleanupgz },
+    { "ecc_challenge",      50,  1,     0,           setupecc,        benchecc,               cleanupecc },
+    { "tiger_1k",           200, 16,    16*1023,     NULL,            benchtiger,             NULL },
+    { "cubescript_exec",    200, 1,     0,           setupcubescript, benchcubescript,        cleanupcubescript },
+    { "cubescript_compile", 200, 1,     0,           NULL,            benchcubescriptcompile, NULL },
+    { "var_by_name",        200, 5120,  0,           NULL,            benchvarbyname,         NULL },
+    { "var_by_id",          200, 5120,  0,           NULL,            benchvarbyid,           NULL },
+    { "map_ogz",            20,  1,     0,           setupmap,        benchmap,               NULL },
+    { "packet_pos",         200, 256,   0,           NULL,            benchpacket,            NULL }
+};
+
+static bool benchselected(const benchmark &b, vector<const char *> &filters)
+{
+    if(filters.empty()) return true;
+    loopv(filters) if(strstr(b.name, filters[i])) return true;
+    return false;
+}
+
+static double benchpercentile(vector<ullong> &times, double p)
+{
+    int idx = clamp(int(p*(times.length()-1) + 0.5), 0, times.length()-1);
+    return double(times[idx]);
+}
+
+static void runbenchmark(benchmark &b, float scale, FILE *out)
+{
+    if(b.setup && !b.setup(b))
+    {
+        fprintf(out, "{\"name\":\"%s\",\"skipped\":true}\n", b.name);
+        fflush(out);
+        return;
+    }
+    seedMT(0x0C7AF0);
+    int samples = max(int(b.samples*scale), 1);
+    b.run(); // warm caches and lazy initialization
+    vector<ullong> times;
+    ullong total = 0;
+    loopi(samples)
+    {
+        ullong start = profmicros();
+        b.run();
+        ullong dur = profmicros() - start;
+        times.add(dur);
+        total += dur;
+    }
+    if(b.cleanup) b.cleanup();
+    times.sort();
+    double secs = max(total, ullong(1))/1e6;
+    fprintf(out, "{\"name\":\"%s\",\"samples\":%d,\"ops_per_sample\":%d,\"ops_per_sec\":%.1f", b.name, samples, b.ops, double(b.ops)*samples/secs);
+    if(b.bytes) fprintf(out, ",\"mb_per_sec\":%.2f", double(b.bytes)*samples/secs/(1024*1024));
+    fprintf(out, ",\"p50_us\":%.0f,\"p90_us\":%.0f,\"p99_us\":%.0f,\"max_us\":%.0f}\n",
+        benchpercentile(times, 0.5), benchpercentile(times, 0.9), benchpercentile(times, 0.99), double(times.last()));
+    fflush(out);
+}
+
+// usage: bench [-k<packagedir>] [-u<homedir>] [-o<output>] [-s<scale>] [name filters...]
+int main(int argc, char **argv)
+{
+    setlogfile(NULL);
+    if(enet_initialize()<0) fatal("Unable to initialise network module");
+    atexit(enet_deinitialize);
+    FILE *out = stdout;
+    float scale = 1;
+    vector<const char *> filters;
+    for(int i = 1; i<argc; i++)
+    {
+        if(argv[i][0]!='-') { filters.add(argv[i]); continue; }
+        switch(argv[i][1])
+        {
+            case 'o': if(argv[i][2] && !(out = fopen(argv[i]+2, "w"))) fatal("could not write %s", argv[i]+2); break;
+            case 's': scale = max(float(atof(argv[i]+2)), 0.01f); break;
+            case 'u': sethomedir(argv[i]+2); break;
+            case 'k': addpackagedir(argv[i]+2); break;
+            default: fatal("unknown option: %s", argv[i]); break;
+        }
+    }
+    loopi(sizeof(benchmarks)/sizeof(benchmarks[0])) if(benchselected(benchmarks[i], filters)) runbenchmark(benchmarks[i], scale, out);
+    if(out != stdout) fclose(out);
+    closelogfile();
+    return EXIT_SUCCESS;
+}
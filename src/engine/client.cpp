@@ -218,6 +218,7 @@ void clientkeepalive() { if(clienthost) enet_host_service(clienthost, NULL, 0);
 
 void gets2c()           // get updates from the server
 {
+    PROFSCOPE("gets2c");
     ENetEvent event;
     if(!clienthost) return;
     if(connpeer && totalmillis/3000 > connmillis/3000)
@@ -18,38 +18,110 @@ enum
 
 VARN(numargs, _numargs, MAXARGS, 0, 0);
 
-void ident::changed() {
-    if (fun) fun(this);
-    if (!(flags&IDF_SIGNAL)) return;
-    switch (type) {
+// signalled var changes are queued and handed to Lua in one batch per frame by
+// flushvarchanges(); a var changed several times in between is only reported once,
+// with the value it has at flush time. IDF_SYNC vars keep emitting immediately.
+static vector<ident *> varchanges;
+
+static void emitvarchanged(ident *id) {
+    switch (id->type) {
         case ID_VAR:
-            lua::call_external("var_emit_changed", "siiii", name,
-                *(storage.i), minval, overrideval.i, maxval);
+            lua::call_external("var_emit_changed", "siiii", id->name,
+                *(id->storage.i), id->minval, id->overrideval.i, id->maxval);
             break;
         case ID_FVAR:
-            lua::call_external("var_emit_changed", "sffff", name,
-                *(storage.f), minvalf, overrideval.f, maxvalf);
+            lua::call_external("var_emit_changed", "sffff", id->name,
+                *(id->storage.f), id->minvalf, id->overrideval.f, id->maxvalf);
             break;
         case ID_SVAR:
-            lua::call_external("var_emit_changed", "sss", name,
-                *(storage.s), overrideval.s);
+            lua::call_external("var_emit_changed", "sss", id->name,
+                *(id->storage.s), id->overrideval.s);
             break;
-        case ID_ALIAS: switch (valtype) {
+        case ID_ALIAS: switch (id->valtype) {
             case VAL_INT:
-                lua::call_external("var_emit_changed", "si", name, val.i);
+                lua::call_external("var_emit_changed", "si", id->name, id->val.i);
                 break;
             case VAL_FLOAT:
-                lua::call_external("var_emit_changed", "sf", name, val.f);
+                lua::call_external("var_emit_changed", "sf", id->name, id->val.f);
                 break;
             case VAL_STR:
-                lua::call_external("var_emit_changed", "ss", name, val.s);
+                lua::call_external("var_emit_changed", "ss", id->name, id->val.s);
                 break;
-            default: lua::call_external("var_emit_changed", "s", name); break;
+            default: lua::call_external("var_emit_changed", "s", id->name); break;
         }
-        default: lua::call_external("var_emit_changed", "s", name); break;
+        break;
+        default: lua::call_external("var_emit_changed", "s", id->name); break;
     }
 }
 
+// pushes the same arguments var_emit_changed gets, returns how many
+static int pushvarchanged(lua_State *L, ident *id) {
+    lua_pushstring(L, id->name);
+    switch (id->type) {
+        case ID_VAR:
+            lua_pushinteger(L, *(id->storage.i));
+            lua_pushinteger(L, id->minval);
+            lua_pushinteger(L, id->overrideval.i);
+            lua_pushinteger(L, id->maxval);
+            return 5;
+        case ID_FVAR:
+            lua_pushnumber(L, *(id->storage.f));
+            lua_pushnumber(L, id->minvalf);
+            lua_pushnumber(L, id->overrideval.f);
+            lua_pushnumber(L, id->maxvalf);
+            return 5;
+        case ID_SVAR:
+            lua_pushstring(L, *(id->storage.s));
+            lua_pushstring(L, id->overrideval.s);
+            return 3;
+        case ID_ALIAS: switch (id->valtype) {
+            case VAL_INT:   lua_pushinteger(L, id->val.i); return 2;
+            case VAL_FLOAT: lua_pushnumber (L, id->val.f); return 2;
+            case VAL_STR:   lua_pushstring (L, id->val.s); return 2;
+        }
+        break;
+    }
+    return 1;
+}
+
+void ident::changed() {
+    if (fun) fun(this);
+    if (!(flags&IDF_SIGNAL)) return;
+    if (flags&IDF_SYNC) { emitvarchanged(this); return; }
+    if (flags&IDF_QUEUED) return;
+    flags |= IDF_QUEUED;
+    varchanges.add(this);
+}
+
+// delivers the queued changes as one var_emit_changed_batch call taking an array
+// of { name, ... } entries; changes made by the handlers go out with the next flush
+void flushvarchanges() {
+    if (varchanges.empty()) return;
+    static vector<ident *> batch;
+    batch.setsize(0);
+    batch.put(varchanges.getbuf(), varchanges.length());
+    varchanges.setsize(0);
+    loopv(batch) batch[i]->flags &= ~IDF_QUEUED;
+    lua_State *L = lua::L;
+    if (!L) return;
+    PROFSCOPE("var_emit_changed");
+    int top = lua_gettop(L);
+    lua_createtable(L, batch.length(), 0);
+    int nchanges = 0;
+    loopv(batch) {
+        ident *id = batch[i];
+        if (!(id->flags&IDF_SIGNAL)) continue;
+        int n = pushvarchanged(L, id);
+        lua_createtable(L, n, 0);
+        lua_insert(L, -n - 1);
+        for (int j = n; j > 0; --j) lua_rawseti(L, -j - 1, j);
+        lua_rawseti(L, -2, ++nchanges);
+    }
+    if (nchanges)
+        lua::call_external("var_emit_changed_batch", "vi", top + 1, nchanges);
+    lua_settop(L, top);
+}
+
 static inline void freearg(tagval &v)
 {
     switch(v.type)
@@ -289,12 +361,13 @@ static void debugalias()
     }
 }
 
-static int nodebug = 0;
+static int nodebug = 0, numdebugcode = 0;
 
 static void debugcode(const char *fmt, ...) PRINTFARGS(1, 2);
 
 static void debugcode(const char *fmt, ...)
 {
+    numdebugcode++;
     if(nodebug) return;
 
     va_list args;
@@ -309,6 +382,7 @@ static void debugcodeline(const char *p, const char *fmt, ...) PRINTFARGS(2, 3);
 
 static void debugcodeline(const char *p, const char *fmt, ...)
 {
+    numdebugcode++;
     if(nodebug) return;
 
     va_list args;
@@ -660,32 +734,76 @@ DEFSVAR(defsvarp, IDF_PERSIST);
         clearval; \
     }
 
-void setvar(const char *name, int i, bool dofunc, bool doclamp)
+// every ident is interned once into identmap, and its index there is a stable symbol id
+// for the lifetime of the process; callers that touch a var repeatedly can resolve the name
+// once with getidentid and then skip hashing and comparing the string on each access,
+// while the by-name functions below are thin wrappers over the same ident-based code
+#define _GETVARID(id, vartype, sym, retval) \
+    ident *id = identmap.inrange(sym) ? identmap[sym] : NULL; \
+    if(!id || id->type!=vartype) return retval;
+
+int getidentid(const char *name)
+{
+    ident *id = idents.access(name);
+    return id ? id->index : -1;
+}
+
+ident *getidentbyid(int sym) { return identmap.inrange(sym) ? identmap[sym] : NULL; }
+
+static void setvarident(ident *id, int i, bool dofunc, bool doclamp)
 {
-    GETVAR(id, name, );
     if(identflags&IDF_SAFE && !(id->flags&IDF_OVERRIDE)) return;
     OVERRIDEVAR(return, id->overrideval.i = *id->storage.i, , )
     if(doclamp) *id->storage.i = clamp(i, id->minval, id->maxval);
     else *id->storage.i = i;
     if(dofunc) id->changed();
 }
-void setfvar(const char *name, float f, bool dofunc, bool doclamp)
+static void setfvarident(ident *id, float f, bool dofunc, bool doclamp)
 {
-    _GETVAR(id, ID_FVAR, name, );
     if(identflags&IDF_SAFE && !(id->flags&IDF_OVERRIDE)) return;
     OVERRIDEVAR(return, id->overrideval.f = *id->storage.f, , );
     if(doclamp) *id->storage.f = clamp(f, id->minvalf, id->maxvalf);
     else *id->storage.f = f;
     if(dofunc) id->changed();
 }
-void setsvar(const char *name, const char *str, bool dofunc)
+static void setsvarident(ident *id, const char *str, bool dofunc)
 {
-    _GETVAR(id, ID_SVAR, name, );
     if(identflags&IDF_SAFE && !(id->flags&IDF_OVERRIDE)) return;
     OVERRIDEVAR(return, id->overrideval.s = *id->storage.s, delete[] id->overrideval.s, delete[] *id->storage.s);
     *id->storage.s = newstring(str);
     if(dofunc) id->changed();
 }
+
+void setvar(const char *name, int i, bool dofunc, bool doclamp)
+{
+    GETVAR(id, name, );
+    setvarident(id, i, dofunc, doclamp);
+}
+void setfvar(const char *name, float f, bool dofunc, bool doclamp)
+{
+    _GETVAR(id, ID_FVAR, name, );
+    setfvarident(id, f, dofunc, doclamp);
+}
+void setsvar(const char *name, const char *str, bool dofunc)
+{
+    _GETVAR(id, ID_SVAR, name, );
+    setsvarident(id, str, dofunc);
+}
+void setvarbyid(int sym, int i, bool dofunc, bool doclamp)
+{
+    _GETVARID(id, ID_VAR, sym, );
+    setvarident(id, i, dofunc, doclamp);
+}
+void setfvarbyid(int sym, float f, bool dofunc, bool doclamp)
+{
+    _GETVARID(id, ID_FVAR, sym, );
+    setfvarident(id, f, dofunc, doclamp);
+}
+void setsvarbyid(int sym, const char *str, bool dofunc)
+{
+    _GETVARID(id, ID_SVAR, sym, );
+    setsvarident(id, str, dofunc);
+}
 int getvar(const char *name)
 {
     GETVAR(id, name, 0);
@@ -721,6 +839,21 @@ const char *getsvar(const char *name)
     _GETVAR(id, ID_SVAR, name, NULL);
     return *id->storage.s;
 }
+int getvarbyid(int sym)
+{
+    _GETVARID(id, ID_VAR, sym, 0);
+    return *id->storage.i;
+}
+float getfvarbyid(int sym)
+{
+    _GETVARID(id, ID_FVAR, sym, 0.0f);
+    return *id->storage.f;
+}
+const char *getsvarbyid(int sym)
+{
+    _GETVARID(id, ID_SVAR, sym, NULL);
+    return *id->storage.s;
+}
 
 ICOMMAND(getvarmin, "s", (char *s), intret(getvarmin(s)));
 ICOMMAND(getvarmax, "s", (char *s), intret(getvarmax(s)));
@@ -3069,6 +3202,164 @@ bool execidentbool(const char *name, bool noid, bool lookup)
     return id ? executebool(id, NULL, 0, lookup) : noid;
 }
 
+// execfile keeps the bytecode of config files in the home dir, one entry per file named by the
+// tiger hash of its path and tagged with the hash of the source it was compiled from, so unchanged
+// files skip lexing and compilation on later runs and an edited file overwrites its old entry;
+// strings are stored inline in the bytecode anyway, while ident references are written as indexes
+// into a symbol table of names and relinked on load, and a symbol whose type or command signature
+// has changed since invalidates the entry so it is compiled and written again; files whose
+// compilation reported errors are not cached, so those errors show up on every run
+VAR(cubescriptcache, 0, 1, 1);
+
+// the format revision is combined with the op and value layout from command.h, so extending
+// either invalidates old entries; reordering them or changing an op's encoding needs a bump
+enum { CSCACHE_VERSION = 2 | (CODE_JUMP_RESULT_FALSE<<8) | (VAL_COND<<16) | (CODE_RET<<24) };
+static const char CSCACHE_MAGIC[4] = { 'O', 'F', 'C', 'S' };
+#ifdef STANDALONE
+#define CSCACHE_DIR "cache/cubescript_server/"
+#else
+#define CSCACHE_DIR "cache/cubescript/"
+#endif
+
+// bit position of the ident index embedded in an op, or 0 if there is none
+static inline int codeidentshift(uint op)
+{
+    switch(op&CODE_OP_MASK)
+    {
+        case CODE_IDENT: case CODE_IDENTARG: case CODE_PRINT:
+        case CODE_LOOKUP: case CODE_LOOKUPARG: case CODE_LOOKUPM: case CODE_LOOKUPMARG:
+        case CODE_SVAR: case CODE_SVARM: case CODE_SVAR1:
+        case CODE_IVAR: case CODE_IVAR1: case CODE_IVAR2: case CODE_IVAR3:
+        case CODE_FVAR: case CODE_FVAR1:
+        case CODE_COM: case CODE_COMD: case CODE_ALIAS: case CODE_ALIASARG:
+            return 8;
+        case CODE_COMC: case CODE_COMV: case CODE_CALL: case CODE_CALLARG:
+            return 13;
+    }
+    return 0;
+}
+
+// number of inline data words following an op
+static inline int codedatalen(uint op)
+{
+    switch(op&0xFF)
+    {
+        case CODE_MACRO: case CODE_VAL|RET_STR: return (op>>8)/sizeof(uint) + 1;
+        case CODE_VAL|RET_INT: case CODE_VAL|RET_FLOAT: return 1;
+    }
+    return 0;
+}
+
+static inline void putcachestr(stream *f, const char *str)
+{
+    int len = str ? strlen(str) : 0;
+    f->putlil<int>(len);
+    if(len) f->write(str, len);
+}
+
+static inline bool getcachestr(stream *f, vector<char> &buf)
+{
+    int len = f->getlil<int>();
+    if(len < 0 || len > 0x10000) return false;
+    buf.setsize(0);
+    if(len && f->read(buf.pad(len), len) != size_t(len)) return false;
+    buf.add('\0');
+    return true;
+}
+
+static void savecodecache(const char *key, const char *srckey, const vector<uint> &code)
+{
+    vector<uint> out;
+    vector<ident *> syms;
+    hashtable<int, int> symidx;
+    out.put(code.getbuf(), code.length());
+    out[0] = CODE_START;
+    for(int i = 0; i < out.length(); i += 1 + codedatalen(out[i]))
+    {
+        uint op = out[i];
+        int shift = codeidentshift(op);
+        if(!shift) continue;
+        int idx = int(op>>shift), *sym = symidx.access(idx);
+        if(!sym)
+        {
+            sym = &symidx[idx];
+            *sym = syms.length();
+            syms.add(identmap[idx]);
+        }
+        out[i] = (op&((1U<<shift)-1)) | (uint(*sym)<<shift);
+    }
+    defformatstring(file, CSCACHE_DIR "%s.csc", key);
+    stream *f = openrawfile(path(file), "wb");
+    if(!f) return;
+    f->write(CSCACHE_MAGIC, sizeof(CSCACHE_MAGIC));
+    f->putlil<int>(CSCACHE_VERSION);
+    putcachestr(f, srckey);
+    f->putlil<int>(syms.length());
+    loopv(syms)
+    {
+        ident *id = syms[i];
+        f->putlil<int>(id->type);
+        f->putlil<int>(id->flags&IDF_HEX);
+        putcachestr(f, id->type == ID_COMMAND ? id->args : NULL);
+        putcachestr(f, id->name);
+    }
+    f->putlil<int>(out.length());
+    lilswap(out.getbuf(), out.length());
+    f->write(out.getbuf(), out.length()*sizeof(uint));
+    delete f;
+}
+
+static bool loadcodecache(const char *key, const char *srckey, vector<uint> &code)
+{
+    defformatstring(file, CSCACHE_DIR "%s.csc", key);
+    stream *f = openrawfile(path(file), "rb");
+    if(!f) return false;
+    char magic[sizeof(CSCACHE_MAGIC)];
+    vector<char> names, name, args;
+    vector<int> nameoffs;
+    bool valid = f->read(magic, sizeof(magic)) == sizeof(magic) && !memcmp(magic, CSCACHE_MAGIC, sizeof(magic)) &&
+                 f->getlil<int>() == CSCACHE_VERSION && getcachestr(f, name) && !strcmp(name.getbuf(), srckey);
+    int numsyms = valid ? f->getlil<int>() : 0;
+    if(numsyms < 0 || numsyms >= (1<<19)) valid = false;
+    // only accept the entry if every ident still compiles the same way; names missing now were
+    // aliases created by the compiler and are recreated below
+    for(int i = 0; valid && i < numsyms; i++)
+    {
+        int type = f->getlil<int>(), hex = f->getlil<int>();
+        if(!getcachestr(f, args) || !getcachestr(f, name)) { valid = false; break; }
+        nameoffs.add(names.length());
+        names.put(name.getbuf(), name.length());
+        ident *id = idents.access(name.getbuf());
+        if(!id) valid = type == ID_ALIAS;
+        else if(id->type != type || (id->flags&IDF_HEX) != hex) valid = false;
+        else if(type == ID_COMMAND && strcmp(id->args, args.getbuf())) valid = false;
+    }
+    int len = valid ? f->getlil<int>() : 0;
+    if(len <= 0 || len > (1<<24)) valid = false;
+    if(valid)
+    {
+        code.setsize(0);
+        if(f->read(code.pad(len), len*sizeof(uint)) != len*sizeof(uint)) valid = false;
+        else lilswap(code.getbuf(), len);
+    }
+    delete f;
+    if(valid) for(int i = 0; i < len; i += 1 + codedatalen(code[i]))
+    {
+        int shift = codeidentshift(code[i]);
+        if(shift && int(code[i]>>shift) >= numsyms) { valid = false; break; }
+    }
+    if(!valid || (code.last()&CODE_OP_MASK) != CODE_EXIT) { code.setsize(0); return false; }
+    vector<int> syms;
+    loopv(nameoffs) syms.add(newident(names.getbuf() + nameoffs[i], IDF_UNKNOWN)->index);
+    for(int i = 0; i < len; i += 1 + codedatalen(code[i]))
+    {
+        uint op = code[i];
+        int shift = codeidentshift(op);
+        if(shift) code[i] = (op&((1U<<shift)-1)) | (uint(syms[op>>shift])<<shift);
+    }
+    return true;
+}
+
 bool execfile(const char *cfgfile, bool msg)
 {
     string s;
@@ -3082,7 +3373,24 @@ bool execfile(const char *cfgfile, bool msg)
     const char *oldsourcefile = sourcefile, *oldsourcestr = sourcestr;
     sourcefile = cfgfile;
     sourcestr = buf;
-    execute(buf);
+    string key = "", srckey = "";
+    if(cubescriptcache)
+    {
+        hashstring(s, key, sizeof(key));
+        hashstring(buf, srckey, sizeof(srckey));
+    }
+    vector<uint> code;
+    if(!key[0] || !loadcodecache(key, srckey, code))
+    {
+        code.reserve(64);
+        int olddebugcode = numdebugcode;
+        compilemain(code, buf, VAL_INT);
+        if(key[0] && numdebugcode == olddebugcode) savecodecache(key, srckey, code);
+    }
+    tagval result;
+    runcode(code.getbuf()+1, result);
+    freearg(result);
+    if(int(code[0]) >= 0x100) code.disown();
     sourcefile = oldsourcefile;
     sourcestr = oldsourcestr;
     delete[] buf;
@@ -4425,9 +4733,7 @@ LUAICOMMAND(var_new, {
     lua_pushboolean(L, true); return 1;
 });
 
-LUAICOMMAND(var_set, {
-    const char *name = luaL_checkstring(L, 1);
-    ident *id = getident(name);
+static int var_set_ident(lua_State *L, ident *id) {
     if (!id) {
         lua_pushboolean(L, false);
         return 1;
@@ -4435,19 +4741,19 @@ LUAICOMMAND(var_set, {
     int nargs = lua_gettop(L);
     switch (id->type) {
         case ID_VAR: {
-            setvar(name, luaL_checkinteger(L, 2),
+            setvarident(id, luaL_checkinteger(L, 2),
                 (nargs >= 3) ? lua_toboolean(L, 3) : true,
                 (nargs >= 4) ? lua_toboolean(L, 4) : true);
             break;
         }
         case ID_FVAR: {
-            setfvar(name, luaL_checknumber(L, 2),
+            setfvarident(id, luaL_checknumber(L, 2),
                 (nargs >= 3) ? lua_toboolean(L, 3) : true,
                 (nargs >= 4) ? lua_toboolean(L, 4) : true);
             break;
         }
         case ID_SVAR: {
-            setsvar(name, luaL_checkstring(L, 2),
+            setsvarident(id, luaL_checkstring(L, 2),
                 (nargs >= 3) ? lua_toboolean(L, 3) : true);
             break;
         }
@@ -4455,20 +4761,46 @@ LUAICOMMAND(var_set, {
     }
     lua_pushboolean(L, true);
     return 1;
-});
+}
 
-LUAICOMMAND(var_get, {
-    const char *name = luaL_checkstring(L, 1);
-    ident *id = getident(name);
+static int var_get_ident(lua_State *L, ident *id) {
     if (!id) return 0;
     switch (id->type) {
-        case ID_VAR: lua_pushinteger(L, getvar(name)); return 1;
-        case ID_FVAR: lua_pushnumber(L, getfvar(name)); return 1;
-        case ID_SVAR: lua_pushstring(L, getsvar(name)); return 1;
+        case ID_VAR: lua_pushinteger(L, *id->storage.i); return 1;
+        case ID_FVAR: lua_pushnumber(L, *id->storage.f); return 1;
+        case ID_SVAR: lua_pushstring(L, *id->storage.s); return 1;
         default: return 0;
     }
+}
+
+LUAICOMMAND(var_set, {
+    return var_set_ident(L, getident(luaL_checkstring(L, 1)));
+});
+
+LUAICOMMAND(var_get, {
+    return var_get_ident(L, getident(luaL_checkstring(L, 1)));
+});
+
+LUAICOMMAND(var_set_by_id, {
+    return var_set_ident(L, getidentbyid(luaL_checkinteger(L, 1)));
+});
+
+LUAICOMMAND(var_get_by_id, {
+    return var_get_ident(L, getidentbyid(luaL_checkinteger(L, 1)));
+});
+
+CLUAICOMMAND(var_get_id, int, (const char *name), {
+    ident *id = getident(name);
+    return (id && id->type <= ID_SVAR) ? id->index : -1;
 });
 
+CLUAICOMMAND(var_get_int_by_id, int, (int sym), return getvarbyid(sym););
+CLUAICOMMAND(var_get_float_by_id, float, (int sym), return getfvarbyid(sym););
+CLUAICOMMAND(var_set_int_by_id, void, (int sym, int v, bool dofunc,
+bool doclamp), setvarbyid(sym, v, dofunc, doclamp));
+CLUAICOMMAND(var_set_float_by_id, void, (int sym, float v, bool dofunc,
+bool doclamp), setfvarbyid(sym, v, dofunc, doclamp));
+
 LUAICOMMAND(var_get_min, {
     const char *name = luaL_checkstring(L, 1);
     ident *id = getident(name);
@@ -4537,5 +4869,19 @@ CLUAICOMMAND(var_make_emit, bool, (const char *name, bool v), {
     return ret;
 })
 
+CLUAICOMMAND(var_emits_sync, bool, (const char *name), {
+    ident *id = getident(name);
+    return id && (id->flags&IDF_SYNC);
+});
+
+CLUAICOMMAND(var_make_sync, bool, (const char *name, bool v), {
+    ident *id = getident(name);
+    bool ret = id && (id->flags&IDF_SYNC);
+    if (!id) return ret;
+    if (v) id->flags |=  IDF_SYNC;
+    else   id->flags &= ~IDF_SYNC;
+    return ret;
+})
+
 #undef ICOMMANDNAME
 #define ICOMMANDNAME(name) _icmd_##name
@@ -594,6 +594,8 @@ extern void clearsleep(bool clearoverrides = true);
 // console
 extern float conscale;
 
+extern void conline(int type, const char *sf);
+
 extern void processkey(int code, bool isdown);
 extern void processtextinput(const char *str, int len);
 extern float rendercommand(float x, float y, float w);
@@ -649,6 +651,40 @@ enum { TI_CONSOLE = 1<<0, TI_GUI = 1<<1 };
 
 extern void textinput(bool on, int mask = ~0);
 
+// jobs
+typedef void (*jobfunc)(void *data, int start, int end, int worker);
+
+// persistent worker threads that split a range of items into batches, the calling thread helps out as worker 0
+struct jobpool
+{
+    struct worker
+    {
+        jobpool *pool;
+        int index;
+        SDL_Thread *thread;
+    };
+
+    const char *name;
+    vector<worker *> workers;
+    SDL_mutex *mutex;
+    SDL_cond *cond, *donecond;
+    jobfunc func;
+    void *data;
+    int next, count, left, batch;
+    bool quit, busy;
+
+    jobpool(const char *name) : name(name), mutex(NULL), cond(NULL), donecond(NULL), func(NULL), data(NULL), next(0), count(0), left(0), batch(1), quit(false), busy(false) {}
+
+    int numthreads() const { return workers.length(); }
+
+    void setthreads(int n);
+    void stop();
+    void run(int n, int size, jobfunc f, void *d);
+
+    bool runbatch(int worker);
+    static int workerloop(void *data);
+};
+
 // physics
 extern void modifyorient(float yaw, float pitch);
 extern void mousemove(int dx, int dy);
@@ -683,6 +719,7 @@ extern void endmodelquery();
 extern void rendershadowmodelbatches(bool dynmodel = true);
 extern void shadowmaskbatchedmodels(bool dynshadow = true);
 extern void rendermapmodelbatches();
+extern void prepareskelposes();
 extern void rendermodelbatches();
 extern void rendertransparentmodelbatches(int stencil = 0);
 extern void rendermapmodel(extentity *e, int anim, const vec &o, float yaw = 0, float pitch = 0, float roll = 0, int flags = MDL_CULL_VFC | MDL_CULL_DIST, int basetime = 0, float size = 1);
@@ -731,6 +768,8 @@ extern int mainmenu;
 
 // sound
 extern void stopmapsounds();
+extern void clearmapsoundgrid();
+extern void loadsoundmanifest(const char *mname);
 extern void checkmapsounds();
 extern void updatesounds();
 
@@ -94,8 +94,99 @@ struct iqmvertexarray
     uint offset;
 };
 
+// an iqm file mapped (or read, if packaged) into memory, shared by every model that loads it
+// the data is byteswapped once on load, after that it is only ever read
+// a mapping reads the file lazily for as long as the meshgroup holding it lives, so model files must not be
+// truncated or rewritten in place while the engine runs (that faults with SIGBUS on access); replacing them
+// with a new file (write elsewhere, then rename) is fine since the mapping keeps the old contents alive
+struct iqmfile
+{
+    char *name;
+    int uses;
+    iqmheader hdr;
+    uchar *buf;
+    size_t size;
+    bool mapped;
+
+    iqmfile(const char *name) : name(newstring(name)), uses(0), buf(NULL), size(0), mapped(false) {}
+    ~iqmfile()
+    {
+        if(mapped) unmapfile(buf, size);
+        else DELETEA(buf);
+        DELETEA(name);
+    }
+
+    // counts are products of untrusted 32 bit header fields, so they are checked in 64 bits
+    template<class T> static bool inrange(const iqmheader &hdr, uint ofs, ullong num)
+    {
+        return ofs <= hdr.filesize && num <= (hdr.filesize - ofs)/sizeof(T);
+    }
+    template<class T> bool inrange(uint ofs, ullong num) const { return inrange<T>(hdr, ofs, num); }
+
+    bool load()
+    {
+        buf = (uchar *)mapfile(name, &size);
+        if(buf) mapped = true;
+        else
+        {
+            buf = (uchar *)loadfile(name, &size, false);
+            if(!buf) return false;
+        }
+        if(size < sizeof(hdr)) return false;
+        memcpy(&hdr, buf, sizeof(hdr));
+        if(memcmp(hdr.magic, "INTERQUAKEMODEL", sizeof(hdr.magic))) return false;
+        lilswap(&hdr.version, (sizeof(hdr) - sizeof(hdr.magic))/sizeof(uint));
+        if(hdr.version != 2 || hdr.filesize > size) return false;
+        if(!mapped && hdr.filesize > (16<<20)) return false; // sanity check... don't read files bigger than 16 MB into memory
+        if(!inrange<iqmvertexarray>(hdr.ofs_vertexarrays, hdr.num_vertexarrays) || !inrange<iqmtriangle>(hdr.ofs_triangles, hdr.num_triangles) ||
+           !inrange<iqmmesh>(hdr.ofs_meshes, hdr.num_meshes) || !inrange<iqmjoint>(hdr.ofs_joints, hdr.num_joints) ||
+           !inrange<iqmpose>(hdr.ofs_poses, hdr.num_poses) || !inrange<iqmanim>(hdr.ofs_anims, hdr.num_anims) ||
+           !inrange<ushort>(hdr.ofs_frames, ullong(hdr.num_frames)*hdr.num_framechannels) || hdr.ofs_text >= hdr.filesize)
+            return false;
+
+        lilswap((uint *)&buf[hdr.ofs_vertexarrays], hdr.num_vertexarrays*sizeof(iqmvertexarray)/sizeof(uint));
+        lilswap((uint *)&buf[hdr.ofs_triangles], hdr.num_triangles*sizeof(iqmtriangle)/sizeof(uint));
+        lilswap((uint *)&buf[hdr.ofs_meshes], hdr.num_meshes*sizeof(iqmmesh)/sizeof(uint));
+        lilswap((uint *)&buf[hdr.ofs_joints], hdr.num_joints*sizeof(iqmjoint)/sizeof(uint));
+        lilswap((uint *)&buf[hdr.ofs_poses], hdr.num_poses*sizeof(iqmpose)/sizeof(uint));
+        lilswap((uint *)&buf[hdr.ofs_anims], hdr.num_anims*sizeof(iqmanim)/sizeof(uint));
+        lilswap((ushort *)&buf[hdr.ofs_frames], hdr.num_frames*hdr.num_framechannels);
+        iqmvertexarray *vas = (iqmvertexarray *)&buf[hdr.ofs_vertexarrays];
+        loopi(hdr.num_vertexarrays)
+        {
+            iqmvertexarray &va = vas[i];
+            if(va.format != IQM_FLOAT) continue;
+            if(!inrange<float>(va.offset, ullong(va.size)*hdr.num_vertexes)) return false;
+            lilswap((float *)&buf[va.offset], va.size*hdr.num_vertexes);
+        }
+        return true;
+    }
+};
+
 struct iqm : skelmodel, skelloader<iqm>
 {
+    static hashnameset<iqmfile *> iqmfiles;
+
+    static iqmfile *acquirefile(const char *filename)
+    {
+        iqmfile **found = iqmfiles.access(filename), *f = found ? *found : NULL;
+        if(!f)
+        {
+            f = new iqmfile(filename);
+            if(!f->load()) { delete f; return NULL; }
+            iqmfiles.add(f);
+        }
+        f->uses++;
+        return f;
+    }
+
+    static void releasefile(iqmfile *f)
+    {
+        if(--f->uses > 0) return;
+        iqmfiles.remove(f->name);
+        delete f;
+    }
+
     iqm(const char *name) : skelmodel(name) {}
 
     static const char *formatname() { return "iqm"; }
@@ -103,17 +194,19 @@ struct iqm : skelmodel, skelloader<iqm>
 
     struct iqmmeshgroup : skelmeshgroup
     {
+        vector<iqmfile *> files;
+
         iqmmeshgroup()
         {
         }
 
-        bool loadiqmmeshes(const char *filename, const iqmheader &hdr, uchar *buf)
+        ~iqmmeshgroup()
         {
-            lilswap((uint *)&buf[hdr.ofs_vertexarrays], hdr.num_vertexarrays*sizeof(iqmvertexarray)/sizeof(uint));
-            lilswap((uint *)&buf[hdr.ofs_triangles], hdr.num_triangles*sizeof(iqmtriangle)/sizeof(uint));
-            lilswap((uint *)&buf[hdr.ofs_meshes], hdr.num_meshes*sizeof(iqmmesh)/sizeof(uint));
-            lilswap((uint *)&buf[hdr.ofs_joints], hdr.num_joints*sizeof(iqmjoint)/sizeof(uint));
+            loopv(files) releasefile(files[i]);
+        }
 
+        bool loadiqmmeshes(const char *filename, const iqmheader &hdr, uchar *buf)
+        {
             const char *str = hdr.ofs_text ? (char *)&buf[hdr.ofs_text] : "";
             float *vpos = NULL, *vnorm = NULL, *vtan = NULL, *vtc = NULL;
             uchar *vindex = NULL, *vweight = NULL;
@@ -123,12 +216,12 @@ struct iqm : skelmodel, skelloader<iqm>
                 iqmvertexarray &va = vas[i];
                 switch(va.type)
                 {
-                    case IQM_POSITION: if(va.format != IQM_FLOAT || va.size != 3) return false; vpos = (float *)&buf[va.offset]; lilswap(vpos, 3*hdr.num_vertexes); break;
-                    case IQM_NORMAL: if(va.format != IQM_FLOAT || va.size != 3) return false; vnorm = (float *)&buf[va.offset]; lilswap(vnorm, 3*hdr.num_vertexes); break;
-                    case IQM_TANGENT: if(va.format != IQM_FLOAT || va.size != 4) return false; vtan = (float *)&buf[va.offset]; lilswap(vtan, 4*hdr.num_vertexes); break;
-                    case IQM_TEXCOORD: if(va.format != IQM_FLOAT || va.size != 2) return false; vtc = (float *)&buf[va.offset]; lilswap(vtc, 2*hdr.num_vertexes); break;
-                    case IQM_BLENDINDEXES: if(va.format != IQM_UBYTE || va.size != 4) return false; vindex = (uchar *)&buf[va.offset]; break;
-                    case IQM_BLENDWEIGHTS: if(va.format != IQM_UBYTE || va.size != 4) return false; vweight = (uchar *)&buf[va.offset]; break;
+                    case IQM_POSITION: if(va.format != IQM_FLOAT || va.size != 3) return false; vpos = (float *)&buf[va.offset]; break;
+                    case IQM_NORMAL: if(va.format != IQM_FLOAT || va.size != 3) return false; vnorm = (float *)&buf[va.offset]; break;
+                    case IQM_TANGENT: if(va.format != IQM_FLOAT || va.size != 4) return false; vtan = (float *)&buf[va.offset]; break;
+                    case IQM_TEXCOORD: if(va.format != IQM_FLOAT || va.size != 2) return false; vtc = (float *)&buf[va.offset]; break;
+                    case IQM_BLENDINDEXES: if(va.format != IQM_UBYTE || va.size != 4 || !iqmfile::inrange<uchar>(hdr, va.offset, 4*ullong(hdr.num_vertexes))) return false; vindex = (uchar *)&buf[va.offset]; break;
+                    case IQM_BLENDWEIGHTS: if(va.format != IQM_UBYTE || va.size != 4 || !iqmfile::inrange<uchar>(hdr, va.offset, 4*ullong(hdr.num_vertexes))) return false; vweight = (uchar *)&buf[va.offset]; break;
                 }
             }
             if(!vpos) return false;
@@ -145,7 +238,7 @@ struct iqm : skelmodel, skelloader<iqm>
                     skel->bones = new boneinfo[skel->numbones];
                     loopi(hdr.num_joints)
                     {
-                        iqmjoint &j = joints[i];
+                        iqmjoint j = joints[i];
                         boneinfo &b = skel->bones[i];
                         if(!b.name) b.name = newstring(&str[j.name]);
                         b.parent = j.parent;
@@ -251,11 +344,9 @@ struct iqm : skelmodel, skelloader<iqm>
             return true;
         }
 
-        bool loadiqmanims(const char *filename, const iqmheader &hdr, uchar *buf)
+        bool loadiqmanims(const char *filename, const iqmheader &hdr, uchar *buf, const char *animname = NULL)
         {
-            lilswap((uint *)&buf[hdr.ofs_poses], hdr.num_poses*sizeof(iqmpose)/sizeof(uint));
-            lilswap((uint *)&buf[hdr.ofs_anims], hdr.num_anims*sizeof(iqmanim)/sizeof(uint));
-            lilswap((ushort *)&buf[hdr.ofs_frames], hdr.num_frames*hdr.num_framechannels);
+            if(hdr.num_poses != uint(skel->numbones)) return false;
 
             const char *str = hdr.ofs_text ? (char *)&buf[hdr.ofs_text] : "";
             iqmpose *poses = (iqmpose *)&buf[hdr.ofs_poses];
@@ -264,6 +355,9 @@ struct iqm : skelmodel, skelloader<iqm>
             loopi(hdr.num_anims)
             {
                 iqmanim &a = anims[i];
+                // only decode the requested animation, the frames of the others are never touched
+                if(animname && strcmp(&str[a.name], animname)) continue;
+                if(a.first_frame > hdr.num_frames || a.num_frames > hdr.num_frames - a.first_frame) continue;
                 string name;
                 copystring(name, filename);
                 concatstring(name, ":");
@@ -320,31 +414,19 @@ struct iqm : skelmodel, skelloader<iqm>
             return true;
         }
 
-        bool loadiqm(const char *filename, bool doloadmesh, bool doloadanim)
+        bool loadiqm(const char *filename, bool doloadmesh, bool doloadanim, const char *animname = NULL)
         {
-            stream *f = openfile(filename, "rb");
+            iqmfile *f = acquirefile(filename);
             if(!f) return false;
 
-            uchar *buf = NULL;
-            iqmheader hdr;
-            if(f->read(&hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, "INTERQUAKEMODEL", sizeof(hdr.magic))) goto error;
-            lilswap(&hdr.version, (sizeof(hdr) - sizeof(hdr.magic))/sizeof(uint));
-            if(hdr.version != 2) goto error;
-            if(hdr.filesize > (16<<20)) goto error; // sanity check... don't load files bigger than 16 MB
-            buf = new uchar[hdr.filesize];
-            if(f->read(buf + sizeof(hdr), hdr.filesize - sizeof(hdr)) != hdr.filesize - sizeof(hdr)) goto error;
-
-            if(doloadmesh && !loadiqmmeshes(filename, hdr, buf)) goto error;
-            if(doloadanim && !loadiqmanims(filename, hdr, buf)) goto error;
+            bool ok = (!doloadmesh || loadiqmmeshes(filename, f->hdr, f->buf)) &&
+                      (!doloadanim || loadiqmanims(filename, f->hdr, f->buf, animname));
 
-            delete[] buf;
-            delete f;
-            return true;
-
-        error:
-            if(buf) delete[] buf;
-            delete f;
-            return false;
+            // mapped files stay around while this group lives, since their pages are only faulted in as
+            // anims get decoded and can be dropped by the OS at any time; heap copies are freed right away
+            if(f->mapped && files.find(f) < 0) files.add(f);
+            else releasefile(f);
+            return ok;
         }
 
         bool load(const char *filename, float smooth)
@@ -363,7 +445,7 @@ struct iqm : skelmodel, skelloader<iqm>
                 string filename;
                 copystring(filename, animname);
                 if(sep) filename[sep - animname] = '\0';
-                if(loadiqm(filename, false, true))
+                if(loadiqm(filename, false, true, sep ? sep+1 : NULL))
                     sa = skel->findskelanim(animname, sep ? '\0' : ':');
             }
             return sa;
@@ -415,5 +497,7 @@ struct iqm : skelmodel, skelloader<iqm>
     }
 };
 
+hashnameset<iqmfile *> iqm::iqmfiles;
+
 skelcommands<iqm> iqmcommands;
 
@@ -0,0 +1,86 @@
+// jobs.cpp: shared worker pool for splitting per-frame and load-time work across threads
+
+#include "engine.h"
+
+// called with mutex held
+bool jobpool::runbatch(int worker)
+{
+    if(next >= count) return false;
+    int start = next, end = min(start + batch, count);
+    next = end;
+    SDL_UnlockMutex(mutex);
+    func(data, start, end, worker);
+    SDL_LockMutex(mutex);
+    left -= end - start;
+    if(left <= 0) SDL_CondSignal(donecond);
+    return true;
+}
+
+int jobpool::workerloop(void *data)
+{
+    worker *w = (worker *)data;
+    jobpool *p = w->pool;
+    SDL_LockMutex(p->mutex);
+    while(!p->quit)
+    {
+        if(!p->runbatch(w->index)) SDL_CondWait(p->cond, p->mutex);
+    }
+    SDL_UnlockMutex(p->mutex);
+    return 0;
+}
+
+void jobpool::stop()
+{
+    if(workers.empty()) return;
+    SDL_LockMutex(mutex);
+    quit = true;
+    SDL_CondBroadcast(cond);
+    SDL_UnlockMutex(mutex);
+    loopv(workers) SDL_WaitThread(workers[i]->thread, NULL);
+    workers.deletecontents();
+    quit = false;
+}
+
+// must not be called from inside a job
+void jobpool::setthreads(int n)
+{
+    if(workers.length() == n) return;
+    stop();
+    if(!mutex)
+    {
+        mutex = SDL_CreateMutex();
+        cond = SDL_CreateCond();
+        donecond = SDL_CreateCond();
+    }
+    loopi(n)
+    {
+        worker *w = workers.add(new worker);
+        w->pool = this;
+        w->index = i+1;
+        w->thread = SDL_CreateThread(workerloop, name, w);
+    }
+}
+
+// runs f over [0, n) in batches of size items and returns once all of them are done,
+// falls back to running inline when there are no workers or the pool is already busy with a job
+void jobpool::run(int n, int size, jobfunc f, void *d)
+{
+    if(n <= 0) return;
+    if(workers.empty() || n <= size) { f(d, 0, n, 0); return; }
+    SDL_LockMutex(mutex);
+    if(busy) { SDL_UnlockMutex(mutex); f(d, 0, n, 0); return; }
+    busy = true;
+    func = f;
+    data = d;
+    batch = max(size, 1);
+    next = 0;
+    count = left = n;
+    SDL_CondBroadcast(cond);
+    while(runbatch(0));
+    while(left > 0) SDL_CondWait(donecond, mutex);
+    next = count = 0;
+    func = NULL;
+    data = NULL;
+    busy = false;
+    SDL_UnlockMutex(mutex);
+}
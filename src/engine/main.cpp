@@ -74,6 +74,7 @@ void fatal(const char *s, ...)    // failure exit
         }
     }
 
+    closelogfile(); // drains the log writer so the error itself isn't lost
     exit(EXIT_FAILURE);
 }
 
@@ -778,10 +779,13 @@ void swapbuffers(bool overlay)
 VAR(menufps, 0, 60, 1000);
 VARP(maxfps, 0, 125, 1000);
 
+// lua garbage collection is stepped here once per limited frame, taking its time out of the frame delay
 void limitfps(int &millis, int curmillis)
 {
     int limit = (mainmenu || minimized) && menufps ? (maxfps ? min(maxfps, menufps) : menufps) : maxfps;
+    lua::gccheck();
     if(!limit) return;
+    int gcmillis = lua::gcidle()/1000;
     static int fpserror = 0;
     int delay = 1000/limit - (millis-curmillis);
     if(delay < 0) fpserror = 0;
@@ -793,11 +797,12 @@ void limitfps(int &millis, int curmillis)
             ++delay;
             fpserror -= limit;
         }
-        if(delay > 0)
+        if(delay > gcmillis)
         {
-            SDL_Delay(delay);
+            SDL_Delay(delay - gcmillis);
             millis += delay;
         }
+        else millis += gcmillis;
     }
 }
 
@@ -952,7 +957,7 @@ int main(int argc, char **argv)
     setlogfile(NULL);
 
     int dedicated = 0;
-    char *load = NULL, *initscript = NULL;
+    char *load = NULL, *initscript = NULL, *batchscript = NULL;
 
     #define initlog(s) logger::log(logger::INIT, "%s", s)
 
@@ -1020,6 +1025,7 @@ int main(int argc, char **argv)
                 break;
             }
             case 'x': initscript = &argv[i][2]; break;
+            case 'b': batchscript = &argv[i][2]; break;
             default: if(!serveroption(argv[i])) gameargs.add(argv[i]); break;
         }
         else gameargs.add(argv[i]);
@@ -1027,6 +1033,7 @@ int main(int argc, char **argv)
 
     /* Initialize logging at first, right after that lua. */
     logger::setlevel(loglevel);
+    logger::startwriter();
 
     initlog("lua");
     lua::init();
@@ -1034,6 +1041,17 @@ int main(int argc, char **argv)
 
     numcpus = clamp(SDL_GetCPUCount(), 1, 16);
 
+    if(batchscript)
+    {
+        /* headless batch mode for asset tools such as gendds: no window, no GL */
+        initlog("batch");
+        if(SDL_Init(SDL_INIT_TIMER)<0) fatal("Unable to initialize SDL: %s", SDL_GetError());
+        execute(batchscript);
+        SDL_Quit();
+        closelogfile();
+        return EXIT_SUCCESS;
+    }
+
     if(dedicated <= 1)
     {
         initlog("sdl");
@@ -1144,6 +1162,7 @@ int main(int argc, char **argv)
     for(;;)
     {
         static int frames = 0;
+        profframe();
         int millis = getclockmillis();
         limitfps(millis, totalmillis);
         elapsedtime = millis - totalmillis;
@@ -1157,12 +1176,23 @@ int main(int argc, char **argv)
         totalmillis = millis;
         updatetime();
 
-        checkinput();
-        ovr::update();
-        lua::call_external("gui_update", "");
+        {
+            PROFSCOPE("input");
+            checkinput();
+            ovr::update();
+        }
+        flushvarchanges();
+        {
+            PROFSCOPE("gui_update");
+            lua::call_external("gui_update", "");
+        }
         tryedit();
 
-        if(lastmillis) game::updateworld();
+        if(lastmillis)
+        {
+            PROFSCOPE("updateworld");
+            game::updateworld();
+        }
 
         checksleep(lastmillis);
 
@@ -1181,8 +1211,14 @@ int main(int argc, char **argv)
         gl_setupframe(!mainmenu);
 
         inbetweenframes = false;
-        gl_drawframe();
-        swapbuffers();
+        {
+            PROFSCOPE("drawframe");
+            gl_drawframe();
+        }
+        {
+            PROFSCOPE("swapbuffers");
+            swapbuffers();
+        }
         renderedframe = inbetweenframes = true;
 
         extern void modifyedgeturn(int curtime);
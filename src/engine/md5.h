@@ -156,13 +156,39 @@ struct md5 : skelmodel, skelloader<md5>
         {
         }
 
-        bool loadmesh(const char *filename, float smooth)
+        void savecacheskins(stream *f)
+        {
+            part *p = loading && loading->parts.length() ? loading->parts.last() : NULL;
+            int numskins = p ? p->skins.length() : 0;
+            f->put<int>(numskins);
+            loopi(numskins) putcachestring(f, p->skins[i].tex != notexture ? p->skins[i].tex->name : NULL);
+        }
+
+        void loadcacheskins(stream *f)
+        {
+            part *p = loading && loading->parts.length() ? loading->parts.last() : NULL;
+            int numskins = f->get<int>();
+            loopi(numskins)
+            {
+                char *texname = getcachestring(f);
+                if(!texname) continue;
+                if(p)
+                {
+                    p->initskins(notexture, notexture, i+1);
+                    p->skins[i].tex = textureload(texname, 0, true, false);
+                }
+                delete[] texname;
+            }
+        }
+
+        bool loadmesh(const char *filename, float smooth, uint cachekey = 0)
         {
             stream *f = openfile(filename, "r");
             if(!f) return false;
 
             char buf[512];
             vector<md5joint> basejoints;
+            bool savenames = skel->numbones <= 0;
             while(f->getline(buf, sizeof(buf)))
             {
                 int tmp;
@@ -258,6 +284,16 @@ struct md5 : skelmodel, skelloader<md5>
             sortblendcombos();
 
             delete f;
+
+            stream *cf = openmodelcache(filename, "mesh", cachekey, true);
+            if(cf)
+            {
+                vector<dualquat> bases;
+                loopv(basejoints) bases.add(dualquat(basejoints[i].orient, basejoints[i].pos));
+                savecache(cf, savenames, bases.getbuf());
+                savecacheskins(cf);
+                delete cf;
+            }
             return true;
         }
 
@@ -266,6 +302,15 @@ struct md5 : skelmodel, skelloader<md5>
             skelanimspec *sa = skel->findskelanim(filename);
             if(sa) return sa;
 
+            uint cachekey = animcachekey(skel, filename);
+            stream *cf = openmodelcache(filename, "anim", cachekey, false);
+            if(cf)
+            {
+                sa = skel->loadanimcache(cf, filename);
+                delete cf;
+                if(sa) return sa;
+            }
+
             stream *f = openfile(filename, "r");
             if(!f) return NULL;
 
@@ -379,6 +424,11 @@ struct md5 : skelmodel, skelloader<md5>
             if(animdata) delete[] animdata;
             delete f;
 
+            if(sa && (cf = openmodelcache(filename, "anim", cachekey, true)))
+            {
+                skel->saveanimcache(cf, *sa);
+                delete cf;
+            }
             return sa;
         }
 
@@ -386,7 +436,17 @@ struct md5 : skelmodel, skelloader<md5>
         {
             name = newstring(meshfile);
 
-            if(!loadmesh(meshfile, smooth)) return false;
+            uint cachekey = modelcachekey(meshfile, modelcachekey(MDL_MD5, &smooth, sizeof(smooth)));
+            stream *cf = openmodelcache(meshfile, "mesh", cachekey, false);
+            if(cf)
+            {
+                bool cached = loadcache(cf);
+                if(cached) loadcacheskins(cf);
+                delete cf;
+                if(cached) return true;
+            }
+
+            if(!loadmesh(meshfile, smooth, cachekey)) return false;
 
             return true;
         }
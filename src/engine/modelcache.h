@@ -0,0 +1,81 @@
+// binary cache of post-processed model data for the text formats (md5, smd, obj)
+// entries live under cache/model/ in the home dir and are keyed by the size and modification time of the source file,
+// so a changed or replaced source simply misses the cache and gets parsed again
+
+VARP(modelcache, 0, 1, 1);
+
+#define MODELCACHE_MAGIC "OFMC"
+#define MODELCACHE_VERSION 2
+// written in native byte order, so a cache copied from a machine of the other endianness fails the header check
+#define MODELCACHE_ENDIAN 0x01020304U
+
+static uint modelcachekey(const char *filename, uint seed = 0)
+{
+    llong info[2];
+    if(!getfileinfo(filename, info[0], info[1])) return 0;
+    return crc32(seed, (const Bytef *)info, sizeof(info)) | 1;
+}
+
+static inline uint modelcachekey(uint key, const void *data, size_t len)
+{
+    return len ? crc32(key, (const Bytef *)data, len) | 1 : key;
+}
+
+static stream *openmodelcache(const char *filename, const char *kind, uint key, bool write)
+{
+    if(!modelcache || !key) return NULL;
+    defformatstring(cachename, "cache/model/%s.%s", filename, kind);
+    stream *f = openfile(path(cachename), write ? "wb" : "rb");
+    if(!f) return NULL;
+    uint header[3] = { MODELCACHE_ENDIAN, MODELCACHE_VERSION, key };
+    if(write)
+    {
+        f->write(MODELCACHE_MAGIC, 4);
+        f->put(header, 3);
+        return f;
+    }
+    char magic[4];
+    uint check[3];
+    if(f->read(magic, 4) != 4 || memcmp(magic, MODELCACHE_MAGIC, 4) || f->get(check, 3) != 3 || memcmp(check, header, sizeof(header)))
+    {
+        delete f;
+        return NULL;
+    }
+    return f;
+}
+
+static void putcachestring(stream *f, const char *s)
+{
+    int len = s ? strlen(s) : 0;
+    f->put<int>(len);
+    if(len) f->write(s, len);
+}
+
+static char *getcachestring(stream *f)
+{
+    int len = f->get<int>();
+    if(len <= 0 || len > 4096) return NULL;
+    char *s = new char[len+1];
+    if(f->read(s, len) != size_t(len)) { delete[] s; return NULL; }
+    s[len] = '\0';
+    return s;
+}
+
+// raw structs are stored as-is, so each block leads with the struct size to catch layout changes
+template<class T> static void putcachearray(stream *f, const T *buf, int num)
+{
+    f->put<int>(sizeof(T));
+    f->put<int>(num);
+    if(num) f->put(buf, num);
+}
+
+template<class T> static bool getcachearray(stream *f, T *&buf, int &num, int maxnum = 1<<24)
+{
+    num = 0;
+    if(f->get<int>() != int(sizeof(T))) return false;
+    num = f->get<int>();
+    if(num < 0 || num > maxnum) { num = 0; return false; }
+    if(!num) return true;
+    buf = new T[num];
+    return f->get(buf, num) == size_t(num);
+}
@@ -32,6 +32,15 @@ struct obj : vertmodel, vertloader<obj>
 
             name = newstring(filename);
 
+            uint cachekey = modelcachekey(filename, modelcachekey(MDL_OBJ, &smooth, sizeof(smooth)));
+            stream *cf = openmodelcache(filename, "mesh", cachekey, false);
+            if(cf)
+            {
+                bool cached = loadcache(cf);
+                delete cf;
+                if(cached) { delete file; return true; }
+            }
+
             numframes = 1;
 
             vector<vec> attrib[3];
@@ -156,6 +165,11 @@ struct obj : vertmodel, vertloader<obj>
 
             delete file;
 
+            if((cf = openmodelcache(filename, "mesh", cachekey, true)))
+            {
+                savecache(cf);
+                delete cf;
+            }
             return true;
         }
     };
@@ -22,6 +22,7 @@ int allocnodes = 0;
 cubeext *growcubeext(cubeext *old, int maxverts)
 {
     cubeext *ext = (cubeext *)new uchar[sizeof(cubeext) + maxverts*sizeof(vertinfo)];
+    MEMTRACK(MEM_OCTREE, sizeof(cubeext) + maxverts*sizeof(vertinfo));
     if(old)
     {
         ext->va = old->va;
@@ -43,7 +44,11 @@ void setcubeext(cube &c, cubeext *ext)
     cubeext *old = c.ext;
     if(old == ext) return;
     c.ext = ext;
-    if(old) delete[] (uchar *)old;
+    if(old)
+    {
+        MEMTRACK(MEM_OCTREE, -llong(sizeof(cubeext) + old->maxverts*sizeof(vertinfo)));
+        delete[] (uchar *)old;
+    }
 }
 
 cubeext *newcubeext(cube &c, int maxverts, bool init)
@@ -66,6 +71,7 @@ cubeext *newcubeext(cube &c, int maxverts, bool init)
 cube *newcubes(uint face, int mat)
 {
     cube *c = new cube[8];
+    MEMTRACK(MEM_OCTREE, 8*sizeof(cube));
     loopi(8)
     {
         c->children = NULL;
@@ -93,6 +99,7 @@ void freeocta(cube *c)
     if(!c) return;
     loopi(8) discardchildren(c[i]);
     delete[] c;
+    MEMTRACK(MEM_OCTREE, -llong(8*sizeof(cube)));
     allocnodes--;
 }
 
@@ -100,6 +107,7 @@ void freecubeext(cube &c)
 {
     if(c.ext)
     {
+        MEMTRACK(MEM_OCTREE, -llong(sizeof(cubeext) + c.ext->maxverts*sizeof(vertinfo)));
         delete[] (uchar *)c.ext;
         c.ext = NULL;
     }
@@ -720,6 +720,7 @@ void pruneundos(int maxremain)                          // bound memory
     {
         undoblock *u = undos.popfirst();
         totalundos -= u->size;
+        MEMTRACK(MEM_UNDO, -u->size);
         freeundo(u);
     }
     //conoutf(CON_DEBUG, "undo: %d of %d(%%%d)", totalundos, undomegs<<20, totalundos*100/(undomegs<<20));
@@ -727,6 +728,7 @@ void pruneundos(int maxremain)                          // bound memory
     {
         undoblock *u = redos.popfirst();
         totalundos -= u->size;
+        MEMTRACK(MEM_UNDO, -u->size);
         freeundo(u);
     }
 }
@@ -756,6 +758,7 @@ void addundo(undoblock *u)
     u->timestamp = totalmillis;
     undos.add(u);
     totalundos += u->size;
+    MEMTRACK(MEM_UNDO, u->size);
     pruneundos(undomegs<<20);
 }
 
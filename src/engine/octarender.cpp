@@ -4,7 +4,7 @@
 
 struct vboinfo
 {
-    int uses;
+    int uses, len;
     uchar *data;
 };
 
@@ -36,7 +36,11 @@ void destroyvbo(GLuint vbo)
     if(!vbi.uses)
     {
         glDeleteBuffers_(1, &vbo);
-        if(vbi.data) delete[] vbi.data;
+        if(vbi.data)
+        {
+            MEMTRACK(MEM_VA, -vbi.len);
+            delete[] vbi.data;
+        }
         vbos.remove(vbo);
     }
 }
@@ -52,8 +56,10 @@ void genvbo(int type, void *buf, int len, vtxarray **vas, int numva)
 
     vboinfo &vbi = vbos[vbo];
     vbi.uses = numva;
+    vbi.len = len;
     vbi.data = new uchar[len];
     memcpy(vbi.data, buf, len);
+    MEMTRACK(MEM_VA, len);
 
     if(printvbo) conoutf(CON_DEBUG, "vbo %d: type %d, size %d, %d uses", vbo, type, len, numva);
 
@@ -471,6 +477,7 @@ struct vacollect : verthash
         if(va->matsurfs)
         {
             va->matbuf = new materialsurface[matsurfs.length()];
+            MEMTRACK(MEM_VA, va->matsurfs*sizeof(materialsurface));
             memcpy(va->matbuf, matsurfs.getbuf(), matsurfs.length()*sizeof(materialsurface));
             loopv(matsurfs)
             {
@@ -512,6 +519,7 @@ struct vacollect : verthash
         if(va->texs)
         {
             va->texelems = new elementset[va->texs];
+            MEMTRACK(MEM_VA, va->texs*sizeof(elementset));
             ushort *edata = (ushort *)addvbo(va, VBO_EBUF, worldtris, sizeof(ushort)), *curbuf = edata;
             loopv(texs)
             {
@@ -568,6 +576,7 @@ struct vacollect : verthash
         if(va->decaltexs)
         {
             va->decalelems = new elementset[va->decaltexs];
+            MEMTRACK(MEM_VA, va->decaltexs*sizeof(elementset));
             ushort *edata = (ushort *)addvbo(va, VBO_DECALBUF, decaltris, sizeof(ushort)), *curbuf = edata;
             loopv(decaltexs)
             {
@@ -1126,6 +1135,7 @@ vector<vtxarray *> valist, varoot;
 vtxarray *newva(const ivec &o, int size)
 {
     vtxarray *va = new vtxarray;
+    MEMTRACK(MEM_VA, sizeof(vtxarray));
     va->parent = NULL;
     va->o = o;
     va->size = size;
@@ -1186,6 +1196,7 @@ void destroyva(vtxarray *va, bool reparent)
     if(va->texelems) delete[] va->texelems;
     if(va->decalelems) delete[] va->decalelems;
     if(va->matbuf) delete[] va->matbuf;
+    MEMTRACK(MEM_VA, -llong(sizeof(vtxarray) + (va->texs + va->decaltexs)*sizeof(elementset) + va->matsurfs*sizeof(materialsurface)));
     delete va;
 }
 
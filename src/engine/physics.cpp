@@ -1924,6 +1924,7 @@ int physsteps = 0, physframetime = PHYSFRAMETIME, lastphysframe = 0;
 
 void physicsframe()          // optimally schedule physics frames inside the graphics frames
 {
+    PROFSCOPE("physicsframe");
     int diff = lastmillis - lastphysframe;
     if(diff <= 0) physsteps = 0;
     else
@@ -0,0 +1,247 @@
+// profiler.cpp: hierarchical cpu profiler with per-thread event buffers and chrome trace export
+
+#include "engine.h"
+
+#ifndef WIN32
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+// every thread that enters a PROFSCOPE gets its own event buffer, so recording never takes a lock;
+// the buffers are folded into the call tree and optionally the trace once per frame by profframe(),
+// at which point the worker pools are idle
+
+void profreset();
+VARF(profiler, 0, 0, 1, profreset());
+
+ullong profmicros()
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq = { { 0, 0 } };
+    if(!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    ullong ticks = now.QuadPart, rate = freq.QuadPart;
+    return (ticks/rate)*1000000 + (ticks%rate)*1000000/rate;
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ullong(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ullong(tv.tv_sec)*1000000 + tv.tv_usec;
+#endif
+}
+
+struct profevent
+{
+    const char *name;
+    ullong start, end;
+    int depth;
+};
+
+struct profthread
+{
+    int id, depth;
+    vector<profevent> events;
+    profthread *next;
+};
+
+static profthread *volatile profthreads = NULL;
+static SDL_atomic_t numprofthreads;
+static THREADLOCAL profthread *curprofthread = NULL;
+
+static profthread *getprofthread()
+{
+    profthread *t = curprofthread;
+    if(t) return t;
+    t = new profthread;
+    t->id = SDL_AtomicAdd(&numprofthreads, 1);
+    t->depth = 0;
+    do t->next = profthreads; while(!SDL_AtomicCASPtr((void **)&profthreads, t->next, t));
+    curprofthread = t;
+    return t;
+}
+
+int profbegin(const char *name)
+{
+    profthread *t = getprofthread();
+    profevent &e = t->events.add();
+    e.name = name;
+    e.depth = t->depth++;
+    e.end = 0;
+    e.start = profmicros();
+    return t->events.length()-1;
+}
+
+void profend(int idx)
+{
+    ullong end = profmicros();
+    profthread *t = curprofthread;
+    if(!t) return;
+    if(t->events.inrange(idx)) t->events[idx].end = end;
+    if(t->depth > 0) t->depth--;
+}
+
+// call tree: one root per thread, children linked as siblings; totals are accumulated until profreset
+struct profnode
+{
+    const char *name;
+    int thread, parent, child, sibling;
+    ullong total, self, peak;
+    uint calls;
+};
+
+static vector<profnode> profnodes;
+static int profframes = 0;
+
+static int profchild(int parent, int thread, const char *name)
+{
+    int first = parent >= 0 ? profnodes[parent].child : -1;
+    if(parent < 0) { loopv(profnodes) if(profnodes[i].parent < 0 && profnodes[i].thread == thread && profnodes[i].name == name) return i; }
+    else for(int i = first; i >= 0; i = profnodes[i].sibling) if(profnodes[i].name == name) return i;
+    profnode &n = profnodes.add();
+    n.name = name;
+    n.thread = thread;
+    n.parent = parent;
+    n.child = n.sibling = -1;
+    n.total = n.self = n.peak = 0;
+    n.calls = 0;
+    int idx = profnodes.length()-1;
+    if(parent >= 0)
+    {
+        profnodes[idx].sibling = profnodes[parent].child;
+        profnodes[parent].child = idx;
+    }
+    return idx;
+}
+
+struct proftraceevent
+{
+    const char *name;
+    ullong start, dur;
+    int thread;
+};
+
+static vector<proftraceevent> proftrace;
+static int proftraceframes = 0, proftracepending = 0;
+static string proftracefile = "";
+static ullong proftracestart = 0;
+
+static void writeproftrace()
+{
+    stream *f = openutf8file(path(proftracefile), "w");
+    if(!f) { conoutf(CON_ERROR, "could not write trace: %s", proftracefile); proftrace.setsize(0); return; }
+    f->printf("{\"traceEvents\":[\n");
+    loopv(proftrace)
+    {
+        proftraceevent &e = proftrace[i];
+        f->printf("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu}\n", i ? "," : "", e.name, e.thread, e.start > proftracestart ? e.start - proftracestart : 0, e.dur);
+    }
+    f->printf("],\"displayTimeUnit\":\"ms\"}\n");
+    delete f;
+    conoutf("wrote %d trace events to %s", proftrace.length(), proftracefile);
+    proftrace.setsize(0);
+}
+
+static void collectprofthread(profthread &t)
+{
+    static vector<int> stack;
+    stack.setsize(0);
+    loopv(t.events)
+    {
+        profevent &e = t.events[i];
+        while(stack.length() > e.depth) stack.pop();
+        int node = profchild(stack.empty() ? -1 : stack.last(), t.id, e.name);
+        stack.add(node);
+        if(!e.end) continue;
+        ullong dur = e.end > e.start ? e.end - e.start : 0;
+        profnode &n = profnodes[node];
+        n.total += dur;
+        n.self += dur;
+        n.peak = max(n.peak, dur);
+        n.calls++;
+        if(n.parent >= 0 && profnodes[n.parent].self >= dur) profnodes[n.parent].self -= dur;
+        if(proftraceframes > 0)
+        {
+            proftraceevent &te = proftrace.add();
+            te.name = e.name;
+            te.start = e.start;
+            te.dur = dur;
+            te.thread = t.id;
+        }
+    }
+    t.events.setsize(0);
+    t.depth = 0;
+}
+
+void profframe()
+{
+    static int frameevent = -1;
+    if(frameevent >= 0) { profend(frameevent); frameevent = -1; }
+    if(!profiler) return;
+    for(profthread *t = profthreads; t; t = t->next) collectprofthread(*t);
+    profframes++;
+    if(proftraceframes > 0 && !--proftraceframes) writeproftrace();
+    if(proftracepending)
+    {
+        // captures start on a frame boundary so no recorded scope predates the trace origin
+        proftraceframes = proftracepending;
+        proftracepending = 0;
+        proftrace.setsize(0);
+        proftracestart = profmicros();
+    }
+    frameevent = profbegin("frame");
+}
+
+void profreset()
+{
+    for(profthread *t = profthreads; t; t = t->next) { t->events.setsize(0); t->depth = 0; }
+    profnodes.setsize(0);
+    profframes = 0;
+}
+
+static bool profnodecmp(int a, int b) { return profnodes[a].total > profnodes[b].total; }
+
+static void printprofnode(int idx, int depth, ullong threshold)
+{
+    profnode &n = profnodes[idx];
+    if(n.total < threshold) return;
+    defformatstring(indent, "%*s", depth*2, "");
+    conoutf("%s%s: %.3f ms (self %.3f ms), %.1f calls, peak %.3f ms", indent, n.name,
+        n.total/1000.0/profframes, n.self/1000.0/profframes, float(n.calls)/profframes, n.peak/1000.0);
+    vector<int> children;
+    for(int i = n.child; i >= 0; i = profnodes[i].sibling) children.add(i);
+    children.sort(profnodecmp);
+    loopv(children) printprofnode(children[i], depth+1, threshold);
+}
+
+// prints the call tree averaged per frame, limited to the n most expensive scopes
+void profsummary(int *n)
+{
+    if(!profframes) { conoutf(CON_ERROR, "no profiling data (set profiler 1)"); return; }
+    int top = *n > 0 ? *n : 20;
+    vector<int> order;
+    loopv(profnodes) order.add(i);
+    order.sort(profnodecmp);
+    ullong threshold = order.inrange(top-1) ? profnodes[order[top-1]].total : 0;
+    conoutf("profile over %d frames:", profframes);
+    loopv(order) if(profnodes[order[i]].parent < 0)
+    {
+        conoutf("thread %d:", profnodes[order[i]].thread);
+        printprofnode(order[i], 1, threshold);
+    }
+}
+COMMAND(profsummary, "i");
+COMMAND(profreset, "");
+
+// records the next n frames and writes them as chrome://tracing json
+void proftracecmd(int *n, char *file)
+{
+    if(proftraceframes > 0 || proftracepending) { conoutf(CON_ERROR, "trace capture already running"); return; }
+    copystring(proftracefile, *file ? file : "profile.json");
+    proftracepending = *n > 0 ? *n : 60;
+    if(!profiler) { profiler = 1; profreset(); }
+}
+COMMANDN(proftrace, proftracecmd, "is");
@@ -1009,6 +1009,8 @@ void setviewcell(const vec &p)
 void clearpvs()
 {
     DELETEP(viewcells);
+    MEMTAG(pvs, MEM_PVS);
+    MEMTAG(pvsbuf, MEM_PVS);
     pvs.setsize(0);
     pvsbuf.setsize(0);
     curpvs = NULL;
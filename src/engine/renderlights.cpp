@@ -4389,6 +4389,7 @@ void workinoq()
     if(drawtex) return;
 
     game::rendergame();
+    prepareskelposes();
 
     if(shouldworkinoq())
     {
@@ -10,6 +10,7 @@ model *loadingmodel = NULL;
 extern vector<int> lua_anims;
 
 #include "ragdoll.h"
+#include "modelcache.h"
 #include "animmodel.h"
 #include "vertmodel.h"
 #include "skelmodel.h"
@@ -679,6 +680,29 @@ void rendermapmodelbatches()
     disableaamask();
 }
 
+// poses the skeletons of all dynamic models that passed frustum culling before any pass renders them,
+// so the pose work can be spread over the anim threads instead of happening lazily on the main thread
+void prepareskelposes()
+{
+    if(!animthreads) return;
+    skelmodel::deferposes = true;
+    loopv(batches)
+    {
+        modelbatch &b = batches[i];
+        if(b.flags&MDL_MAPMODEL || !b.m->skeletal()) continue;
+        for(int j = b.batched; j >= 0;)
+        {
+            batchedmodel &bm = batchedmodels[j];
+            j = bm.next;
+            if(bm.anim&ANIM_RAGDOLL || cullmodel(b.m, bm.center, bm.radius, bm.flags&(MDL_CULL_VFC|MDL_CULL_DIST), bm.d)) continue;
+            modelattach *a = bm.attached >= 0 ? &modelattached[bm.attached] : NULL;
+            b.m->render(bm.anim|ANIM_NORENDER, bm.basetime, bm.basetime2, bm.pos, bm.yaw, bm.pitch, bm.roll, bm.d, a, bm.sizescale, bm.colorscale);
+        }
+    }
+    skelmodel::deferposes = false;
+    runskelposejobs();
+}
+
 float transmdlsx1 = -1, transmdlsy1 = -1, transmdlsx2 = 1, transmdlsy2 = 1;
 uint transmdltiles[LIGHTTILE_MAXH];
 
@@ -757,6 +781,91 @@ void rendermodelbatches()
     disableaamask();
 }
 
+// poses a crowd of characters on a synthetic skeleton through the skel cache, so the CPU pose path can be timed without any models or GL
+void benchskel(int *numchars, int *numstates, int *iterations)
+{
+    const int numbones = 64, numframes = 64;
+    int chars = *numchars > 0 ? *numchars : 200, states = *numstates > 0 ? min(*numstates, chars) : chars, n = *iterations > 0 ? *iterations : 100;
+
+    skelmodel::skeleton *skel = new skelmodel::skeleton;
+    skel->numbones = skel->numinterpbones = numbones;
+    skel->numframes = numframes;
+    skel->bones = new skelmodel::boneinfo[numbones];
+    loopi(numbones)
+    {
+        skelmodel::boneinfo &b = skel->bones[i];
+        b.parent = i > 0 ? (i%5 ? i-1 : i/5) : -1;
+        b.interpindex = i;
+        b.interpparent = b.parent;
+    }
+    skel->framebones = new dualquat[numbones*numframes];
+    loopi(numbones*numframes)
+    {
+        quat q(rndscale(2)-1, rndscale(2)-1, rndscale(2)-1, rndscale(2)-1);
+        q.normalize();
+        skel->framebones[i] = dualquat(q, vec(rndscale(2)-1, rndscale(2)-1, rndscale(2)-1));
+    }
+
+    skelmodel::skelpart part(NULL);
+    uchar partmask[numbones];
+    memset(partmask, 0, sizeof(partmask));
+    part.partmask = partmask;
+
+    vector<animmodel::animstate> anims;
+    loopi(chars)
+    {
+        animmodel::animstate &as = anims.add();
+        int state = i%states;
+        as.owner = &part;
+        as.cur.anim = as.prev.anim = ANIM_LOOP;
+        as.cur.fr1 = state%numframes;
+        as.cur.fr2 = (as.cur.fr1+1)%numframes;
+        as.prev.fr1 = (state*7)%numframes;
+        as.prev.fr2 = (as.prev.fr1+1)%numframes;
+        as.interp = state%3 ? 1 : 0.5f;
+    }
+
+    int oldmillis = lastmillis, oldsimd = skelsimd;
+    const char *modes[3] = { "scalar", "simd", "threaded" };
+    int nummodes = animthreads ? 3 : 2;
+    // the default build uses -ffast-math, so the simd and threaded poses are only expected to match the scalar ones within rounding
+    dualquat reference[numbones];
+    float maxdiff[3] = { 0, 0, 0 };
+    loopk(nummodes)
+    {
+        skelsimd = k ? oldsimd : 0;
+        skel->cleanup(false);
+        Uint32 start = SDL_GetTicks();
+        loopj(n)
+        {
+            lastmillis++;
+            skelmodel::deferposes = k == 2;
+            loopv(anims)
+            {
+                animmodel::animstate &as = anims[i];
+                as.cur.t = as.prev.t = fmod(j*0.13f + (i%states)*0.017f, 1.0f);
+                skel->checkskelcache(&part, &as, 0, vec(1, 0, 0), vec(0, 1, 0), NULL);
+            }
+            skelmodel::deferposes = false;
+            runskelposejobs();
+        }
+        Uint32 end = SDL_GetTicks();
+        skelmodel::skelcacheentry &sc = skel->checkskelcache(&part, &anims[0], 0, vec(1, 0, 0), vec(0, 1, 0), NULL);
+        if(!k) memcpy(reference, sc.bdata, sizeof(reference));
+        else
+        {
+            const float *a = (const float *)sc.bdata, *b = (const float *)reference;
+            loopi(numbones*sizeof(dualquat)/sizeof(float)) maxdiff[k] = max(maxdiff[k], fabs(a[i] - b[i]));
+        }
+        conoutf("benchskel %s: %d characters, %d poses, %.3f ms per frame", modes[k], chars, states, float(end - start) / n);
+    }
+    for(int k = 1; k < nummodes; k++) conoutf("benchskel: %s %s scalar (max difference %g)", modes[k], maxdiff[k] <= 1e-4f ? "matches" : "differs from", maxdiff[k]);
+    skelsimd = oldsimd;
+    lastmillis = oldmillis;
+    delete skel;
+}
+COMMAND(benchskel, "iii");
+
 void rendertransparentmodelbatches(int stencil)
 {
     enableaamask(stencil);
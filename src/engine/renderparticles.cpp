@@ -3,6 +3,10 @@
 #include "engine.h"
 #include "game.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 Shader *particleshader = NULL, *particlenotextureshader = NULL, *particlesoftshader = NULL, *particletextshader = NULL;
 
 VARP(particlelayers, 0, 1, 1);
@@ -190,6 +194,7 @@ struct partrenderer
     virtual void resettracked(physent *owner) { }
     virtual particle *addpart(const vec &o, const vec &d, int fade, const vec &color, float size, int gravity = 0) = 0;
     virtual void update() { }
+    virtual void genchunk(int start, int end) { }
     virtual void render() = 0;
     virtual bool haswork() = 0;
     virtual int count() = 0; //for debug
@@ -349,6 +354,7 @@ struct listrenderer : partrenderer
         if(!parempty)
         {
             T *ps = new T[256];
+            MEMTRACK(MEM_PARTICLES, 256*sizeof(T));
             loopi(255) ps[i].next = &ps[i+1];
             ps[255].next = parempty;
             parempty = ps;
@@ -708,17 +714,53 @@ inline void seedpos<PT_TRAIL>(particleemitter &pe, const vec &o, const vec &d, i
     pe.extendbb(e, size);
 }
 
+VARP(particlesimd, 0, 1, 1);
+VARP(particlethreads, 0, 0, 16);
+
+#define PARTICLECHUNK 1024
+
+// large vertex array renderers split their update into chunks of PARTICLECHUNK particles on the particle workers
+static jobpool particlepool("particle worker");
+
+static void runparticlechunk(void *data, int start, int end, int worker)
+{
+    ((partrenderer *)data)->genchunk(start, end);
+}
+
+static void genparticlechunks(partrenderer *owner, int numparts)
+{
+    particlepool.setthreads(particlethreads);
+    if(numparts < 2*PARTICLECHUNK) { owner->genchunk(0, numparts); return; }
+    particlepool.run(numparts, PARTICLECHUNK, runparticlechunk, owner);
+}
+
+template<class T> static inline void newparticlearray(T *&buf, int n)
+{
+    delete[] buf;
+    buf = new T[(n+3)&~3];
+}
+
 template<int T>
 struct varenderer : partrenderer
 {
     partvert *verts;
-    particle *parts;
-    int maxparts, numparts, lastupdate, rndmask;
+    particle *staged;
+    int maxparts, numparts, numstaged, lastupdate, rndmask;
     GLuint vbo;
 
+    // live particles are kept as structure of arrays so the update can work on 4 at a time,
+    // new ones are staged as plain particles until the next update moves them in
+    float *ox, *oy, *oz, *dx, *dy, *dz, *sizes, *vals;
+    vec *colors;
+    int *gravities, *fades, *millis;
+    uchar *flags;
+    physent **owners;
+
     varenderer(const char *texname, int type, int stain = -1)
         : partrenderer(texname, 3, type|T, stain),
-          verts(NULL), parts(NULL), maxparts(0), numparts(0), lastupdate(-1), rndmask(0), vbo(0)
+          verts(NULL), staged(NULL), maxparts(0), numparts(0), numstaged(0), lastupdate(-1), rndmask(0), vbo(0),
+          ox(NULL), oy(NULL), oz(NULL), dx(NULL), dy(NULL), dz(NULL), sizes(NULL), vals(NULL), colors(NULL),
+          gravities(NULL), fades(NULL), millis(NULL), flags(NULL), owners(NULL)
     {
         if(type & PT_HFLIP) rndmask |= 0x01;
         if(type & PT_VFLIP) rndmask |= 0x02;
@@ -726,6 +768,23 @@ struct varenderer : partrenderer
         if(type & PT_RND4) rndmask |= 0x03<<5;
     }
 
+    static int partbytes()
+    {
+        return sizeof(particle) + 4*sizeof(partvert) + 8*sizeof(float) + sizeof(vec) + 3*sizeof(int) + sizeof(uchar) + sizeof(physent *);
+    }
+
+    ~varenderer()
+    {
+        MEMTRACK(MEM_PARTICLES, -llong(maxparts)*partbytes());
+        DELETEA(verts);
+        DELETEA(staged);
+        DELETEA(ox); DELETEA(oy); DELETEA(oz);
+        DELETEA(dx); DELETEA(dy); DELETEA(dz);
+        DELETEA(sizes); DELETEA(vals); DELETEA(colors);
+        DELETEA(gravities); DELETEA(fades); DELETEA(millis);
+        DELETEA(flags); DELETEA(owners);
+    }
+
     void cleanup()
     {
         if(vbo) { glDeleteBuffers_(1, &vbo); vbo = 0; }
@@ -733,45 +792,94 @@ struct varenderer : partrenderer
 
     void init(int n)
     {
-        DELETEA(parts);
-        DELETEA(verts);
-        parts = new particle[n];
-        verts = new partvert[n*4];
+        newparticlearray(staged, n);
+        newparticlearray(verts, n*4);
+        newparticlearray(ox, n); newparticlearray(oy, n); newparticlearray(oz, n);
+        newparticlearray(dx, n); newparticlearray(dy, n); newparticlearray(dz, n);
+        newparticlearray(sizes, n); newparticlearray(vals, n); newparticlearray(colors, n);
+        newparticlearray(gravities, n); newparticlearray(fades, n); newparticlearray(millis, n);
+        newparticlearray(flags, n); newparticlearray(owners, n);
+        MEMTRACK(MEM_PARTICLES, llong(n - maxparts)*partbytes());
         maxparts = n;
-        numparts = 0;
+        numparts = numstaged = 0;
         lastupdate = -1;
     }
 
     void reset()
     {
-        numparts = 0;
+        numparts = numstaged = 0;
         lastupdate = -1;
     }
 
+    void getpart(int i, particle &p) const
+    {
+        p.o = vec(ox[i], oy[i], oz[i]);
+        p.d = vec(dx[i], dy[i], dz[i]);
+        p.gravity = gravities[i];
+        p.fade = fades[i];
+        p.millis = millis[i];
+        p.color = colors[i];
+        p.flags = flags[i];
+        p.size = sizes[i];
+        p.val = vals[i];
+        p.owner = owners[i];
+    }
+
+    void setpart(int i, const particle &p)
+    {
+        ox[i] = p.o.x; oy[i] = p.o.y; oz[i] = p.o.z;
+        dx[i] = p.d.x; dy[i] = p.d.y; dz[i] = p.d.z;
+        gravities[i] = p.gravity;
+        fades[i] = p.fade;
+        millis[i] = p.millis;
+        colors[i] = p.color;
+        flags[i] = p.flags;
+        sizes[i] = p.size;
+        vals[i] = p.val;
+        owners[i] = p.owner;
+    }
+
+    void movepart(int dst, int src)
+    {
+        ox[dst] = ox[src]; oy[dst] = oy[src]; oz[dst] = oz[src];
+        dx[dst] = dx[src]; dy[dst] = dy[src]; dz[dst] = dz[src];
+        gravities[dst] = gravities[src];
+        fades[dst] = fades[src];
+        millis[dst] = millis[src];
+        colors[dst] = colors[src];
+        flags[dst] = flags[src] | 0x80;
+        sizes[dst] = sizes[src];
+        vals[dst] = vals[src];
+        owners[dst] = owners[src];
+    }
+
     void resettracked(physent *owner)
     {
         if(!(type&PT_TRACK)) return;
         loopi(numparts)
         {
-            particle *p = parts+i;
-            if(!owner || (p->owner == owner)) p->fade = -1;
+            if(!owner || owners[i] == owner) fades[i] = -1;
+        }
+        loopi(numstaged)
+        {
+            if(!owner || staged[i].owner == owner) staged[i].fade = -1;
         }
         lastupdate = -1;
     }
 
     int count()
     {
-        return numparts;
+        return numparts + numstaged;
     }
 
     bool haswork()
     {
-        return (numparts > 0);
+        return numparts > 0 || numstaged > 0;
     }
 
     particle *addpart(const vec &o, const vec &d, int fade, const vec &color, float size, int gravity)
     {
-        particle *p = parts + (numparts < maxparts ? numparts++ : rnd(maxparts)); //next free slot, or kill a random kitten
+        particle *p = staged + (numstaged < maxparts ? numstaged++ : rnd(maxparts)); //next free slot, or kill a random kitten
         p->o = o;
         p->d = d;
         p->gravity = gravity;
@@ -779,6 +887,7 @@ struct varenderer : partrenderer
         p->millis = lastmillis + emitoffset;
         p->color = color;
         p->size = size;
+        p->val = 0;
         p->owner = NULL;
         p->flags = 0x80 | (rndmask ? rnd(0x80) & rndmask : 0);
         lastupdate = -1;
@@ -804,21 +913,11 @@ struct varenderer : partrenderer
         if(tpeak > 0 && tpeak < fade) pe.extendbb(o.z + 1.5f*d.z*tpeak/5000.0f, size);
     }
 
-    void genverts(particle *p, partvert *vs, bool regen)
+    void gencolors(uchar &pflags, const vec &color, partvert *vs, bool regen, float blendf)
     {
-        vec o, d;
-        int blend, ts;
-        float size;
-
-        calc(p, blend, ts, size, o, d);
-        if(blend <= 1 || p->fade <= 5) p->fade = -1; //mark to remove on next pass (i.e. after render)
-
-        modifyblend<T>(o, blend);
-        float blendf = blend / 255.0f;
-
         if(regen)
         {
-            p->flags &= ~0x80;
+            pflags &= ~0x80;
 
             #define SETTEXCOORDS(u1c, u2c, v1c, v2c, body) \
             { \
@@ -835,16 +934,16 @@ struct varenderer : partrenderer
             }
             if(type&PT_RND4)
             {
-                float tx = 0.5f*((p->flags>>5)&1), ty = 0.5f*((p->flags>>6)&1);
+                float tx = 0.5f*((pflags>>5)&1), ty = 0.5f*((pflags>>6)&1);
                 SETTEXCOORDS(tx, tx + 0.5f, ty, ty + 0.5f,
                 {
-                    if(p->flags&0x01) swap(u1, u2);
-                    if(p->flags&0x02) swap(v1, v2);
+                    if(pflags&0x01) swap(u1, u2);
+                    if(pflags&0x02) swap(v1, v2);
                 });
             }
             else if(type&PT_ICONGRID)
             {
-                float tx = 0.25f*(p->flags&3), ty = 0.25f*((p->flags>>2)&3);
+                float tx = 0.25f*(pflags&3), ty = 0.25f*((pflags>>2)&3);
                 SETTEXCOORDS(tx, tx + 0.25f, ty, ty + 0.25f, {});
             }
             else SETTEXCOORDS(0, 1, 0, 1, {});
@@ -854,36 +953,122 @@ struct varenderer : partrenderer
                 vec4 col(r, g, b, a); \
                 loopi(4) vs[i].color = col; \
             } while(0)
-            #define SETMODCOLOR SETCOLOR(p->color.r*blendf, p->color.g*blendf, p->color.b*blendf, 1.0f)
+            #define SETMODCOLOR SETCOLOR(color.r*blendf, color.g*blendf, color.b*blendf, 1.0f)
             if(type&PT_MOD) SETMODCOLOR;
-            else SETCOLOR(p->color.r, p->color.g, p->color.b, blendf);
+            else SETCOLOR(color.r, color.g, color.b, blendf);
         }
         else if(type&PT_MOD) SETMODCOLOR;
         else loopi(4) vs[i].color.a = blendf;
+    }
+
+    void genverts(particle *p, partvert *vs, bool regen)
+    {
+        vec o, d;
+        int blend, ts;
+        float size;
+
+        calc(p, blend, ts, size, o, d);
+        if(blend <= 1 || p->fade <= 5) p->fade = -1; //mark to remove on next pass (i.e. after render)
+
+        modifyblend<T>(o, blend);
+        gencolors(p->flags, p->color, vs, regen, blend / 255.0f);
 
         if(type&PT_ROT) genrotpos<T>(o, d, size, ts, p->gravity, vs, (p->flags>>2)&0x1F);
         else genpos<T>(o, d, size, ts, p->gravity, vs);
     }
 
-    void genverts()
+    void genverts(int i)
     {
-        loopi(numparts)
+        particle p;
+        getpart(i, p);
+        genverts(&p, &verts[i*4], (p.flags&0x80)!=0);
+        fades[i] = p.fade;
+        flags[i] = p.flags;
+        vals[i] = p.val;
+    }
+
+#ifdef __SSE2__
+    // plain quads without tracking, collision, rotation or resizing: moves 4 particles along their
+    // gravity arcs and builds their corners at once, blend stays scalar to match calc() exactly
+    void genverts4(int i)
+    {
+        float t[4], weight[4];
+        loopk(4)
         {
-            particle *p = &parts[i];
-            partvert *vs = &verts[i*4];
-            if(p->fade < 0)
+            int j = i+k, blend = 255, fade = fades[j];
+            t[k] = 0;
+            weight[k] = 1;
+            if(fade > 5)
             {
-                do
+                int ts = lastmillis-millis[j];
+                blend = max(255 - (ts<<8)/fade, 0);
+                if(gravities[j])
                 {
-                    --numparts;
-                    if(numparts <= i) return;
+                    t[k] = min(ts, fade);
+                    weight[k] = gravities[j];
                 }
-                while(parts[numparts].fade < 0);
-                *p = parts[numparts];
-                genverts(p, vs, true);
             }
-            else genverts(p, vs, (p->flags&0x80)!=0);
+            if(blend <= 1 || fade <= 5) fades[j] = -1;
+            modifyblend<T>(vec(0, 0, 0), blend);
+            gencolors(flags[j], colors[j], &verts[j*4], (flags[j]&0x80)!=0, blend / 255.0f);
         }
+        __m128 tv = _mm_loadu_ps(t), k = _mm_div_ps(tv, _mm_set1_ps(5000.0f)),
+               x = _mm_add_ps(_mm_loadu_ps(&ox[i]), _mm_mul_ps(_mm_loadu_ps(&dx[i]), k)),
+               y = _mm_add_ps(_mm_loadu_ps(&oy[i]), _mm_mul_ps(_mm_loadu_ps(&dy[i]), k)),
+               z = _mm_add_ps(_mm_loadu_ps(&oz[i]), _mm_mul_ps(_mm_loadu_ps(&dz[i]), k)),
+               size = _mm_loadu_ps(&sizes[i]);
+        z = _mm_sub_ps(z, _mm_div_ps(_mm_mul_ps(tv, tv), _mm_mul_ps(_mm_set1_ps(2.0f * 5000.0f), _mm_loadu_ps(weight))));
+        vec u = vec(camup).sub(camright), v = vec(camup).add(camright);
+        __m128 ux = _mm_mul_ps(_mm_set1_ps(u.x), size), uy = _mm_mul_ps(_mm_set1_ps(u.y), size), uz = _mm_mul_ps(_mm_set1_ps(u.z), size),
+               vx = _mm_mul_ps(_mm_set1_ps(v.x), size), vy = _mm_mul_ps(_mm_set1_ps(v.y), size), vz = _mm_mul_ps(_mm_set1_ps(v.z), size);
+        float corners[12][4];
+        _mm_storeu_ps(corners[0], _mm_add_ps(x, ux)); _mm_storeu_ps(corners[1], _mm_add_ps(y, uy)); _mm_storeu_ps(corners[2], _mm_add_ps(z, uz));
+        _mm_storeu_ps(corners[3], _mm_add_ps(x, vx)); _mm_storeu_ps(corners[4], _mm_add_ps(y, vy)); _mm_storeu_ps(corners[5], _mm_add_ps(z, vz));
+        _mm_storeu_ps(corners[6], _mm_sub_ps(x, ux)); _mm_storeu_ps(corners[7], _mm_sub_ps(y, uy)); _mm_storeu_ps(corners[8], _mm_sub_ps(z, uz));
+        _mm_storeu_ps(corners[9], _mm_sub_ps(x, vx)); _mm_storeu_ps(corners[10], _mm_sub_ps(y, vy)); _mm_storeu_ps(corners[11], _mm_sub_ps(z, vz));
+        loopk(4)
+        {
+            partvert *vs = &verts[(i+k)*4];
+            loopj(4) vs[j].pos = vec(corners[j*3][k], corners[j*3+1][k], corners[j*3+2][k]);
+        }
+    }
+#endif
+
+    bool threadsafe() const
+    {
+        return !(type&(PT_TRACK|PT_COLLIDE));
+    }
+
+    void genchunk(int start, int end)
+    {
+        int i = start;
+#ifdef __SSE2__
+        if(particlesimd && T == PT_PART && !(type&(PT_TRACK|PT_COLLIDE|PT_ROT|PT_SHRINK|PT_GROW)))
+            for(; i + 4 <= end; i += 4) genverts4(i);
+#endif
+        for(; i < end; i++) genverts(i);
+    }
+
+    void flushparts()
+    {
+        for(int i = 0; i < numparts;)
+        {
+            if(fades[i] >= 0) { i++; continue; }
+            if(--numparts > i) movepart(i, numparts);
+        }
+        loopi(numstaged)
+        {
+            if(staged[i].fade < 0) continue;
+            setpart(numparts < maxparts ? numparts++ : rnd(maxparts), staged[i]);
+        }
+        numstaged = 0;
+    }
+
+    void genverts()
+    {
+        flushparts();
+        if(threadsafe()) genparticlechunks(this, numparts);
+        else genchunk(0, numparts);
     }
 
     void genvbo()
@@ -930,6 +1115,42 @@ typedef varenderer<PT_PART> quadrenderer;
 typedef varenderer<PT_TAPE> taperenderer;
 typedef varenderer<PT_TRAIL> trailrenderer;
 
+// updates a synthetic cloud of quad particles through the vertex array renderer without touching GL
+void benchparticles(int *numparts, int *iterations)
+{
+    int n = *numparts > 0 ? *numparts : 10000, iters = *iterations > 0 ? *iterations : 100;
+    quadrenderer r(NULL, PT_FLIP);
+    r.init(n);
+    loopi(n) r.addpart(vec(rndscale(1024), rndscale(1024), rndscale(512)), vec(rndscale(200)-100, rndscale(200)-100, rndscale(200)), 1000000, vec(1, 1, 1), 1 + rndscale(4), rnd(4) ? 20 + rnd(200) : 0);
+    r.flushparts();
+
+    int oldmillis = lastmillis;
+    const char *modes[3] = { "scalar", "simd", "threaded" };
+    int nummodes = particlethreads ? 3 : 2;
+    uint check[3] = { 0, 0, 0 };
+    loopk(nummodes)
+    {
+        int oldsimd = particlesimd;
+        if(!k) particlesimd = 0;
+        lastmillis = oldmillis;
+        loopi(r.numparts) r.flags[i] |= 0x80;
+        Uint32 start = SDL_GetTicks();
+        loopj(iters)
+        {
+            lastmillis++;
+            if(k == 2) r.genverts();
+            else r.genchunk(0, r.numparts);
+        }
+        Uint32 end = SDL_GetTicks();
+        particlesimd = oldsimd;
+        check[k] = crc32(0, (const Bytef *)r.verts, r.numparts*4*sizeof(partvert));
+        conoutf("benchparticles %s: %d particles, %.3f ms per update", modes[k], r.numparts, float(end - start) / iters);
+    }
+    conoutf("benchparticles: simd %s scalar", check[1] == check[0] ? "matches" : "differs from");
+    lastmillis = oldmillis;
+}
+COMMAND(benchparticles, "ii");
+
 #include "explosion.h"
 #include "lensflare.h"
 #include "lightning.h"
@@ -1514,6 +1735,7 @@ FVARFP(editpartsize, 0.0f, 4.0f, 100.0f, initparticles());
 
 void updateparticles()
 {
+    PROFSCOPE("updateparticles");
     if(regenemitters) addparticleemitters();
 
     if(minimized) { canemit = false; return; }
@@ -164,6 +164,7 @@ static inline void findvisiblevas(vector<vtxarray *> &vas)
 
 void findvisiblevas()
 {
+    PROFSCOPE("findvisiblevas");
     memset(vasort, 0, sizeof(vasort));
     findvisiblevas<false, false>(varoot);
     sortvisiblevas();
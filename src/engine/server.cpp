@@ -3,12 +3,17 @@
 
 #include "engine.h"
 
+#ifndef WIN32
+#include <signal.h>
+#endif
+
 #define LOGSTRLEN 512
 
 static FILE *logfile = NULL;
 
 void closelogfile()
 {
+    logger::stopwriter();
     if(logfile)
     {
         fclose(logfile);
@@ -27,6 +32,7 @@ FILE *getlogfile()
 
 void setlogfile(const char *fname)
 {
+    bool async = logger::writing();
     closelogfile();
     if(fname && fname[0])
     {
@@ -35,6 +41,7 @@ void setlogfile(const char *fname)
     }
     FILE *f = getlogfile();
     if(f) setvbuf(f, NULL, _IOLBF, BUFSIZ);
+    if(async) logger::startwriter();
 }
 
 void logoutf(const char *fmt, ...)
@@ -624,8 +631,34 @@ void updatetime()
     }
 }
 
+#ifdef MEMSTATS
+static float luaheapkb() { return lua::L ? lua_gc(lua::L, LUA_GCCOUNT, 0) + lua_gc(lua::L, LUA_GCCOUNTB, 0)/1024.0f : 0; }
+
+void memstats()
+{
+    llong total = 0;
+    loopi(MEM_NUMTAGS)
+    {
+        conoutf("%-10s %10.1f KB (peak %.1f KB)", memtagnames[i], memcurrent(i)/1024.0f, mempeak(i)/1024.0f);
+        total += memcurrent(i);
+    }
+    conoutf("%-10s %10.1f KB", "lua", luaheapkb());
+    conoutf("%-10s %10.1f KB", "total", total/1024.0f + luaheapkb());
+}
+COMMAND(memstats, "");
+
+static void logmemstats()
+{
+    char line[512] = "memory:";
+    loopi(MEM_NUMTAGS) if(mempeak(i)) concformatstring(line, " %s %.1fK/%.1fK", memtagnames[i], memcurrent(i)/1024.0f, mempeak(i)/1024.0f);
+    concformatstring(line, " lua %.1fK", luaheapkb());
+    logoutf("%s", line);
+}
+#endif
+
 void serverslice(bool dedicated, uint timeout)   // main server update, called from main loop in sp, or from below in dedicated server
 {
+    PROFSCOPE("serverslice");
     if(!serverhost)
     {
         server::serverupdate();
@@ -648,7 +681,10 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
         totalmillis = millis;
         updatetime();
     }
-    server::serverupdate();
+    {
+        PROFSCOPE("serverupdate");
+        server::serverupdate();
+    }
 
     flushmasteroutput();
     checkserversockets();
@@ -661,6 +697,9 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
         laststatus = totalmillis;
         if(nonlocalclients || serverhost->totalSentData || serverhost->totalReceivedData) logoutf("status: %d remote clients, %.1f send, %.1f rec (K/sec)", nonlocalclients, serverhost->totalSentData/60.0f/1024, serverhost->totalReceivedData/60.0f/1024);
         serverhost->totalSentData = serverhost->totalReceivedData = 0;
+#ifdef MEMSTATS
+        if(dedicated) logmemstats();
+#endif
     }
 
     ENetEvent event;
@@ -710,8 +749,12 @@ void serverslice(bool dedicated, uint timeout)   // main server update, called f
 
     if (!dedicated) return;
 
+    flushvarchanges();
     if(lastmillis && lua::L)
+    {
+        PROFSCOPE("frame_handle");
         lua::call_external("frame_handle", "ii", curtime, lastmillis);
+    }
 }
 
 void flushserver(bool force)
@@ -822,6 +865,7 @@ static BOOL WINAPI consolehandler(DWORD dwCtrlType)
         case CTRL_C_EVENT:
         case CTRL_BREAK_EVENT:
         case CTRL_CLOSE_EVENT:
+            closelogfile();
             exit(EXIT_SUCCESS);
             return TRUE;
     }
@@ -997,19 +1041,20 @@ void logoutfv(const char *fmt, va_list args)
     {
         logline &line = loglines.add();
         vformatstring(line.buf, fmt, args, sizeof(line.buf));
-        if(logfile) writelog(logfile, line.buf);
+        if(logfile && !logger::postline(line.buf)) writelog(logfile, line.buf);
         line.len = min(strlen(line.buf), sizeof(line.buf)-2);
         line.buf[line.len++] = '\n';
         line.buf[line.len] = '\0';
         if(outhandle) writeline(line);
     }
-    else if(logfile) writelogv(logfile, fmt, args);
+    else if(logfile && !logger::post(LOGPLAIN, fmt, args)) writelogv(logfile, fmt, args);
 }
 
 #else
 
 void logoutfv(const char *fmt, va_list args)
 {
+    if(logger::post(LOGPLAIN, fmt, args)) return;
     FILE *f = getlogfile();
     if(f) writelogv(f, fmt, args);
 }
@@ -1018,6 +1063,13 @@ void logoutfv(const char *fmt, va_list args)
 
 static bool dedicatedserver = false;
 
+#ifndef WIN32
+// the loop notices the flag within one slice and shuts down cleanly, so the log ring gets drained
+static volatile sig_atomic_t serverquitsignal = 0;
+
+static void serverquithandler(int sig) { serverquitsignal = sig; }
+#endif
+
 bool isdedicatedserver() { return dedicatedserver; }
 
 void rundedicatedserver()
@@ -1031,14 +1083,28 @@ void rundedicatedserver()
         MSG msg;
         while(PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
         {
-            if(msg.message == WM_QUIT) exit(EXIT_SUCCESS);
+            if(msg.message == WM_QUIT) { closelogfile(); exit(EXIT_SUCCESS); }
             TranslateMessage(&msg);
             DispatchMessage(&msg);
         }
+        profframe();
         serverslice(true, 5);
+        lua::gccheck();
+        lua::gcidle();
     }
 #else
-    for(;;) serverslice(true, 5);
+    signal(SIGINT, serverquithandler);
+    signal(SIGTERM, serverquithandler);
+    while(!serverquitsignal)
+    {
+        profframe();
+        serverslice(true, 5);
+        lua::gccheck();
+        lua::gcidle();
+    }
+    logoutf("dedicated server stopped by signal %d", int(serverquitsignal));
+    closelogfile();
+    exit(EXIT_SUCCESS);
 #endif
     dedicatedserver = false;
 }
@@ -1150,10 +1216,11 @@ bool serveroption(char *opt)
 
 vector<const char *> gameargs;
 
-#ifdef STANDALONE
+#if defined(STANDALONE) && !defined(BENCH)
 int main(int argc, char **argv)
 {
     setlogfile(NULL);
+    logger::startwriter();
     if(enet_initialize()<0) fatal("Unable to initialise network module");
     atexit(enet_deinitialize);
     enet_time_set(0);
@@ -1162,6 +1229,7 @@ int main(int argc, char **argv)
     lua::init();
     initserver(true, true);
     lua::close();
+    closelogfile();
     return EXIT_SUCCESS;
 }
 #endif
@@ -1,7 +1,14 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 VARP(gpuskel, 0, 1, 1);
 
 VAR(maxskelanimdata, 1, 192, 0);
 
+VAR(skelsimd, 0, 1, 1);
+VARP(animthreads, 0, 0, 16);
+
 #define BONEMASK_NOT  0x8000
 #define BONEMASK_END  0xFFFF
 #define BONEMASK_BONE 0x7FFF
@@ -149,8 +156,11 @@ struct skelmodel : animmodel
     {
         dualquat *bdata;
         int version;
+        uint hash;
+        int nexthash;
+        bool pending;
 
-        skelcacheentry() : bdata(NULL), version(-1) {}
+        skelcacheentry() : bdata(NULL), version(-1), hash(0), nexthash(-2), pending(false) {}
 
         void nextversion()
         {
@@ -416,18 +426,39 @@ struct skelmodel : animmodel
     struct pitchtarget
     {
         int bone, frame, corrects, deps;
-        float pitchmin, pitchmax, deviated;
+        float pitchmin, pitchmax;
         dualquat pose;
     };
 
     struct pitchcorrect
     {
         int bone, target, parent;
-        float pitchmin, pitchmax, pitchscale, pitchangle, pitchtotal;
+        float pitchmin, pitchmax, pitchscale;
 
-        pitchcorrect() : parent(-1), pitchangle(0), pitchtotal(0) {}
+        pitchcorrect() : parent(-1) {}
+    };
+
+    // scratch space for posing a skeleton, one per thread so several poses can be built at once
+    struct posescratch
+    {
+        vector<dualquat> poses, deps;
+        vector<float> deviated, angles, totals;
     };
 
+    static posescratch mainscratch;
+
+    struct skeleton;
+
+    struct posejob
+    {
+        skeleton *skel;
+        int entry, numanimparts;
+        vec axis, forward;
+    };
+
+    static vector<posejob> posejobs;
+    static bool deferposes;
+
     struct skeleton
     {
         char *name;
@@ -436,6 +467,8 @@ struct skelmodel : animmodel
         boneinfo *bones;
         int numbones, numinterpbones, numgpubones, numframes;
         dualquat *framebones;
+        float *soabones;
+        int soaframes;
         vector<skelanimspec> skelanims;
         vector<tag> tags;
         vector<antipode> antipodes;
@@ -448,8 +481,15 @@ struct skelmodel : animmodel
         vector<skelcacheentry> skelcache;
         hashtable<GLuint, int> blendoffsets;
 
-        skeleton() : name(NULL), shared(0), bones(NULL), numbones(0), numinterpbones(0), numgpubones(0), numframes(0), framebones(NULL), ragdoll(NULL), usegpuskel(false), blendoffsets(32)
+        // skelcache entries are shared by every instance posed identically, hashed on the anim state
+        static const int SKELCACHEBUCKETS = 256;
+        int skelcachebuckets[SKELCACHEBUCKETS];
+        int skelcachecursor, skelcachefull;
+
+        skeleton() : name(NULL), shared(0), bones(NULL), numbones(0), numinterpbones(0), numgpubones(0), numframes(0), framebones(NULL), soabones(NULL), soaframes(0), ragdoll(NULL), usegpuskel(false), blendoffsets(32), skelcachecursor(0), skelcachefull(-1)
         {
+            memset(skelcachebuckets, -1, sizeof(skelcachebuckets));
+            MEMTAG(skelcache, MEM_MODEL);
         }
 
         ~skeleton()
@@ -457,9 +497,11 @@ struct skelmodel : animmodel
             DELETEA(name);
             DELETEA(bones);
             DELETEA(framebones);
+            DELETEA(soabones);
             DELETEP(ragdoll);
-            loopv(skelcache)
+            loopv(skelcache) if(skelcache[i].bdata)
             {
+                MEMTRACK(MEM_MODEL, -llong(numinterpbones*sizeof(dualquat)));
                 DELETEA(skelcache[i].bdata);
             }
         }
@@ -489,6 +531,41 @@ struct skelmodel : animmodel
             return sa;
         }
 
+        uint cachekey(uint key)
+        {
+            // anim frames are stored relative to the base pose and antipodally fixed against the first frame
+            loopi(numbones) key = modelcachekey(key, &bones[i].base, sizeof(dualquat));
+            if(numframes > 0) key = modelcachekey(key, framebones, numbones*sizeof(dualquat));
+            return key;
+        }
+
+        void saveanimcache(stream *f, const skelanimspec &sa)
+        {
+            putcachearray(f, &framebones[sa.frame*numbones], sa.range*numbones);
+        }
+
+        skelanimspec *loadanimcache(stream *f, const char *filename)
+        {
+            dualquat *animbones = NULL;
+            int numanimbones = 0;
+            if(!getcachearray(f, animbones, numanimbones) || numanimbones <= 0 || numanimbones%numbones) { DELETEA(animbones); return NULL; }
+            int animframes = numanimbones/numbones;
+            dualquat *allbones = new dualquat[(numframes+animframes)*numbones];
+            if(framebones)
+            {
+                memcpy(allbones, framebones, numframes*numbones*sizeof(dualquat));
+                delete[] framebones;
+            }
+            memcpy(&allbones[numframes*numbones], animbones, numanimbones*sizeof(dualquat));
+            delete[] animbones;
+            framebones = allbones;
+            skelanimspec &sa = addskelanim(filename);
+            sa.frame = numframes;
+            sa.range = animframes;
+            numframes += animframes;
+            return &sa;
+        }
+
         int findbone(const char *name)
         {
             loopi(numbones) if(bones[i].name && !strcmp(bones[i].name, name)) return i;
@@ -783,30 +860,33 @@ struct skelmodel : animmodel
             return atan2f(dy, dx)/RAD;
         }
 
-        void calcpitchcorrects(float pitch, const vec &axis, const vec &forward)
+        void calcpitchcorrects(float pitch, const vec &axis, const vec &forward, posescratch &ps)
         {
+            ps.deviated.setsize(0);
             loopv(pitchtargets)
             {
                 pitchtarget &t = pitchtargets[i];
-                t.deviated = calcdeviation(axis, forward, t.pose, pitchdeps[t.deps].pose);
+                ps.deviated.add(calcdeviation(axis, forward, t.pose, ps.deps[t.deps]));
             }
+            ps.angles.setsize(0);
+            ps.totals.setsize(0);
             loopv(pitchcorrects)
             {
-                pitchcorrect &c = pitchcorrects[i];
-                c.pitchangle = c.pitchtotal = 0;
+                ps.angles.add(0);
+                ps.totals.add(0);
             }
             loopvj(pitchtargets)
             {
                 pitchtarget &t = pitchtargets[j];
-                float tpitch = pitch - t.deviated;
+                float tpitch = pitch - ps.deviated[j];
                 for(int parent = t.corrects; parent >= 0; parent = pitchcorrects[parent].parent)
-                    tpitch -= pitchcorrects[parent].pitchangle;
+                    tpitch -= ps.angles[parent];
                 if(t.pitchmin || t.pitchmax) tpitch = clamp(tpitch, t.pitchmin, t.pitchmax);
                 loopv(pitchcorrects)
                 {
                     pitchcorrect &c = pitchcorrects[i];
                     if(c.target != j) continue;
-                    float total = c.parent >= 0 ? pitchcorrects[c.parent].pitchtotal : 0,
+                    float total = c.parent >= 0 ? ps.totals[c.parent] : 0,
                           avail = tpitch - total,
                           used = tpitch*c.pitchscale;
                     if(c.pitchmin || c.pitchmax)
@@ -816,12 +896,17 @@ struct skelmodel : animmodel
                     }
                     if(used < 0) used = clamp(avail, used, 0.0f);
                     else used = clamp(avail, 0.0f, used);
-                    c.pitchangle = used;
-                    c.pitchtotal = used + total;
+                    ps.angles[i] = used;
+                    ps.totals[i] = used + total;
                 }
             }
         }
 
+        struct framedata
+        {
+            const dualquat *fr1, *fr2, *pfr1, *pfr2;
+        };
+
         #define INTERPBONE(bone) \
             const animstate &s = as[partmask[bone]]; \
             const framedata &f = partframes[partmask[bone]]; \
@@ -834,14 +919,107 @@ struct skelmodel : animmodel
                 d.accumulate(f.pfr2[bone], s.prev.t*(1-s.interp)); \
             }
 
-        void interpbones(const animstate *as, float pitch, const vec &axis, const vec &forward, int numanimparts, const uchar *partmask, skelcacheentry &sc)
+#ifdef __SSE2__
+        // frame bones regrouped into blocks of 4 bones as x/y/z/w rows of the real and dual parts,
+        // so the interpolation below works on 4 bones at once without transposing its inputs
+        void gensoabones()
         {
-            if(!sc.bdata) sc.bdata = new dualquat[numinterpbones];
-            sc.nextversion();
-            struct framedata
+            DELETEA(soabones);
+            soaframes = numframes;
+            int groups = numbones/4;
+            if(!numframes || !groups) return;
+            soabones = new float[numframes*groups*32];
+            loopi(numframes) loopj(groups)
+            {
+                float *dst = &soabones[(i*groups + j)*32];
+                loopk(4)
+                {
+                    const dualquat &d = framebones[i*numbones + j*4 + k];
+                    dst[k] = d.real.x; dst[4+k] = d.real.y; dst[8+k] = d.real.z; dst[12+k] = d.real.w;
+                    dst[16+k] = d.dual.x; dst[20+k] = d.dual.y; dst[24+k] = d.dual.z; dst[28+k] = d.dual.w;
+                }
+            }
+        }
+
+        static inline void accumulateposes(__m128 *d, const float *o, __m128 k)
+        {
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], _mm_loadu_ps(o)), _mm_mul_ps(d[1], _mm_loadu_ps(o+4))), _mm_mul_ps(d[2], _mm_loadu_ps(o+8))), _mm_mul_ps(d[3], _mm_loadu_ps(o+12)));
+            k = _mm_xor_ps(k, _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), _mm_set1_ps(-0.0f)));
+            loopi(8) d[i] = _mm_add_ps(d[i], _mm_mul_ps(_mm_loadu_ps(o + 4*i), k));
+        }
+
+        // same math as INTERPBONE followed by normalize, for a block of 4 bones that share an anim part
+        void interpposes4(const animstate &s, int group, dualquat *poses)
+        {
+            int stride = (numbones/4)*32;
+            const float *fr1 = &soabones[s.cur.fr1*stride + group*32], *fr2 = &soabones[s.cur.fr2*stride + group*32];
+            __m128 d[8], k = _mm_set1_ps((1-s.cur.t)*s.interp);
+            loopi(8) d[i] = _mm_mul_ps(_mm_loadu_ps(fr1 + 4*i), k);
+            accumulateposes(d, fr2, _mm_set1_ps(s.cur.t*s.interp));
+            if(s.interp<1)
+            {
+                accumulateposes(d, &soabones[s.prev.fr1*stride + group*32], _mm_set1_ps((1-s.prev.t)*(1-s.interp)));
+                accumulateposes(d, &soabones[s.prev.fr2*stride + group*32], _mm_set1_ps(s.prev.t*(1-s.interp)));
+            }
+            __m128 invlen = _mm_div_ps(_mm_set1_ps(1), _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], d[0]), _mm_mul_ps(d[1], d[1])), _mm_mul_ps(d[2], d[2])), _mm_mul_ps(d[3], d[3]))));
+            loopi(8) d[i] = _mm_mul_ps(d[i], invlen);
+            _MM_TRANSPOSE4_PS(d[0], d[1], d[2], d[3]);
+            _MM_TRANSPOSE4_PS(d[4], d[5], d[6], d[7]);
+            dualquat *dst = &poses[group*4];
+            loopi(4)
+            {
+                _mm_storeu_ps(&dst[i].real.x, d[i]);
+                _mm_storeu_ps(&dst[i].dual.x, d[4+i]);
+            }
+        }
+
+        static inline __m128 mulquat(__m128 p, __m128 o)
+        {
+            const __m128 sign1 = _mm_setr_ps(0.0f, -0.0f, 0.0f, -0.0f), sign2 = _mm_setr_ps(0.0f, 0.0f, -0.0f, -0.0f), sign3 = _mm_setr_ps(-0.0f, 0.0f, 0.0f, -0.0f);
+            __m128 r = _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3)), o);
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)), _mm_xor_ps(_mm_shuffle_ps(o, o, _MM_SHUFFLE(0, 1, 2, 3)), sign1)));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)), _mm_xor_ps(_mm_shuffle_ps(o, o, _MM_SHUFFLE(1, 0, 3, 2)), sign2)));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2)), _mm_xor_ps(_mm_shuffle_ps(o, o, _MM_SHUFFLE(2, 3, 0, 1)), sign3)));
+            return r;
+        }
+#endif
+
+        static inline void mulpose(dualquat &dst, const dualquat &p, const dualquat &o)
+        {
+#ifdef __SSE2__
+            if(skelsimd)
+            {
+                __m128 preal = _mm_loadu_ps(&p.real.x), pdual = _mm_loadu_ps(&p.dual.x),
+                       oreal = _mm_loadu_ps(&o.real.x), odual = _mm_loadu_ps(&o.dual.x);
+                _mm_storeu_ps(&dst.real.x, mulquat(preal, oreal));
+                _mm_storeu_ps(&dst.dual.x, _mm_add_ps(mulquat(preal, odual), mulquat(pdual, oreal)));
+                return;
+            }
+#endif
+            dst.mul(p, o);
+        }
+
+        void interpposes(const animstate *as, const framedata *partframes, const uchar *partmask, dualquat *poses)
+        {
+            loopi(numbones)
             {
-                const dualquat *fr1, *fr2, *pfr1, *pfr2;
-            } partframes[MAXANIMPARTS];
+#ifdef __SSE2__
+                if(skelsimd && soabones && !(i&3) && i + 4 <= numbones && partmask[i] == partmask[i+1] && partmask[i] == partmask[i+2] && partmask[i] == partmask[i+3])
+                {
+                    interpposes4(as[partmask[i]], i/4, poses);
+                    i += 3;
+                    continue;
+                }
+#endif
+                INTERPBONE(i);
+                d.normalize();
+                poses[i] = d;
+            }
+        }
+
+        void interpbones(const animstate *as, float pitch, const vec &axis, const vec &forward, int numanimparts, const uchar *partmask, skelcacheentry &sc, posescratch &ps)
+        {
+            framedata partframes[MAXANIMPARTS];
             loopi(numanimparts)
             {
                 partframes[i].fr1 = &framebones[as[i].cur.fr1*numbones];
@@ -851,27 +1029,29 @@ struct skelmodel : animmodel
                     partframes[i].pfr1 = &framebones[as[i].prev.fr1*numbones];
                     partframes[i].pfr2 = &framebones[as[i].prev.fr2*numbones];
                 }
+                else partframes[i].pfr1 = partframes[i].pfr2 = partframes[i].fr1;
             }
+            if(ps.poses.length() < numbones) ps.poses.pad(numbones - ps.poses.length());
+            dualquat *poses = ps.poses.getbuf();
+            interpposes(as, partframes, partmask, poses);
+            ps.deps.setsize(0);
             loopv(pitchdeps)
             {
                 pitchdep &p = pitchdeps[i];
-                INTERPBONE(p.bone);
-                d.normalize();
-                if(p.parent >= 0) p.pose.mul(pitchdeps[p.parent].pose, d);
-                else p.pose = d;
+                dualquat &d = ps.deps.add();
+                if(p.parent >= 0) d.mul(ps.deps[p.parent], poses[p.bone]);
+                else d = poses[p.bone];
             }
-            calcpitchcorrects(pitch, axis, forward);
+            calcpitchcorrects(pitch, axis, forward, ps);
             loopi(numbones) if(bones[i].interpindex>=0)
             {
-                INTERPBONE(i);
-                d.normalize();
                 const boneinfo &b = bones[i];
-                if(b.interpparent<0) sc.bdata[b.interpindex] = d;
-                else sc.bdata[b.interpindex].mul(sc.bdata[b.interpparent], d);
+                if(b.interpparent<0) sc.bdata[b.interpindex] = poses[i];
+                else mulpose(sc.bdata[b.interpindex], sc.bdata[b.interpparent], poses[i]);
 
                 float angle;
                 if(b.pitchscale) { angle = b.pitchscale*pitch + b.pitchoffset; if(b.pitchmin || b.pitchmax) angle = clamp(angle, b.pitchmin, b.pitchmax); }
-                else if(b.correctindex >= 0) angle = pitchcorrects[b.correctindex].pitchangle;
+                else if(b.correctindex >= 0) angle = ps.angles[b.correctindex];
                 else continue;
                 if(as->cur.anim&ANIM_NOPITCH || (as->interp < 1 && as->prev.anim&ANIM_NOPITCH))
                     angle *= (as->cur.anim&ANIM_NOPITCH ? 0 : as->interp) + (as->interp < 1 && as->prev.anim&ANIM_NOPITCH ? 0 : 1-as->interp);
@@ -918,7 +1098,11 @@ struct skelmodel : animmodel
 
         void genragdollbones(ragdolldata &d, skelcacheentry &sc, part *p)
         {
-            if(!sc.bdata) sc.bdata = new dualquat[numinterpbones];
+            if(!sc.bdata)
+            {
+                sc.bdata = new dualquat[numinterpbones];
+                MEMTRACK(MEM_MODEL, numinterpbones*sizeof(dualquat));
+            }
             sc.nextversion();
             vec trans = vec(d.center).div(p->model->scale).add(p->model->translate);
             loopv(ragdoll->joints)
@@ -971,9 +1155,13 @@ struct skelmodel : animmodel
             {
                 skelcacheentry &sc = skelcache[i];
                 loopj(MAXANIMPARTS) sc.as[j].cur.fr1 = -1;
+                if(sc.bdata) MEMTRACK(MEM_MODEL, -llong(numinterpbones*sizeof(dualquat)));
                 DELETEA(sc.bdata);
             }
             skelcache.setsize(0);
+            memset(skelcachebuckets, -1, sizeof(skelcachebuckets));
+            skelcachecursor = 0;
+            skelcachefull = -1;
             blendoffsets.clear();
             if(full) loopv(users) users[i]->cleanup();
         }
@@ -989,6 +1177,51 @@ struct skelmodel : animmodel
             }
         }
 
+        static inline uint hashfloat(uint h, float f)
+        {
+            union { float f; uint u; } conv;
+            conv.f = f == 0 ? 0 : f;
+            return (h<<5) + h + conv.u;
+        }
+
+        static uint hashanimstate(const animstate *as, int numanimparts, float pitch, const uchar *partmask, const ragdolldata *rdata)
+        {
+            uint h = hashfloat(uint(size_t(partmask) ^ size_t(rdata)), pitch);
+            loopi(numanimparts)
+            {
+                const animstate &s = as[i];
+                h = (h<<5) + h + uint(s.cur.fr1);
+                h = (h<<5) + h + uint(s.cur.fr2);
+                if(s.cur.fr1 != s.cur.fr2) h = hashfloat(h, s.cur.t);
+                if(s.interp < 1)
+                {
+                    h = hashfloat(h, s.interp);
+                    h = (h<<5) + h + uint(s.prev.fr1);
+                    h = (h<<5) + h + uint(s.prev.fr2);
+                    if(s.prev.fr1 != s.prev.fr2) h = hashfloat(h, s.prev.t);
+                }
+            }
+            return h;
+        }
+
+        void unlinkskelcache(skelcacheentry &sc)
+        {
+            if(sc.nexthash < -1) return;
+            int idx = &sc - skelcache.getbuf();
+            for(int *prev = &skelcachebuckets[sc.hash%SKELCACHEBUCKETS]; *prev >= 0; prev = &skelcache[*prev].nexthash)
+            {
+                if(*prev == idx) { *prev = sc.nexthash; break; }
+            }
+            sc.nexthash = -2;
+        }
+
+        void runposejob(const posejob &job, posescratch &ps)
+        {
+            if(!skelcache.inrange(job.entry) || !skelcache[job.entry].pending) return;
+            skelcacheentry &sc = skelcache[job.entry];
+            interpbones(sc.as, sc.pitch, job.axis, job.forward, job.numanimparts, sc.partmask, sc, ps);
+        }
+
         skelcacheentry &checkskelcache(part *p, const animstate *as, float pitch, const vec &axis, const vec &forward, ragdolldata *rdata)
         {
             if(skelcache.empty())
@@ -998,30 +1231,74 @@ struct skelmodel : animmodel
 
             int numanimparts = ((skelpart *)as->owner)->numanimparts;
             uchar *partmask = ((skelpart *)as->owner)->partmask;
-            skelcacheentry *sc = NULL;
-            bool match = false;
-            loopv(skelcache)
+            uint hash = hashanimstate(as, numanimparts, pitch, partmask, rdata);
+            for(int i = skelcachebuckets[hash%SKELCACHEBUCKETS]; i >= 0; i = skelcache[i].nexthash)
             {
                 skelcacheentry &c = skelcache[i];
+                if(c.hash != hash) continue;
                 loopj(numanimparts) if(c.as[j]!=as[j]) goto mismatch;
-                if(c.pitch != pitch || c.partmask != partmask || c.ragdoll != rdata || (rdata && c.millis < rdata->lastmove)) goto mismatch;
-                match = true;
-                sc = &c;
-                break;
-            mismatch:
-                if(c.millis < lastmillis) { sc = &c; break; }
-            }
-            if(!sc) sc = &skelcache.add();
-            if(!match)
-            {
-                loopi(numanimparts) sc->as[i] = as[i];
-                sc->pitch = pitch;
-                sc->partmask = partmask;
-                sc->ragdoll = rdata;
-                if(rdata) genragdollbones(*rdata, *sc, p);
-                else interpbones(as, pitch, axis, forward, numanimparts, partmask, *sc);
+                if(c.pitch != pitch || c.partmask != partmask || c.ragdoll != rdata || (rdata && c.millis < rdata->lastmove)) continue;
+                c.millis = lastmillis;
+                if(c.pending && p && p->links.length())
+                {
+                    // queued by a part without links, but this one needs its tags now
+                    interpbones(c.as, pitch, axis, forward, numanimparts, partmask, c, mainscratch);
+                    c.pending = false;
+                }
+                return c;
+            mismatch:;
+            }
+
+            // recycle an entry that went unused last frame, scanning round-robin so a full cache is not rescanned every miss
+            skelcacheentry *sc = NULL;
+            if(skelcachefull != lastmillis) loopv(skelcache)
+            {
+                skelcacheentry &c = skelcache[skelcachecursor];
+                if(++skelcachecursor >= skelcache.length()) skelcachecursor = 0;
+                if(c.millis < lastmillis && !c.pending) { sc = &c; break; }
             }
+            if(!sc)
+            {
+                skelcachefull = lastmillis;
+                sc = &skelcache.add();
+            }
+            else unlinkskelcache(*sc);
+            sc->hash = hash;
+            int &bucket = skelcachebuckets[hash%SKELCACHEBUCKETS];
+            sc->nexthash = bucket;
+            bucket = sc - skelcache.getbuf();
+
+            loopi(numanimparts) sc->as[i] = as[i];
+            sc->pitch = pitch;
+            sc->partmask = partmask;
+            sc->ragdoll = rdata;
             sc->millis = lastmillis;
+            if(rdata) genragdollbones(*rdata, *sc, p);
+            else
+            {
+                if(!sc->bdata)
+                {
+                    sc->bdata = new dualquat[numinterpbones];
+                    MEMTRACK(MEM_MODEL, numinterpbones*sizeof(dualquat));
+                }
+                sc->nextversion();
+#ifdef __SSE2__
+                if(skelsimd && soaframes != numframes) gensoabones();
+#endif
+                // parts with linked parts are posed right away, their tags place the linked parts
+                // before those get posed themselves, so only entries without tags are left pending
+                if(deferposes && !(as->cur.anim&ANIM_RAGDOLL) && (!p || p->links.empty()))
+                {
+                    posejob &job = posejobs.add();
+                    job.skel = this;
+                    job.entry = bucket;
+                    job.numanimparts = numanimparts;
+                    job.axis = axis;
+                    job.forward = forward;
+                    sc->pending = true;
+                }
+                else interpbones(as, pitch, axis, forward, numanimparts, partmask, *sc, mainscratch);
+            }
             return *sc;
         }
 
@@ -1098,8 +1375,9 @@ struct skelmodel : animmodel
                 else DELETEP(skel);
             }
             if(ebuf) glDeleteBuffers_(1, &ebuf);
-            loopi(MAXBLENDCACHE)
+            loopi(MAXBLENDCACHE) if(blendcache[i].bdata)
             {
+                MEMTRACK(MEM_MODEL, -llong(vblends*sizeof(dualquat)));
                 DELETEA(blendcache[i].bdata);
             }
             loopi(MAXVBOCACHE)
@@ -1286,6 +1564,105 @@ struct skelmodel : animmodel
             delete[] remap;
         }
 
+        enum { CACHE_BONENAMES = 1<<0, CACHE_BONEBASES = 1<<1 };
+
+        void savecache(stream *f, bool savenames, const dualquat *bases)
+        {
+            f->put<int>(skel->numbones);
+            f->put<int>((savenames ? CACHE_BONENAMES : 0) | (bases ? CACHE_BONEBASES : 0));
+            if(savenames) loopi(skel->numbones)
+            {
+                putcachestring(f, skel->bones[i].name);
+                f->put<int>(skel->bones[i].parent);
+            }
+            if(bases) putcachearray(f, bases, skel->numbones);
+            f->put<int>(meshes.length());
+            loopv(meshes)
+            {
+                skelmesh &m = *(skelmesh *)meshes[i];
+                putcachestring(f, m.name);
+                f->put<int>(m.maxweights);
+                putcachearray(f, m.verts, m.numverts);
+                putcachearray(f, m.tris, m.numtris);
+            }
+            putcachearray(f, blendcombos.getbuf(), blendcombos.length());
+            f->put(numblends, 4);
+        }
+
+        bool loadcache(stream *f)
+        {
+            int numbones = f->get<int>(), flags = f->get<int>();
+            if(numbones <= 0 || numbones > 0x10000) return false;
+            if(skel->numbones > 0 ? skel->numbones != numbones : !(flags&CACHE_BONENAMES)) return false;
+            if(skel->shared <= 1 && !(flags&CACHE_BONEBASES)) return false;
+
+            bool ok = true;
+            vector<char *> names;
+            vector<int> parents;
+            if(flags&CACHE_BONENAMES) loopi(numbones)
+            {
+                names.add(getcachestring(f));
+                int parent = parents.add(f->get<int>());
+                if(parent >= numbones) ok = false;
+            }
+            dualquat *bases = NULL;
+            int numbases = 0;
+            if(flags&CACHE_BONEBASES) ok = getcachearray(f, bases, numbases) && numbases == numbones;
+            int nummeshes = ok ? f->get<int>() : 0;
+            if(nummeshes <= 0 || nummeshes > 0x10000) ok = false;
+            else loopi(nummeshes)
+            {
+                skelmesh *m = new skelmesh;
+                m->group = this;
+                m->name = getcachestring(f);
+                m->maxweights = f->get<int>();
+                meshes.add(m);
+                if(!getcachearray(f, m->verts, m->numverts) || !getcachearray(f, m->tris, m->numtris)) { ok = false; break; }
+            }
+            blendcombo *combos = NULL;
+            int numcombos = 0;
+            if(ok) ok = getcachearray(f, combos, numcombos) && f->get(numblends, 4) == 4;
+            if(ok) loopv(meshes)
+            {
+                skelmesh &m = *(skelmesh *)meshes[i];
+                loopj(m.numverts) if(m.verts[j].blend < 0 || m.verts[j].blend >= numcombos) { ok = false; break; }
+                loopj(m.numtris) loopk(3) if(m.tris[j].vert[k] >= m.numverts) { ok = false; break; }
+            }
+            if(!ok)
+            {
+                names.deletearrays();
+                DELETEA(bases);
+                DELETEA(combos);
+                meshes.deletecontents();
+                memset(numblends, 0, sizeof(numblends));
+                return false;
+            }
+
+            if(skel->numbones <= 0)
+            {
+                skel->numbones = numbones;
+                skel->bones = new boneinfo[numbones];
+                loopi(numbones)
+                {
+                    skel->bones[i].name = names[i];
+                    skel->bones[i].parent = parents[i];
+                }
+                names.setsize(0);
+                skel->linkchildren();
+            }
+            if(skel->shared <= 1) loopi(numbones)
+            {
+                boneinfo &b = skel->bones[i];
+                b.base = bases[i];
+                (b.invbase = b.base).invert();
+            }
+            names.deletearrays();
+            DELETEA(bases);
+            blendcombos.put(combos, numcombos);
+            DELETEA(combos);
+            return true;
+        }
+
         int remapblend(int blend)
         {
             const blendcombo &c = blendcombos[blend];
@@ -1307,7 +1684,11 @@ struct skelmodel : animmodel
         void blendbones(const skelcacheentry &sc, blendcacheentry &bc)
         {
             bc.nextversion();
-            if(!bc.bdata) bc.bdata = new dualquat[vblends];
+            if(!bc.bdata)
+            {
+                bc.bdata = new dualquat[vblends];
+                MEMTRACK(MEM_MODEL, vblends*sizeof(dualquat));
+            }
             dualquat *dst = bc.bdata - skel->numgpubones;
             bool normalize = !skel->usegpuskel || vweights<=1;
             loopv(blendcombos)
@@ -1335,6 +1716,7 @@ struct skelmodel : animmodel
             loopi(MAXBLENDCACHE)
             {
                 blendcacheentry &c = blendcache[i];
+                if(c.bdata) MEMTRACK(MEM_MODEL, -llong(vblends*sizeof(dualquat)));
                 DELETEA(c.bdata);
                 c.owner = -1;
             }
@@ -1465,7 +1847,7 @@ struct skelmodel : animmodel
                 });
             }
 
-            skel->calctags(p, &sc);
+            if(!sc.pending) skel->calctags(p, &sc); // pending entries have no links, so there are no tags to update
 
             if(as->cur.anim&ANIM_RAGDOLL && skel->ragdoll && !d->ragdoll)
             {
@@ -1601,6 +1983,37 @@ struct skelmodel : animmodel
 
 hashnameset<skelmodel::skeleton *> skelmodel::skeletons;
 
+skelmodel::posescratch skelmodel::mainscratch;
+vector<skelmodel::posejob> skelmodel::posejobs;
+bool skelmodel::deferposes = false;
+
+// skeletons queued by the render prepass are posed on the pose workers while the main thread helps out
+static jobpool posepool("pose worker");
+static vector<skelmodel::posescratch *> posescratches;
+
+#define POSEJOBBATCH 4
+
+static void runposebatch(void *data, int start, int end, int worker)
+{
+    skelmodel::posescratch &ps = worker > 0 ? *posescratches[worker-1] : skelmodel::mainscratch;
+    for(int i = start; i < end; i++)
+    {
+        skelmodel::posejob &job = skelmodel::posejobs[i];
+        job.skel->runposejob(job, ps);
+    }
+}
+
+void runskelposejobs()
+{
+    vector<skelmodel::posejob> &jobs = skelmodel::posejobs;
+    if(jobs.empty()) return;
+    posepool.setthreads(animthreads);
+    while(posescratches.length() < posepool.numthreads()) posescratches.add(new skelmodel::posescratch);
+    posepool.run(jobs.length(), POSEJOBBATCH, runposebatch, NULL);
+    loopv(jobs) if(jobs[i].skel->skelcache.inrange(jobs[i].entry)) jobs[i].skel->skelcache[jobs[i].entry].pending = false;
+    jobs.setsize(0);
+}
+
 struct skeladjustment
 {
     float yaw, pitch, roll;
@@ -1622,6 +2035,11 @@ template<class MDL> struct skelloader : modelloader<MDL>
     static vector<skeladjustment> adjustments;
     static vector<uchar> hitzones;
 
+    static uint animcachekey(skelmodel::skeleton *skel, const char *filename)
+    {
+        return modelcachekey(filename, skel->cachekey(modelcachekey(skel->numbones, adjustments.getbuf(), adjustments.length()*sizeof(skeladjustment))));
+    }
+
     void flushpart()
     {
         if(MDL::loading && MDL::loading->parts.length())
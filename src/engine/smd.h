@@ -245,13 +245,14 @@ struct smd : skelmodel, skelloader<smd>
             }
         }
 
-        bool loadmesh(const char *filename)
+        bool loadmesh(const char *filename, uint cachekey = 0)
         {
             stream *f = openfile(filename, "r");
             if(!f) return false;
 
             char buf[512];
             int version = -1;
+            bool savenames = skel->numbones <= 0;
             while(f->getline(buf, sizeof(buf)))
             {
                 char *curbuf = buf;
@@ -291,6 +292,15 @@ struct smd : skelmodel, skelloader<smd>
             sortblendcombos();
 
             delete f;
+
+            stream *cf = skel->numbones > 0 ? openmodelcache(filename, "mesh", cachekey, true) : NULL;
+            if(cf)
+            {
+                vector<dualquat> bases;
+                if(skel->shared <= 1) loopi(skel->numbones) bases.add(skel->bones[i].base);
+                savecache(cf, savenames, bases.length() ? bases.getbuf() : NULL);
+                delete cf;
+            }
             return true;
         }
 
@@ -353,6 +363,15 @@ struct smd : skelmodel, skelloader<smd>
             skelanimspec *sa = skel->findskelanim(filename);
             if(sa || skel->numbones <= 0) return sa;
 
+            uint cachekey = animcachekey(skel, filename);
+            stream *cf = openmodelcache(filename, "anim", cachekey, false);
+            if(cf)
+            {
+                sa = skel->loadanimcache(cf, filename);
+                delete cf;
+                if(sa) return sa;
+            }
+
             stream *f = openfile(filename, "r");
             if(!f) return NULL;
 
@@ -396,6 +415,11 @@ struct smd : skelmodel, skelloader<smd>
 
             delete f;
 
+            if(numframes > 0 && (cf = openmodelcache(filename, "anim", cachekey, true)))
+            {
+                skel->saveanimcache(cf, *sa);
+                delete cf;
+            }
             return sa;
         }
 
@@ -403,7 +427,16 @@ struct smd : skelmodel, skelloader<smd>
         {
             name = newstring(meshfile);
 
-            return loadmesh(meshfile);
+            uint cachekey = modelcachekey(meshfile, MDL_SMD);
+            stream *cf = openmodelcache(meshfile, "mesh", cachekey, false);
+            if(cf)
+            {
+                bool cached = loadcache(cf);
+                delete cf;
+                if(cached) return true;
+            }
+
+            return loadmesh(meshfile, cachekey);
         }
     };
 
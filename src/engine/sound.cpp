@@ -16,12 +16,16 @@ struct soundsample
 {
     char *name;
     Mix_Chunk *chunk;
+    int lastused;
+    bool loading, failed, used;
 
-    soundsample() : name(NULL), chunk(NULL) {}
+    soundsample() : name(NULL), chunk(NULL), lastused(0), loading(false), failed(false), used(false) {}
     ~soundsample() { DELETEA(name); }
 
-    void cleanup() { if(chunk) { Mix_FreeChunk(chunk); chunk = NULL; } }
+    void setchunk(Mix_Chunk *c);
+    void cleanup();
     bool load(const char *dir, bool msg = false);
+    bool queueload(const char *dir, bool msg = true);
 };
 
 struct soundchannel
@@ -32,7 +36,8 @@ struct soundchannel
     soundsample *sample;
     extentity *ent;
     int svolume, radius, volume, pan, flags;
-    bool dirty;
+    int loops, fade, expire;
+    bool dirty, pending;
 
     soundchannel(int id) : id(id) { reset(); }
 
@@ -50,7 +55,9 @@ struct soundchannel
         volume = svolume = -1;
         pan = -1;
         flags = 0;
-        dirty = false;
+        loops = fade = 0;
+        expire = -1;
+        dirty = pending = false;
     }
 };
 vector<soundchannel> channels;
@@ -225,20 +232,168 @@ static Mix_Chunk *loadwav(const char *name)
     return c;
 }
 
+// samples are decoded off the main thread: the file is still read here since the zip and path code is not
+// thread-safe, but the (much slower) decode into a Mix_Chunk happens on a single loader thread;
+// channels started on a sample that is still loading are held pending until checksoundloads() picks it up
+VARP(soundasync, 0, 1, 1);
+static void trimsoundcache();
+VARFP(soundcachesize, 0, 64, 1024, trimsoundcache()); // MB of decoded samples kept around, 0 = unlimited
+
+struct soundload
+{
+    soundsample *sample;
+    char *data;
+    size_t len;
+    Mix_Chunk *chunk;
+};
+
+static SDL_Thread *soundloadthread = NULL;
+static SDL_mutex *soundloadmutex = NULL;
+static SDL_cond *soundloadcond = NULL, *soundloaddone = NULL;
+static vector<soundload> soundloadqueue, soundloadresults;
+static bool soundloadbusy = false, soundloadquit = false;
+static size_t soundcachebytes = 0;
+
+static int soundloadworker(void *)
+{
+    SDL_LockMutex(soundloadmutex);
+    for(;;)
+    {
+        while(soundloadqueue.empty() && !soundloadquit) SDL_CondWait(soundloadcond, soundloadmutex);
+        if(soundloadquit) break;
+        soundload l = soundloadqueue.remove(0);
+        soundloadbusy = true;
+        SDL_UnlockMutex(soundloadmutex);
+
+        SDL_RWops *rw = SDL_RWFromConstMem(l.data, int(l.len));
+        l.chunk = rw ? Mix_LoadWAV_RW(rw, 1) : NULL;
+
+        SDL_LockMutex(soundloadmutex);
+        soundloadbusy = false;
+        soundloadresults.add(l);
+        SDL_CondSignal(soundloaddone);
+    }
+    SDL_UnlockMutex(soundloadmutex);
+    return 0;
+}
+
+static bool queuesoundload(soundsample *s, char *data, size_t len)
+{
+    if(!soundloadthread)
+    {
+        if(!soundloadmutex) soundloadmutex = SDL_CreateMutex();
+        if(!soundloadcond) soundloadcond = SDL_CreateCond();
+        if(!soundloaddone) soundloaddone = SDL_CreateCond();
+        soundloadquit = false;
+        soundloadthread = SDL_CreateThread(soundloadworker, "sound loader", NULL);
+        if(!soundloadthread) return false;
+    }
+    SDL_LockMutex(soundloadmutex);
+    soundload &l = soundloadqueue.add();
+    l.sample = s;
+    l.data = data;
+    l.len = len;
+    l.chunk = NULL;
+    s->loading = true;
+    SDL_CondSignal(soundloadcond);
+    SDL_UnlockMutex(soundloadmutex);
+    return true;
+}
+
+// drops anything not yet decoded and waits for the loader to go idle, so samples can be freed or the audio device closed
+static void flushsoundloads()
+{
+    if(!soundloadthread) return;
+    SDL_LockMutex(soundloadmutex);
+    soundloadqueue.move(soundloadresults);
+    while(soundloadbusy) SDL_CondWait(soundloaddone, soundloadmutex);
+    loopv(soundloadresults)
+    {
+        soundload &l = soundloadresults[i];
+        l.sample->loading = false;
+        if(l.chunk) Mix_FreeChunk(l.chunk);
+        delete[] l.data;
+    }
+    soundloadresults.setsize(0);
+    SDL_UnlockMutex(soundloadmutex);
+    loopv(channels) if(channels[i].inuse && channels[i].pending) freechannel(i);
+}
+
+static void stopsoundloader()
+{
+    flushsoundloads();
+    if(!soundloadthread) return;
+    SDL_LockMutex(soundloadmutex);
+    soundloadquit = true;
+    SDL_CondSignal(soundloadcond);
+    SDL_UnlockMutex(soundloadmutex);
+    SDL_WaitThread(soundloadthread, NULL);
+    soundloadthread = NULL;
+    SDL_DestroyCond(soundloadcond);
+    SDL_DestroyCond(soundloaddone);
+    SDL_DestroyMutex(soundloadmutex);
+    soundloadcond = soundloaddone = NULL;
+    soundloadmutex = NULL;
+}
+
+void soundsample::setchunk(Mix_Chunk *c)
+{
+    chunk = c;
+    soundcachebytes += c->alen;
+    MEMTRACK(MEM_SOUND, c->alen);
+    lastused = totalmillis;
+}
+
+void soundsample::cleanup()
+{
+    if(chunk)
+    {
+        soundcachebytes -= chunk->alen;
+        MEMTRACK(MEM_SOUND, -llong(chunk->alen));
+        Mix_FreeChunk(chunk);
+        chunk = NULL;
+    }
+    failed = false;
+}
+
+static const char * const soundexts[] = { "", ".wav", ".ogg" };
+
+bool soundsample::queueload(const char *dir, bool msg)
+{
+    if(chunk || loading) return true;
+    if(failed || !name[0]) return false;
+
+    string filename;
+    loopi(sizeof(soundexts)/sizeof(soundexts[0]))
+    {
+        formatstring(filename, "media/sound/%s%s%s", dir, name, soundexts[i]);
+        path(filename);
+        size_t len = 0;
+        char *data = loadfile(filename, &len);
+        if(!data) continue;
+        if(queuesoundload(this, data, len)) return true;
+        delete[] data;
+        return load(dir);
+    }
+
+    failed = true;
+    if(msg) conoutf(CON_ERROR, "failed to load sample: media/sound/%s%s", dir, name);
+    return false;
+}
+
 bool soundsample::load(const char *dir, bool msg)
 {
     if(chunk) return true;
     if(!name[0]) return false;
 
-    static const char * const exts[] = { "", ".wav", ".ogg" };
     string filename;
-    loopi(sizeof(exts)/sizeof(exts[0]))
+    loopi(sizeof(soundexts)/sizeof(soundexts[0]))
     {
-        formatstring(filename, "media/sound/%s%s%s", dir, name, exts[i]);
+        formatstring(filename, "media/sound/%s%s%s", dir, name, soundexts[i]);
         if(msg && !i) renderprogress(0, filename);
         path(filename);
-        chunk = loadwav(filename);
-        if(chunk) return true;
+        Mix_Chunk *c = loadwav(filename);
+        if(c) { setchunk(c); return true; }
     }
 
     conoutf(CON_ERROR, "failed to load sample: media/sound/%s%s", dir, name);
@@ -294,7 +449,7 @@ static struct soundtype
     {
         if (nosound) return true;
         soundsample *s = addsample(name);
-        return s->load(dir, true);
+        return soundasync ? s->queueload(dir) : s->load(dir, true);
     }
 
     bool playing(const soundchannel &chan, const soundsample *sample, int volume) const
@@ -303,6 +458,131 @@ static struct soundtype
     }
 } gamesounds("", 0), mapsounds("", SND_MAP);
 
+static bool samplebusy(const soundsample *s)
+{
+    loopv(channels) if(channels[i].inuse && channels[i].sample == s) return true;
+    return false;
+}
+
+// evicts the least recently played decoded samples that no channel is using until the cache fits soundcachesize
+static void trimsoundcache()
+{
+    if(!soundcachesize) return;
+    size_t budget = size_t(soundcachesize)<<20;
+    while(soundcachebytes > budget)
+    {
+        soundsample *lru = NULL;
+        enumerate(gamesounds.samples, soundsample, s,
+        {
+            if(s.chunk && (!lru || s.lastused < lru->lastused) && !samplebusy(&s)) lru = &s;
+        });
+        enumerate(mapsounds.samples, soundsample, s,
+        {
+            if(s.chunk && (!lru || s.lastused < lru->lastused) && !samplebusy(&s)) lru = &s;
+        });
+        if(!lru) break;
+        lru->cleanup();
+    }
+}
+
+static int startchannel(soundchannel &chan)
+{
+    chan.pending = false;
+    Mix_Chunk *chunk = chan.sample->chunk;
+    int playing = -1;
+    if(chan.fade)
+    {
+        Mix_Volume(chan.id, chan.volume);
+        playing = chan.expire >= 0 ? Mix_FadeInChannelTimed(chan.id, chunk, chan.loops, chan.fade, chan.expire) : Mix_FadeInChannel(chan.id, chunk, chan.loops, chan.fade);
+    }
+    else playing = chan.expire >= 0 ? Mix_PlayChannelTimed(chan.id, chunk, chan.loops, chan.expire) : Mix_PlayChannel(chan.id, chunk, chan.loops);
+    if(playing >= 0)
+    {
+        chan.dirty = true;
+        syncchannel(chan);
+    }
+    else freechannel(chan.id);
+    return playing;
+}
+
+static void checksoundloads()
+{
+    if(!soundloadthread) return;
+    static vector<soundload> done;
+    SDL_LockMutex(soundloadmutex);
+    done.move(soundloadresults);
+    SDL_UnlockMutex(soundloadmutex);
+    if(done.empty()) return;
+    loopv(done)
+    {
+        soundload &l = done[i];
+        soundsample *s = l.sample;
+        s->loading = false;
+        delete[] l.data;
+        if(l.chunk) s->setchunk(l.chunk);
+        else
+        {
+            s->failed = true;
+            conoutf(CON_ERROR, "failed to decode sample: %s", s->name);
+        }
+        loopvj(channels)
+        {
+            soundchannel &chan = channels[j];
+            if(chan.inuse && chan.pending && chan.sample == s)
+            {
+                if(s->chunk) startchannel(chan);
+                else freechannel(j);
+            }
+        }
+    }
+    done.setsize(0);
+    trimsoundcache();
+}
+
+// the samples a map actually played are listed in cache/sound/<map>.txt when leaving it,
+// and queued for loading on the next visit so they are usually decoded before they are first needed
+static string soundmanifestmap = "";
+
+static void savesoundmanifest()
+{
+    if(!soundmanifestmap[0]) return;
+    defformatstring(fname, "cache/sound/%s.txt", soundmanifestmap);
+    soundmanifestmap[0] = '\0';
+    stream *f = NULL;
+    soundtype *types[2] = { &mapsounds, &gamesounds };
+    loopj(2) enumerate(types[j]->samples, soundsample, s,
+    {
+        if(!s.used) continue;
+        s.used = false;
+        if(!f && !(f = openutf8file(path(fname), "w"))) continue;
+        f->printf("%c %s\n", j ? 'g' : 'm', s.name);
+    });
+    DELETEP(f);
+}
+
+void loadsoundmanifest(const char *mname)
+{
+    savesoundmanifest();
+    if(!mname || !mname[0]) return;
+    copystring(soundmanifestmap, mname);
+    if(nosound || !soundasync) return;
+    defformatstring(fname, "cache/sound/%s.txt", mname);
+    char *buf = loadfile(path(fname), NULL);
+    if(!buf) return;
+    for(char *line = buf; *line;)
+    {
+        char *end = line + strcspn(line, "\r\n"), next = *end;
+        *end = '\0';
+        if((line[0] == 'm' || line[0] == 'g') && line[1] == ' ' && line[2])
+        {
+            soundtype &sounds = line[0] == 'm' ? mapsounds : gamesounds;
+            sounds.addsample(&line[2])->queueload(sounds.dir, false);
+        }
+        line = next ? end+1 : end;
+    }
+    delete[] buf;
+}
+
 void soundreset()
 {
     gamesounds.reset();
@@ -327,6 +607,8 @@ void clear_sound()
     if(nosound) return;
     stopmusic();
 
+    savesoundmanifest();
+    stopsoundloader();
     gamesounds.cleanup();
     mapsounds.cleanup();
     Mix_CloseAudio();
@@ -355,19 +637,142 @@ void stopmapsound(extentity *e)
     }
 }
 
-void checkmapsounds()
+// map sound entities are bucketed into a 2D grid of SOUNDCELLSIZE cells, each entity listed in every cell its radius (plus hysteresis) overlaps,
+// so only the listener's cell needs to be checked; very large radii would touch too many cells and are kept in a separate list
+#define SOUNDCELLSIZE 256
+#define MAXSOUNDCELLS 64
+
+void clearmapsoundgrid();
+
+VARFP(mapsoundhysteresis, 0, 16, 1000, clearmapsoundgrid());
+VARP(maxmapsounds, 0, 0, 1024);
+
+struct soundcell
 {
+    vector<int> ents;
+};
+
+static vector<soundcell> soundcells;
+static hashtable<uint, int> soundcellmap;
+static vector<int> largemapsounds;
+static bool soundgridchanged = true;
+
+struct mapsoundcandidate
+{
+    extentity *ent;
+    float priority;
+    bool playing;
+};
+
+static vector<mapsoundcandidate> mapsoundcandidates;
+
+void clearmapsoundgrid()
+{
+    soundgridchanged = true;
+}
+
+static inline uint soundcellkey(int x, int y)
+{
+    return (uint(x)&0xFFFF) | (uint(y)<<16);
+}
+
+static void buildmapsoundgrid()
+{
+    soundgridchanged = false;
+    loopv(soundcells) soundcells[i].ents.setsize(0);
+    soundcellmap.clear();
+    largemapsounds.setsize(0);
     const vector<extentity *> &ents = entities::getents();
     loopv(ents)
     {
         extentity &e = *ents[i];
-        if(e.type!=ET_SOUND) continue;
-        if(camera1->o.dist(e.o) < e.attr[0])
+        if(e.type!=ET_SOUND || e.attr[0] <= 0) continue;
+        float rad = e.attr[0] + mapsoundhysteresis;
+        int x1 = int(floor((e.o.x - rad)/SOUNDCELLSIZE)), x2 = int(floor((e.o.x + rad)/SOUNDCELLSIZE)),
+            y1 = int(floor((e.o.y - rad)/SOUNDCELLSIZE)), y2 = int(floor((e.o.y + rad)/SOUNDCELLSIZE));
+        if((x2 - x1 + 1)*(y2 - y1 + 1) > MAXSOUNDCELLS) { largemapsounds.add(i); continue; }
+        for(int y = y1; y <= y2; y++) for(int x = x1; x <= x2; x++)
         {
-            if(!(e.flags&EF_SOUND))
-                lua::call_external("sound_play_map", "p", &e);
+            int &idx = soundcellmap.access(soundcellkey(x, y), soundcellmap.numelems);
+            if(idx >= soundcells.length()) soundcells.add();
+            soundcells[idx].ents.add(i);
         }
-        else if(e.flags&EF_SOUND) stopmapsound(&e);
+    }
+}
+
+// same falloff updatechannel uses for the volume, so louder sounds win when voices run out
+static inline float mapsoundpriority(const extentity &e, float dist)
+{
+    int rad = e.attr[0];
+    if(e.attr[1])
+    {
+        rad -= e.attr[1];
+        dist -= e.attr[1];
+    }
+    return rad > 0 ? 1 - clamp(dist/rad, 0.0f, 1.0f) : 1;
+}
+
+static bool addmapsoundcandidate(extentity &e)
+{
+    if(e.type!=ET_SOUND) return false;
+    bool playing = (e.flags&EF_SOUND)!=0;
+    float dist = camera1->o.dist(e.o);
+    if(playing) dist -= mapsoundhysteresis;
+    if(dist >= e.attr[0]) return false;
+    mapsoundcandidate &c = mapsoundcandidates.add();
+    c.ent = &e;
+    c.priority = mapsoundpriority(e, dist);
+    c.playing = playing;
+    return true;
+}
+
+static bool mapsoundcmp(const mapsoundcandidate &a, const mapsoundcandidate &b)
+{
+    if(a.priority > b.priority) return true;
+    if(a.priority < b.priority) return false;
+    return a.playing && !b.playing;
+}
+
+void checkmapsounds()
+{
+    if(soundgridchanged) buildmapsoundgrid();
+
+    const vector<extentity *> &ents = entities::getents();
+    mapsoundcandidates.setsize(0);
+    int *cell = soundcellmap.access(soundcellkey(int(floor(camera1->o.x/SOUNDCELLSIZE)), int(floor(camera1->o.y/SOUNDCELLSIZE))));
+    if(cell)
+    {
+        vector<int> &cellents = soundcells[*cell].ents;
+        loopv(cellents) if(ents.inrange(cellents[i])) addmapsoundcandidate(*ents[cellents[i]]);
+    }
+    loopv(largemapsounds) if(ents.inrange(largemapsounds[i])) addmapsoundcandidate(*ents[largemapsounds[i]]);
+
+    // sounds already playing are only stopped once the listener moves mapsoundhysteresis past their radius
+    loopv(channels)
+    {
+        soundchannel &chan = channels[i];
+        if(!chan.inuse || !chan.ent || !(chan.ent->flags&EF_SOUND)) continue;
+        bool found = false;
+        loopvj(mapsoundcandidates) if(mapsoundcandidates[j].ent == chan.ent) { found = true; break; }
+        if(!found) stopmapsound(chan.ent);
+    }
+
+    int limit = maxmapsounds ? min(maxmapsounds, maxchannels) : maxchannels;
+    if(limit > 0 && mapsoundcandidates.length() > limit)
+    {
+        mapsoundcandidates.sort(mapsoundcmp);
+        for(int i = limit; i < mapsoundcandidates.length(); i++)
+        {
+            mapsoundcandidate &c = mapsoundcandidates[i];
+            if(c.playing) stopmapsound(c.ent);
+        }
+        mapsoundcandidates.setsize(limit);
+    }
+
+    loopv(mapsoundcandidates)
+    {
+        mapsoundcandidate &c = mapsoundcandidates[i];
+        if(!c.playing && !(c.ent->flags&EF_SOUND)) lua::call_external("sound_play_map", "p", c.ent);
     }
 }
 
@@ -415,7 +820,7 @@ void reclaimchannels()
     loopv(channels)
     {
         soundchannel &chan = channels[i];
-        if(chan.inuse && !Mix_Playing(i)) freechannel(i);
+        if(chan.inuse && !chan.pending && !Mix_Playing(i)) freechannel(i);
     }
 }
 
@@ -430,11 +835,13 @@ void syncchannels()
 
 void updatesounds()
 {
+    PROFSCOPE("updatesounds");
     updatemumble();
     if(nosound) return;
     if(minimized) stopsounds();
     else
     {
+        checksoundloads();
         reclaimchannels();
         if(mainmenu) stopmapsounds();
         else checkmapsounds();
@@ -496,7 +903,19 @@ int playsound(const char *s, const vec *loc, extentity *ent, int vol, int flags,
     }
     if(fade < 0) return -1;
 
-    if(!sample->chunk && !sample->load(sounds.dir)) return -1;
+    bool pending = false;
+    if(!sample->chunk)
+    {
+        if(soundasync)
+        {
+            if(!sample->queueload(sounds.dir)) return -1;
+            pending = !sample->chunk;
+        }
+        else if(sample->load(sounds.dir)) trimsoundcache();
+        else return -1;
+    }
+    sample->lastused = totalmillis;
+    sample->used = true;
 
     if(dbgsound) conoutf("sound: %s%s", sounds.dir, sample->name);
 
@@ -508,16 +927,15 @@ int playsound(const char *s, const vec *loc, extentity *ent, int vol, int flags,
 
     soundchannel &chan = newchannel(chanid, sample, vol, loc, ent, flags, radius);
     updatechannel(chan);
-    int playing = -1;
-    if(fade)
+    chan.loops = loops;
+    chan.fade = fade;
+    chan.expire = expire;
+    if(pending)
     {
-        Mix_Volume(chanid, chan.volume);
-        playing = expire >= 0 ? Mix_FadeInChannelTimed(chanid, sample->chunk, loops, fade, expire) : Mix_FadeInChannel(chanid, sample->chunk, loops, fade);
+        chan.pending = true;
+        return chanid;
     }
-    else playing = expire >= 0 ? Mix_PlayChannelTimed(chanid, sample->chunk, loops, expire) : Mix_PlayChannel(chanid, sample->chunk, loops);
-    if(playing >= 0) syncchannel(chan);
-    else freechannel(chanid);
-    return playing;
+    return startchannel(chan);
 }
 
 void stopsounds()
@@ -534,6 +952,7 @@ void resetsound()
     lua::call_external("changes_clear", "i", CHANGE_SOUND);
     if(!nosound)
     {
+        flushsoundloads();
         gamesounds.cleanupsamples();
         mapsounds.cleanupsamples();
         if(music)
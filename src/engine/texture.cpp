@@ -10,6 +10,10 @@
   #include "SDL_image.h"
 #endif
 
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
 template<int S>
 static void halvetexture(uchar *src, uint sw, uint sh, uint stride, uchar *dst)
 {
@@ -3712,77 +3716,33 @@ struct DDSURFACEDESC2
     uint dwTextureStage;
 };
 
-#define DECODEDDS(name, dbpp, initblock, writeval, nextval) \
-static void name(ImageData &s) \
-{ \
-    ImageData d(s.w, s.h, dbpp); \
-    uchar *dst = d.data; \
-    const uchar *src = s.data; \
-    for(int by = 0; by < s.h; by += s.align) \
-    { \
-        for(int bx = 0; bx < s.w; bx += s.align, src += s.bpp) \
-        { \
-            int maxy = min(d.h - by, s.align), maxx = min(d.w - bx, s.align); \
-            initblock; \
-            loop(y, maxy) \
-            { \
-                int x; \
-                for(x = 0; x < maxx; ++x) \
-                { \
-                    writeval; \
-                    nextval; \
-                    dst += d.bpp; \
-                }  \
-                for(; x < s.align; ++x) { nextval; } \
-                dst += d.pitch - maxx*d.bpp; \
-            } \
-            dst += maxx*d.bpp - maxy*d.pitch; \
-        } \
-        dst += (s.align-1)*d.pitch; \
-    } \
-    s.replace(d); \
-}
+VAR(ddsthreads, 0, 0, 16);
 
-DECODEDDS(decodedxt1, s.compressed == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 4 : 3,
-    ushort color0 = lilswap(*(const ushort *)src);
-    ushort color1 = lilswap(*(const ushort *)&src[2]);
-    uint bits = lilswap(*(const uint *)&src[4]);
-    bvec4 rgba[4];
-    rgba[0] = bvec4(bvec::from565(color0), 0xFF);
-    rgba[1] = bvec4(bvec::from565(color1), 0xFF);
-    if(color0 > color1)
+static jobpool ddspool("dds worker");
+
+// splits block rows of a DDS image between the dds worker threads
+struct ddsrowjob
+{
+    int numrows;
+
+    ddsrowjob() : numrows(0) {}
+    virtual ~ddsrowjob() {}
+
+    virtual void processrow(int row) = 0;
+
+    static void run(void *data, int start, int end, int worker)
     {
-        rgba[2].lerp(rgba[0], rgba[1], 2, 1, 3);
-        rgba[3].lerp(rgba[0], rgba[1], 1, 2, 3);
+        ddsrowjob *job = (ddsrowjob *)data;
+        for(int i = start; i < end; i++) job->processrow(i);
     }
-    else
+
+    void process(int numthreads)
     {
-        rgba[2].lerp(rgba[0], rgba[1], 1, 1, 2);
-        rgba[3] = bvec4(0, 0, 0, 0);
+        if(numthreads <= 1 || numrows <= 4) { run(this, 0, numrows, 0); return; }
+        ddspool.setthreads(numthreads-1);
+        ddspool.run(numrows, 4, run, this);
     }
-,
-    memcpy(dst, rgba[bits&3].v, d.bpp);
-,
-    bits >>= 2;
-);
-
-DECODEDDS(decodedxt3, 4,
-    ullong alpha = lilswap(*(const ullong *)src);
-    ushort color0 = lilswap(*(const ushort *)&src[8]);
-    ushort color1 = lilswap(*(const ushort *)&src[10]);
-    uint bits = lilswap(*(const uint *)&src[12]);
-    bvec rgb[4];
-    rgb[0] = bvec::from565(color0);
-    rgb[1] = bvec::from565(color1);
-    rgb[2].lerp(rgb[0], rgb[1], 2, 1, 3);
-    rgb[3].lerp(rgb[0], rgb[1], 1, 2, 3);
-,
-    memcpy(dst, rgb[bits&3].v, 3);
-    dst[3] = ((alpha&0xF)*1088 + 32) >> 6;
-,
-    bits >>= 2;
-    alpha >>= 4;
-);
+};
 
 static inline void decodealpha(uchar alpha0, uchar alpha1, uchar alpha[8])
 {
@@ -3808,50 +3768,418 @@ static inline void decodealpha(uchar alpha0, uchar alpha1, uchar alpha[8])
     }
 }
 
-DECODEDDS(decodedxt5, 4,
+// builds the 4 entry RGBA palette of a DXT color block, DXT1 switches to 3 colors + transparent black if color0 <= color1
+#ifdef __SSE2__
+static inline void decodecolorpalette(ushort color0, ushort color1, bool fourcolor, uint pal[4])
+{
+    bvec c0 = bvec::from565(color0), c1 = bvec::from565(color1);
+    __m128i ends = _mm_setr_epi16(c0.r, c0.g, c0.b, 0xFF, c1.r, c1.g, c1.b, 0xFF),
+            swapped = _mm_shuffle_epi32(ends, _MM_SHUFFLE(1, 0, 3, 2)), mids;
+    if(fourcolor || color0 > color1)
+    {
+        // (2*a + b)/3 for both orders at once, exact for all 16 bit inputs
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(ends, ends), swapped);
+        mids = _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16(short(0xAAAB))), 1);
+    }
+    else mids = _mm_unpacklo_epi64(_mm_srli_epi16(_mm_add_epi16(ends, swapped), 1), _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *)pal, _mm_packus_epi16(ends, mids));
+}
+#else
+static inline void decodecolorpalette(ushort color0, ushort color1, bool fourcolor, uint pal[4])
+{
+    bvec4 *rgba = (bvec4 *)pal;
+    rgba[0] = bvec4(bvec::from565(color0), 0xFF);
+    rgba[1] = bvec4(bvec::from565(color1), 0xFF);
+    if(fourcolor || color0 > color1)
+    {
+        rgba[2].lerp(rgba[0], rgba[1], 2, 1, 3);
+        rgba[3].lerp(rgba[0], rgba[1], 1, 2, 3);
+    }
+    else
+    {
+        rgba[2].lerp(rgba[0], rgba[1], 1, 1, 2);
+        rgba[3] = bvec4(0, 0, 0, 0);
+    }
+}
+#endif
+
+template<int BPP>
+static inline void decodecolorblock(const uchar *src, uchar *tile, bool fourcolor)
+{
+    uint pal[4];
+    decodecolorpalette(lilswap(*(const ushort *)src), lilswap(*(const ushort *)&src[2]), fourcolor, pal);
+    uint bits = lilswap(*(const uint *)&src[4]);
+    loopi(16) { memcpy(&tile[i*BPP], &pal[bits&3], BPP); bits >>= 2; }
+}
+
+template<int BPP>
+static inline void decodealphablock(const uchar *src, uchar *tile, int channel)
+{
     uchar alpha[8];
     decodealpha(src[0], src[1], alpha);
-    ullong alphabits = lilswap(*(const ushort *)&src[2]) + ((ullong)lilswap(*(const uint *)&src[4]) << 16);
-    ushort color0 = lilswap(*(const ushort *)&src[8]);
-    ushort color1 = lilswap(*(const ushort *)&src[10]);
-    uint bits = lilswap(*(const uint *)&src[12]);
+    ullong bits = lilswap(*(const ushort *)&src[2]) + ((ullong)lilswap(*(const uint *)&src[4]) << 16);
+    loopi(16) { tile[i*BPP + channel] = alpha[bits&7]; bits >>= 3; }
+}
+
+template<int BPP> struct dxt1block
+{
+    enum { bpp = BPP };
+    static inline void decode(const uchar *src, uchar *tile) { decodecolorblock<BPP>(src, tile, false); }
+};
+
+struct dxt3block
+{
+    enum { bpp = 4 };
+    static inline void decode(const uchar *src, uchar *tile)
+    {
+        decodecolorblock<4>(&src[8], tile, true);
+        ullong alpha = lilswap(*(const ullong *)src);
+        loopi(16) { tile[i*4 + 3] = ((alpha&0xF)*1088 + 32) >> 6; alpha >>= 4; }
+    }
+};
+
+struct dxt5block
+{
+    enum { bpp = 4 };
+    static inline void decode(const uchar *src, uchar *tile)
+    {
+        decodecolorblock<4>(&src[8], tile, true);
+        decodealphablock<4>(src, tile, 3);
+    }
+};
+
+struct rgtc1block
+{
+    enum { bpp = 1 };
+    static inline void decode(const uchar *src, uchar *tile) { decodealphablock<1>(src, tile, 0); }
+};
+
+struct rgtc2block
+{
+    enum { bpp = 2 };
+    static inline void decode(const uchar *src, uchar *tile)
+    {
+        decodealphablock<2>(src, tile, 0);
+        decodealphablock<2>(&src[8], tile, 1);
+    }
+};
+
+template<class B> struct ddsdecoder : ddsrowjob
+{
+    const ImageData &s;
+    ImageData &d;
+
+    ddsdecoder(const ImageData &s, ImageData &d) : s(s), d(d)
+    {
+        numrows = (s.h + s.align-1)/s.align;
+    }
+
+    void processrow(int row)
+    {
+        int by = row*s.align, bw = (s.w + s.align-1)/s.align, maxy = min(d.h - by, s.align);
+        const uchar *src = &s.data[row*bw*s.bpp];
+        uchar tile[16*B::bpp];
+        for(int bx = 0; bx < s.w; bx += s.align, src += s.bpp)
+        {
+            B::decode(src, tile);
+            int maxx = min(d.w - bx, s.align);
+            uchar *dst = &d.data[by*d.pitch + bx*B::bpp];
+            if(maxx == 4) loop(y, maxy)
+            {
+                memcpy(dst, &tile[y*4*B::bpp], 4*B::bpp);
+                dst += d.pitch;
+            }
+            else loop(y, maxy)
+            {
+                memcpy(dst, &tile[y*4*B::bpp], maxx*B::bpp);
+                dst += d.pitch;
+            }
+        }
+    }
+};
+
+template<class B> static void decodedds(ImageData &s)
+{
+    ImageData d(s.w, s.h, B::bpp);
+    ddsdecoder<B> dec(s, d);
+    // threads only pay off once there are enough blocks to go around
+    dec.process(s.w*s.h >= 256*256 ? (ddsthreads > 0 ? ddsthreads : numcpus) : 1);
+    s.replace(d);
+}
+
+static void decodedxt1(ImageData &s)
+{
+    if(s.compressed == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) decodedds< dxt1block<4> >(s);
+    else decodedds< dxt1block<3> >(s);
+}
+static inline void decodedxt3(ImageData &s) { decodedds<dxt3block>(s); }
+static inline void decodedxt5(ImageData &s) { decodedds<dxt5block>(s); }
+static inline void decodergtc1(ImageData &s) { decodedds<rgtc1block>(s); }
+static inline void decodergtc2(ImageData &s) { decodedds<rgtc2block>(s); }
+
+VAR(ddsquality, 0, 1, 2);
+
+static inline ushort encode565(const vec &c)
+{
+    int r = clamp(int(c.x*(31.0f/255.0f) + 0.5f), 0, 31),
+        g = clamp(int(c.y*(63.0f/255.0f) + 0.5f), 0, 63),
+        b = clamp(int(c.z*(31.0f/255.0f) + 0.5f), 0, 31);
+    return (r<<11) | (g<<5) | b;
+}
+
+static int fitcolorblock(const uchar block[16][4], ushort color0, ushort color1, uint &bits)
+{
     bvec rgb[4];
     rgb[0] = bvec::from565(color0);
     rgb[1] = bvec::from565(color1);
     rgb[2].lerp(rgb[0], rgb[1], 2, 1, 3);
     rgb[3].lerp(rgb[0], rgb[1], 1, 2, 3);
-,
-    memcpy(dst, rgb[bits&3].v, 3);
-    dst[3] = alpha[alphabits&7];
-,
-    bits >>= 2;
-    alphabits >>= 3;
-);
-
-DECODEDDS(decodergtc1, 1,
-    uchar red[8];
-    decodealpha(src[0], src[1], red);
-    ullong redbits = lilswap(*(const ushort *)&src[2]) + ((ullong)lilswap(*(const uint *)&src[4]) << 16);
-,
-    dst[0] = red[redbits&7];
-,
-    redbits >>= 3;
-);
-
-DECODEDDS(decodergtc2, 2,
-    uchar red[8];
-    decodealpha(src[0], src[1], red);
-    ullong redbits = lilswap(*(const ushort *)&src[2]) + ((ullong)lilswap(*(const uint *)&src[4]) << 16);
-    uchar green[8];
-    decodealpha(src[8], src[9], green);
-    ullong greenbits = lilswap(*(const ushort *)&src[10]) + ((ullong)lilswap(*(const uint *)&src[12]) << 16);
-,
-    dst[0] = red[redbits&7];
-    dst[1] = green[greenbits&7];
-,
-    redbits >>= 3;
-    greenbits >>= 3;
-);
+    int err = 0;
+    bits = 0;
+    loopi(16)
+    {
+        const uchar *c = block[i];
+        int best = 0, bestdist = INT_MAX;
+        loopj(4)
+        {
+            int dr = c[0] - rgb[j].r, dg = c[1] - rgb[j].g, db = c[2] - rgb[j].b, dist = dr*dr + dg*dg + db*db;
+            if(dist < bestdist) { best = j; bestdist = dist; }
+        }
+        bits |= best<<(2*i);
+        err += bestdist;
+    }
+    return err;
+}
+
+// quality 0 fits the bounding box, 1 the principal axis, 2 additionally refines the endpoints by least squares
+static void encodecolorblock(const uchar block[16][4], uchar *dst, int quality)
+{
+    vec lo(255, 255, 255), hi(0, 0, 0), mean(0, 0, 0);
+    loopi(16)
+    {
+        vec c(block[i][0], block[i][1], block[i][2]);
+        lo.min(c);
+        hi.max(c);
+        mean.add(c);
+    }
+    mean.mul(1.0f/16);
+    vec end0, end1;
+    if(quality <= 0)
+    {
+        vec inset = vec(hi).sub(lo).mul(1.0f/16);
+        end0 = vec(hi).sub(inset);
+        end1 = vec(lo).add(inset);
+    }
+    else
+    {
+        float cov[6] = { 0, 0, 0, 0, 0, 0 };
+        loopi(16)
+        {
+            vec d = vec(block[i][0], block[i][1], block[i][2]).sub(mean);
+            cov[0] += d.x*d.x; cov[1] += d.x*d.y; cov[2] += d.x*d.z;
+            cov[3] += d.y*d.y; cov[4] += d.y*d.z; cov[5] += d.z*d.z;
+        }
+        vec axis = vec(hi).sub(lo);
+        loopk(8)
+        {
+            vec next(axis.x*cov[0] + axis.y*cov[1] + axis.z*cov[2],
+                     axis.x*cov[1] + axis.y*cov[3] + axis.z*cov[4],
+                     axis.x*cov[2] + axis.y*cov[4] + axis.z*cov[5]);
+            float mag = next.magnitude();
+            if(mag < 1e-6f) break;
+            axis = next.div(mag);
+        }
+        float tmin = 0, tmax = 0;
+        loopi(16)
+        {
+            float t = vec(block[i][0], block[i][1], block[i][2]).sub(mean).dot(axis);
+            tmin = min(tmin, t);
+            tmax = max(tmax, t);
+        }
+        end0 = vec(axis).mul(tmax).add(mean);
+        end1 = vec(axis).mul(tmin).add(mean);
+    }
+    ushort color0 = encode565(end0), color1 = encode565(end1);
+    uint bits;
+    int err = fitcolorblock(block, color0, color1, bits);
+    if(quality >= 2) loopk(2)
+    {
+        static const float weights[4] = { 1, 0, 2.0f/3, 1.0f/3 };
+        float aa = 0, ab = 0, bb = 0;
+        vec ax(0, 0, 0), bx(0, 0, 0);
+        loopi(16)
+        {
+            float wa = weights[(bits>>(2*i))&3], wb = 1 - wa;
+            vec c(block[i][0], block[i][1], block[i][2]);
+            aa += wa*wa;
+            ab += wa*wb;
+            bb += wb*wb;
+            ax.add(vec(c).mul(wa));
+            bx.add(vec(c).mul(wb));
+        }
+        float det = aa*bb - ab*ab;
+        if(fabs(det) < 1e-6f) break;
+        ushort ncolor0 = encode565(vec(ax).mul(bb).sub(vec(bx).mul(ab)).div(det)),
+               ncolor1 = encode565(vec(bx).mul(aa).sub(vec(ax).mul(ab)).div(det));
+        if(ncolor0 == color0 && ncolor1 == color1) break;
+        uint nbits;
+        int nerr = fitcolorblock(block, ncolor0, ncolor1, nbits);
+        if(nerr >= err) break;
+        color0 = ncolor0;
+        color1 = ncolor1;
+        bits = nbits;
+        err = nerr;
+    }
+    // DXT1 only uses 4 colors when color0 > color1, so swap the endpoints and their indices
+    if(color0 < color1)
+    {
+        swap(color0, color1);
+        bits ^= 0x55555555U;
+    }
+    else if(color0 == color1) bits = 0;
+    dst[0] = color0&0xFF;
+    dst[1] = color0>>8;
+    dst[2] = color1&0xFF;
+    dst[3] = color1>>8;
+    loopi(4) dst[4+i] = (bits>>(8*i))&0xFF;
+}
+
+static int fitalphablock(const uchar vals[16], uchar alpha0, uchar alpha1, ullong &bits)
+{
+    uchar alpha[8];
+    decodealpha(alpha0, alpha1, alpha);
+    int err = 0;
+    bits = 0;
+    loopi(16)
+    {
+        int best = 0, bestdist = INT_MAX;
+        loopj(8)
+        {
+            int dist = (vals[i] - alpha[j])*(vals[i] - alpha[j]);
+            if(dist < bestdist) { best = j; bestdist = dist; }
+        }
+        bits |= ullong(best)<<(3*i);
+        err += bestdist;
+    }
+    return err;
+}
+
+// quality 1 also tries the 6 value mode with explicit 0 and 255, quality 2 searches inset endpoints
+static void encodealphablock(const uchar vals[16], uchar *dst, int quality)
+{
+    int lo = 255, hi = 0, lo6 = 255, hi6 = 0;
+    loopi(16)
+    {
+        int v = vals[i];
+        lo = min(lo, v);
+        hi = max(hi, v);
+        if(v > 0 && v < 255) { lo6 = min(lo6, v); hi6 = max(hi6, v); }
+    }
+    uchar alpha0 = hi, alpha1 = lo;
+    ullong bits;
+    int err = fitalphablock(vals, alpha0, alpha1, bits);
+    if(err && quality >= 1 && lo6 <= hi6)
+    {
+        ullong nbits;
+        int nerr = fitalphablock(vals, lo6, hi6, nbits);
+        if(nerr < err) { alpha0 = lo6; alpha1 = hi6; bits = nbits; err = nerr; }
+    }
+    if(err && quality >= 2 && hi - lo > 8)
+    {
+        for(int d0 = 0; d0 <= 4; d0++) for(int d1 = 0; d1 <= 4; d1++) if(d0 || d1)
+        {
+            ullong nbits;
+            int nerr = fitalphablock(vals, hi - d0, lo + d1, nbits);
+            if(nerr < err) { alpha0 = hi - d0; alpha1 = lo + d1; bits = nbits; err = nerr; }
+        }
+    }
+    dst[0] = alpha0;
+    dst[1] = alpha1;
+    loopi(6) dst[2+i] = (bits>>(8*i))&0xFF;
+}
+
+static void fetchblock(const ImageData &s, int bx, int by, uchar block[16][4])
+{
+    loop(y, 4)
+    {
+        const uchar *src = &s.data[min(by+y, s.h-1)*s.pitch];
+        loop(x, 4)
+        {
+            const uchar *c = &src[min(bx+x, s.w-1)*s.bpp];
+            uchar *dst = block[y*4 + x];
+            dst[0] = c[0];
+            dst[1] = s.bpp >= 2 ? c[1] : 0;
+            dst[2] = s.bpp >= 3 ? c[2] : 0;
+            dst[3] = s.bpp >= 4 ? c[3] : 0xFF;
+        }
+    }
+}
+
+struct ddsencoder : ddsrowjob
+{
+    struct blockrow
+    {
+        const ImageData *src;
+        int y;
+        uchar *dst;
+    };
+
+    GLenum format;
+    int quality;
+    vector<blockrow> rows;
+
+    ddsencoder(GLenum format, int quality) : format(format), quality(quality) {}
+
+    void addlevel(const ImageData &s, uchar *dst, int blocksize)
+    {
+        for(int y = 0; y < s.h; y += 4)
+        {
+            blockrow &r = rows.add();
+            r.src = &s;
+            r.y = y;
+            r.dst = dst;
+            dst += ((s.w+3)/4)*blocksize;
+        }
+        numrows = rows.length();
+    }
+
+    void processrow(int row)
+    {
+        const blockrow &r = rows[row];
+        const ImageData &s = *r.src;
+        uchar *dst = r.dst;
+        uchar block[16][4], vals[16];
+        for(int x = 0; x < s.w; x += 4)
+        {
+            fetchblock(s, x, r.y, block);
+            switch(format)
+            {
+                case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+                    encodecolorblock(block, dst, quality);
+                    dst += 8;
+                    break;
+                case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                    loopi(16) vals[i] = block[i][3];
+                    encodealphablock(vals, dst, quality);
+                    encodecolorblock(block, &dst[8], quality);
+                    dst += 16;
+                    break;
+                case GL_COMPRESSED_RED_RGTC1:
+                    loopi(16) vals[i] = block[i][0];
+                    encodealphablock(vals, dst, quality);
+                    dst += 8;
+                    break;
+                case GL_COMPRESSED_RG_RGTC2:
+                    loopi(16) vals[i] = block[i][0];
+                    encodealphablock(vals, dst, quality);
+                    loopi(16) vals[i] = block[i][1];
+                    encodealphablock(vals, &dst[8], quality);
+                    dst += 16;
+                    break;
+            }
+        }
+    }
+};
 
 bool loaddds(const char *filename, ImageData &image, int force)
 {
@@ -3933,41 +4261,36 @@ bool loaddds(const char *filename, ImageData &image, int force)
     return true;
 }
 
-void gendds(char *infile, char *outfile)
+void benchdds(char *filename, int *iterations)
 {
-    if(!hasS3TC || usetexcompress <= 1) { conoutf(CON_ERROR, "OpenGL driver does not support S3TC texture compression"); return; }
-
-    glHint(GL_TEXTURE_COMPRESSION_HINT, GL_NICEST);
+    int n = *iterations > 0 ? *iterations : 10;
+    ImageData image;
+    Uint32 start = SDL_GetTicks();
+    loopi(n)
+    {
+        image.cleanup();
+        if(!loaddds(filename, image, 1)) { conoutf(CON_ERROR, "could not load %s", filename); return; }
+    }
+    Uint32 end = SDL_GetTicks();
+    conoutf("decoded %s (%d x %d) %d times, %.2f ms average", filename, image.w, image.h, n, float(end - start) / n);
+}
+COMMAND(benchdds, "si");
 
-    defformatstring(cfile, "<compress>%s", infile);
-    extern void reloadtex(char *name);
-    Texture *t = textures.access(path(cfile));
-    if(t) reloadtex(cfile);
-    t = textureload(cfile);
-    if(t==notexture) { conoutf(CON_ERROR, "failed loading %s", infile); return; }
+void gendds(char *infile, char *outfile)
+{
+    ImageData s;
+    if(!texturedata(s, infile, false) || !s.data) { conoutf(CON_ERROR, "failed loading %s", infile); return; }
+    if(s.compressed) { conoutf(CON_ERROR, "%s is already compressed", infile); return; }
 
-    glBindTexture(GL_TEXTURE_2D, t->id);
-    GLint compressed = 0, format = 0, width = 0, height = 0;
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
-
-    if(!compressed) { conoutf(CON_ERROR, "failed compressing %s", infile); return; }
-    int fourcc = 0;
-    switch(format)
+    GLenum format = GL_FALSE;
+    int fourcc = 0, blocksize = 0;
+    switch(s.bpp)
     {
-        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: fourcc = FOURCC_DXT1; conoutf("compressed as DXT1"); break;
-        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: fourcc = FOURCC_DXT1; conoutf("compressed as DXT1a"); break;
-        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: fourcc = FOURCC_DXT3; conoutf("compressed as DXT3"); break;
-        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: fourcc = FOURCC_DXT5; conoutf("compressed as DXT5"); break;
-        case GL_COMPRESSED_LUMINANCE_LATC1_EXT:
-        case GL_COMPRESSED_RED_RGTC1: fourcc = FOURCC_ATI1; conoutf("compressed as ATI1"); break;
-        case GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT:
-        case GL_COMPRESSED_RG_RGTC2: fourcc = FOURCC_ATI2; conoutf("compressed as ATI2"); break;
-        default:
-            conoutf(CON_ERROR, "failed compressing %s: unknown format: 0x%X", infile, format); break;
-            return;
+        case 1: format = GL_COMPRESSED_RED_RGTC1; fourcc = FOURCC_ATI1; blocksize = 8; conoutf("compressing as ATI1"); break;
+        case 2: format = GL_COMPRESSED_RG_RGTC2; fourcc = FOURCC_ATI2; blocksize = 16; conoutf("compressing as ATI2"); break;
+        case 3: format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; fourcc = FOURCC_DXT1; blocksize = 8; conoutf("compressing as DXT1"); break;
+        case 4: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; fourcc = FOURCC_DXT5; blocksize = 16; conoutf("compressing as DXT5"); break;
+        default: conoutf(CON_ERROR, "failed compressing %s: unsupported bpp %d", infile, s.bpp); return;
     }
 
     if(!outfile[0])
@@ -3980,56 +4303,59 @@ void gendds(char *infile, char *outfile)
         outfile = buf;
     }
 
-    stream *f = openfile(path(outfile, true), "wb");
-    if(!f) { conoutf(CON_ERROR, "failed writing to %s", outfile); return; }
+    Uint32 start = SDL_GetTicks();
 
-    int csize = 0;
-    for(int lw = width, lh = height, level = 0;;)
+    int levels = 1;
+    for(int lw = s.w, lh = s.h; max(lw, lh) > 1; levels++)
     {
-        GLint size = 0;
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, level++, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
-        csize += size;
-        if(max(lw, lh) <= 1) break;
         if(lw > 1) lw /= 2;
         if(lh > 1) lh /= 2;
     }
+    ImageData *mips = new ImageData[levels];
+    mips[0].replace(s);
+    for(int i = 1; i < levels; i++)
+    {
+        const ImageData &prev = mips[i-1];
+        mips[i].setdata(NULL, max(prev.w/2, 1), max(prev.h/2, 1), prev.bpp);
+        scaletexture(prev.data, prev.w, prev.h, prev.bpp, prev.pitch, mips[i].data, mips[i].w, mips[i].h);
+    }
+
+    ImageData c(mips[0].w, mips[0].h, blocksize, levels, 4, format);
+    ddsencoder enc(format, ddsquality);
+    uchar *dst = c.data;
+    loopi(levels)
+    {
+        enc.addlevel(mips[i], dst, blocksize);
+        dst += c.calclevelsize(i);
+    }
+    enc.process(ddsthreads > 0 ? ddsthreads : numcpus);
+    delete[] mips;
 
+    stream *f = openfile(path(outfile, true), "wb");
+    if(!f) { conoutf(CON_ERROR, "failed writing to %s", outfile); return; }
+
+    int csize = c.calcsize();
     DDSURFACEDESC2 d;
     memset(&d, 0, sizeof(d));
     d.dwSize = sizeof(DDSURFACEDESC2);
-    d.dwWidth = width;
-    d.dwHeight = height;
+    d.dwWidth = c.w;
+    d.dwHeight = c.h;
     d.dwLinearSize = csize;
+    d.dwMipMapCount = levels;
     d.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
     d.ddsCaps.dwCaps = DDSCAPS_TEXTURE | DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
     d.ddpfPixelFormat.dwSize = sizeof(DDPIXELFORMAT);
     d.ddpfPixelFormat.dwFlags = DDPF_FOURCC | (alphaformat(uncompressedformat(format)) ? DDPF_ALPHAPIXELS : 0);
     d.ddpfPixelFormat.dwFourCC = fourcc;
 
-    uchar *data = new uchar[csize], *dst = data;
-    for(int lw = width, lh = height;;)
-    {
-        GLint size;
-        glGetTexLevelParameteriv(GL_TEXTURE_2D, d.dwMipMapCount, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
-        glGetCompressedTexImage_(GL_TEXTURE_2D, d.dwMipMapCount++, dst);
-        dst += size;
-        if(max(lw, lh) <= 1) break;
-        if(lw > 1) lw /= 2;
-        if(lh > 1) lh /= 2;
-    }
-
     lilswap((uint *)&d, sizeof(d)/sizeof(uint));
 
     f->write("DDS ", 4);
     f->write(&d, sizeof(d));
-    f->write(data, csize);
+    f->write(c.data, csize);
     delete f;
 
-    delete[] data;
-
-    conoutf("wrote DDS file %s", outfile);
-
-    setuptexcompress();
+    conoutf("wrote DDS file %s (%d x %d, %d mipmaps, %.1f seconds)", outfile, c.w, c.h, levels, (SDL_GetTicks() - start) / 1000.0f);
 }
 COMMAND(gendds, "ss");
 
@@ -472,6 +472,9 @@ struct ImageData
     uchar *data;
     void *owner;
     void (*freefunc)(void *);
+#ifdef MEMSTATS
+    int memsize;
+#endif
 
     ImageData()
         : data(NULL), owner(NULL), freefunc(NULL)
@@ -502,7 +505,15 @@ struct ImageData
         pitch = align ? 0 : w*bpp;
         compressed = ncompressed;
         data = ndata ? ndata : new uchar[calcsize()];
-        if(!ndata) { owner = this; freefunc = NULL; }
+        if(!ndata)
+        {
+            owner = this;
+            freefunc = NULL;
+#ifdef MEMSTATS
+            memsize = calcsize();
+            MEMTRACK(MEM_TEXTURE, memsize);
+#endif
+        }
     }
 
     int calclevelsize(int level) const { return ((max(w>>level, 1)+align-1)/align)*((max(h>>level, 1)+align-1)/align)*bpp; }
@@ -533,7 +544,11 @@ struct ImageData
 
     void cleanup()
     {
-        if(owner==this) delete[] data;
+        if(owner==this)
+        {
+            MEMTRACK(MEM_TEXTURE, -memsize);
+            delete[] data;
+        }
         else if(freefunc) (*freefunc)(owner);
         disown();
     }
@@ -211,6 +211,49 @@ struct vertmodel : animmodel
             DELETEA(vdata);
         }
 
+        void savecache(stream *f)
+        {
+            f->put<int>(numframes);
+            f->put<int>(meshes.length());
+            loopv(meshes)
+            {
+                vertmesh &m = *(vertmesh *)meshes[i];
+                putcachestring(f, m.name);
+                putcachearray(f, m.verts, m.numverts*numframes);
+                putcachearray(f, m.tcverts, m.verts ? m.numverts : 0);
+                putcachearray(f, m.tris, m.numtris);
+            }
+        }
+
+        bool loadcache(stream *f)
+        {
+            numframes = f->get<int>();
+            int nummeshes = f->get<int>();
+            bool ok = numframes > 0 && nummeshes > 0 && nummeshes <= 0x10000;
+            if(ok) loopi(nummeshes)
+            {
+                vertmesh *m = new vertmesh;
+                m->group = this;
+                m->name = getcachestring(f);
+                meshes.add(m);
+                int numverts = 0, numtcverts = 0;
+                if(!getcachearray(f, m->verts, numverts) || !getcachearray(f, m->tcverts, numtcverts) || !getcachearray(f, m->tris, m->numtris) ||
+                   numverts != numtcverts*numframes)
+                {
+                    ok = false;
+                    break;
+                }
+                m->numverts = numtcverts;
+                loopj(m->numtris) loopk(3) if(m->tris[j].vert[k] >= m->numverts) ok = false;
+            }
+            if(!ok)
+            {
+                meshes.deletecontents();
+                numframes = 0;
+            }
+            return ok;
+        }
+
         int findtag(const char *name)
         {
             loopi(numtags) if(!strcmp(tags[i].name, name)) return i;
@@ -248,6 +248,7 @@ static bool modifyoctaent(int flags, int id, extentity &e)
         case ET_LIGHT: clearlightcache(id); if(e.attr[4]&L_VOLUMETRIC) { if(flags&MODOE_ADD) volumetriclights++; else --volumetriclights; } break;
         case ET_SPOTLIGHT: if(!(flags&MODOE_ADD ? spotlights++ : --spotlights)) { cleardeferredlightshaders(); cleanupvolumetric(); } break;
         case ET_PARTICLES: clearparticleemitters(); break;
+        case ET_SOUND: clearmapsoundgrid(); break;
         case ET_DECAL: if(flags&MODOE_CHANGED) changed(o, r, false); break;
     }
     return true;
@@ -276,6 +277,20 @@ static inline void removeentityedit(int id) { modifyoctaent(MODOE_UPDATEBB|MODOE
 void addentity(extentity* entity) { addentity(getentid(entity)); }
 void removeentity(extentity *entity) { removeentity(getentid(entity)); }
 
+/* OctaForge: batched versions for callers that already know the ids, repeated ids are only handled once */
+static void modifyoctaents(int flags, const int *ids, int n)
+{
+    static vector<int> uniqueids;
+    uniqueids.setsize(0);
+    uniqueids.put(ids, n);
+    uniqueids.sort();
+    uniqueids.unique();
+    loopv(uniqueids) modifyoctaent(flags, uniqueids[i]);
+}
+
+void addentities(const int *ids, int n) { modifyoctaents(MODOE_ADD|MODOE_UPDATEBB, ids, n); }
+void removeentities(const int *ids, int n) { modifyoctaents(MODOE_UPDATEBB, ids, n); }
+
 void freeoctaentities(cube &c)
 {
     if(!c.ext) return;
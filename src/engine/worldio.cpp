@@ -891,6 +891,8 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     logger::log(logger::DEBUG, "Requesting active entities...");
 //    game::addmsg(N_ACTIVEENTSREQUEST, "r"); // ask for players/logic entities
 
+    loadsoundmanifest(cname ? cname : mname);
+
     preloadusedmapmodels(true);
     flushpreloadedmodels();
 
@@ -1011,7 +1011,18 @@ namespace game
                 }
                 updatephysstate(d);
                 updatepos(d);
-                if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
+                if(interpdelay && d->smoothmillis>=0)
+                {
+                    if(addsnapshot(d))
+                    {
+                        d->o = oldpos;
+                        d->yaw = oldyaw;
+                        d->pitch = oldpitch;
+                        d->roll = oldroll;
+                    }
+                    d->smoothmillis = 0;
+                }
+                else if(smoothmove && d->smoothmillis>=0 && oldpos.dist(d->o) < smoothdist)
                 {
                     d->newpos = d->o;
                     d->newyaw = d->yaw;
@@ -1030,6 +1041,7 @@ namespace game
                     d->smoothmillis = lastmillis;
                 }
                 else d->smoothmillis = 0;
+                if(!interpdelay && d->snapshots.num) d->snapshots.clear();
                 if(d->state==CS_LAGGED || d->state==CS_SPAWNING) d->state = CS_ALIVE;
                 break;
             }
@@ -1056,13 +1068,19 @@ namespace game
 
     SVARP(chat_sound, "olpc/FlavioGaete/Vla_G_Major");
 
+    msgstats clientmsgstats;
+
     void parsemessages(int cn, gameent *d, ucharbuf &p)
     {
         static char text[MAXTRANS];
         int type;
         bool mapchanged = false, demopacket = false;
 
-        while(p.remaining()) switch(type = getint(p))
+        #define BEGIN_MSG (msgstart = p.length(), msgkind = MSGSTAT_NATIVE, msgbegin = server::netstats ? profmicros() : 0, true)
+        #define END_MSG (server::netstats ? clientmsgstats.add(type, p.length() - msgstart, profmicros() - msgbegin, msgkind) : (void)0)
+        int msgstart = 0, msgkind = MSGSTAT_NATIVE;
+        ullong msgbegin = 0;
+        for(; p.remaining() && BEGIN_MSG; END_MSG) switch(type = getint(p))
         {
             case N_DEMOPACKET: demopacket = true; break;
 
@@ -1119,7 +1137,14 @@ namespace game
             {
                 int cn = getint(p), len = getuint(p);
                 ucharbuf q = p.subbuf(len);
+                ullong nestedbegin = server::netstats ? profmicros() : 0;
                 parsemessages(cn, getclient(cn), q);
+                // the nested messages are counted on their own, only the wrapper itself is left here
+                if(server::netstats)
+                {
+                    msgbegin += profmicros() - nestedbegin;
+                    msgstart += q.length();
+                }
                 break;
             }
 
@@ -1533,7 +1558,8 @@ namespace game
                 bool hashandler = false;
                 lua::pop_external_ret(lua::call_external_ret("message_receive", "iiip",
                     "b", type, game::player1->clientnum, cn, (void*)&p, &hashandler));
-                if (!hashandler) {
+                if(hashandler) msgkind = MSGSTAT_LUA;
+                else {
                     logger::log(logger::DEBUG, "No scripting handler for message %d from %d", type, cn);
                     neterr("type", cn < 0);
                     return;
@@ -1541,6 +1567,8 @@ namespace game
                 break;
             }
         }
+        #undef BEGIN_MSG
+        #undef END_MSG
     }
 
     void receivefile(packetbuf &p)
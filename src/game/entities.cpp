@@ -3,6 +3,8 @@
 
 void removeentity(extentity* entity);
 void addentity(extentity* entity);
+void removeentities(const int *ids, int n);
+void addentities(const int *ids, int n);
 void attachentity(extentity &e);
 bool enttoggle(int id);
 void makeundoent();
@@ -317,6 +319,113 @@ namespace entities
     DYNENTVEC(falling, falling)
     #undef DYNENTVEC
 
+    /* Bulk transforms: one call covers a whole list of entities, with
+     * positions, velocities and orientations (yaw, pitch, roll) packed as
+     * 3 floats per entity and any of the arrays allowed to be NULL; on set,
+     * a per-entity mask of XFORM_* bits selects what to apply (NULL mask
+     * applies every given array)
+     */
+
+    enum {
+        XFORM_POS  = 1 << 0,
+        XFORM_VEL  = 1 << 1,
+        XFORM_ORI  = 1 << 2,
+        XFORM_ANIM = 1 << 3
+    };
+
+    CLUAICOMMAND(get_dynent_transforms, void, (physent **dyns, int n,
+    float *pos, float *vel, float *ori), {
+        for (int i = 0; i < n; ++i) {
+            gameent *d = (gameent*)dyns[i];
+            if (!d) continue;
+            if (pos) {
+                pos[3*i + 0] = d->o.x;
+                pos[3*i + 1] = d->o.y;
+                pos[3*i + 2] = d->o.z - d->eyeheight;
+            }
+            if (vel) {
+                vel[3*i + 0] = d->vel.x;
+                vel[3*i + 1] = d->vel.y;
+                vel[3*i + 2] = d->vel.z;
+            }
+            if (ori) {
+                ori[3*i + 0] = d->yaw;
+                ori[3*i + 1] = d->pitch;
+                ori[3*i + 2] = d->roll;
+            }
+        }
+    });
+
+    CLUAICOMMAND(set_dynent_transforms, void, (physent **dyns, int n,
+    const uchar *mask, const float *pos, const float *vel, const float *ori,
+    const int *anims), {
+        for (int i = 0; i < n; ++i) {
+            gameent *d = (gameent*)dyns[i];
+            if (!d) continue;
+            int m = mask ? mask[i] : ~0;
+            if (pos && (m & XFORM_POS)) {
+                d->o = vec(pos[3*i], pos[3*i + 1], pos[3*i + 2] + d->eyeheight);
+                d->newpos = d->o;
+                d->resetinterp();
+            }
+            if (vel && (m & XFORM_VEL)) {
+                d->vel = vec(vel[3*i], vel[3*i + 1], vel[3*i + 2]);
+            }
+            if (ori && (m & XFORM_ORI)) {
+                d->yaw   = ori[3*i + 0];
+                d->pitch = ori[3*i + 1];
+                d->roll  = ori[3*i + 2];
+            }
+            if (anims && (m & XFORM_ANIM)) {
+                d->anim = anims[i];
+                d->start_time = lastmillis;
+            }
+        }
+    });
+
+    CLUAICOMMAND(get_extent_transforms, void, (const int *uids, int n,
+    float *pos), {
+        for (int i = 0; i < n; ++i) {
+            if (!ents.inrange(uids[i])) continue;
+            const vec &o = ents[uids[i]]->o;
+            pos[3*i + 0] = o.x;
+            pos[3*i + 1] = o.y;
+            pos[3*i + 2] = o.z;
+        }
+    });
+
+    /* Extents are addressed by uid (their index in the entity list) so the
+     * octree can be updated without searching for each entity; only those
+     * that actually moved are unlinked and linked again (a repeated uid is
+     * relinked once, with its last position). Returns the number of
+     * relinked entities.
+     */
+    CLUAICOMMAND(set_extent_transforms, int, (const int *uids, int n,
+    const uchar *mask, const float *pos), {
+        static vector<int> moved;
+        moved.setsize(0);
+        for (int i = 0; i < n; ++i) {
+            if (mask && !(mask[i] & XFORM_POS)) continue;
+            if (!ents.inrange(uids[i])) continue;
+            vec o(pos[3*i], pos[3*i + 1], pos[3*i + 2]);
+            if (ents[uids[i]]->o == o) continue;
+            moved.add(i);
+        }
+        if (moved.empty()) return 0;
+        static vector<int> ids;
+        ids.setsize(0);
+        for (int i = 0; i < moved.length(); ++i) ids.add(uids[moved[i]]);
+        removeentities(ids.getbuf(), ids.length());
+        for (int i = 0; i < moved.length(); ++i) {
+            const float *p = &pos[3*moved[i]];
+            ents[ids[i]]->o = vec(p[0], p[1], p[2]);
+        }
+        ids.sort();
+        ids.unique();
+        addentities(ids.getbuf(), ids.length());
+        return ids.length();
+    });
+
     CLUAICOMMAND(get_plag, bool, (physent *d, int *val), {
         gameent *p = (gameent*)d;
         assert(p);
@@ -167,6 +167,109 @@ namespace game
         }
     }
 
+    // snapshot interpolation: remote players are drawn interpdelay ms in the past, blending between
+    // the two received poses around that time instead of simulating them; the delay grows to cover
+    // the measured packet jitter so there is normally a newer pose to blend towards, and physics is
+    // only run to extrapolate when the buffer runs dry, for at most interpextrap ms
+    VARP(interpdelay, 0, 100, 500);
+    VARP(interpjitter, 0, 1, 1);
+    VARP(interpextrap, 0, 200, 1000);
+
+    static inline void savepose(gameent *d, posesnapshot &s)
+    {
+        s.o = d->o;
+        s.vel = d->vel;
+        s.falling = d->falling;
+        s.yaw = d->yaw;
+        s.pitch = d->pitch;
+        s.roll = d->roll;
+        s.physstate = d->physstate;
+    }
+
+    static inline void loadpose(gameent *d, const posesnapshot &s)
+    {
+        d->o = s.o;
+        d->vel = s.vel;
+        d->falling = s.falling;
+        d->yaw = s.yaw;
+        d->pitch = s.pitch;
+        d->roll = s.roll;
+        d->physstate = s.physstate;
+    }
+
+    // records the pose just parsed into d; returns false if d should jump to it right away
+    bool addsnapshot(gameent *d)
+    {
+        snapshotbuffer &b = d->snapshots;
+        if(b.lastarrival)
+        {
+            float dt = totalmillis - b.lastarrival;
+            b.jitter += (fabs(dt - b.interval) - b.jitter)/16;
+            b.interval += (dt - b.interval)/16;
+        }
+        b.lastarrival = totalmillis;
+        if(b.num && b.newest().o.dist(d->o) >= smoothdist) b.clear();
+        if(b.extrapolating && b.num && b.rendertime > b.newest().time)
+        {
+            // continue from where the player is drawn rather than snapping back to the timeline
+            posesnapshot &cur = b.add();
+            cur.time = b.rendertime;
+            savepose(d, cur);
+        }
+        b.extrapolating = false;
+        bool blend = b.num > 0;
+        posesnapshot &s = blend && b.newest().time >= totalmillis ? b.newest() : b.add();
+        s.time = totalmillis;
+        savepose(d, s);
+        return blend;
+    }
+
+    static inline float lerpangle(float a, float b, float t)
+    {
+        float d = b - a;
+        if(d > 180) d -= 360;
+        else if(d < -180) d += 360;
+        float r = a + d*t;
+        if(r < 0) r += 360;
+        else if(r >= 360) r -= 360;
+        return r;
+    }
+
+    // samples the pose at the current render time; returns false while extrapolating with physics
+    static bool interpolateplayer(gameent *d)
+    {
+        snapshotbuffer &b = d->snapshots;
+        float target = interpdelay;
+        if(interpjitter) target = max(target, b.interval + 2*b.jitter);
+        target = min(target, 1000.0f);
+        if(b.delay < 0) b.delay = target;
+        else b.delay += (target - b.delay)*min(curtime/500.0f, 1.0f);
+        int rendertime = totalmillis - int(b.delay);
+        b.rendertime = rendertime;
+        while(b.num >= 2 && b.get(1).time <= rendertime) b.drop();
+        posesnapshot &from = b.get(0);
+        if(b.num >= 2)
+        {
+            posesnapshot &to = b.get(1);
+            float t = clamp(float(rendertime - from.time)/max(to.time - from.time, 1), 0.0f, 1.0f);
+            d->o.lerp(from.o, to.o, t);
+            d->vel.lerp(from.vel, to.vel, t);
+            d->falling.lerp(from.falling, to.falling, t);
+            d->yaw = lerpangle(from.yaw, to.yaw, t);
+            d->pitch = from.pitch + (to.pitch - from.pitch)*t;
+            d->roll = from.roll + (to.roll - from.roll)*t;
+            d->physstate = t < 1 ? from.physstate : to.physstate;
+            return true;
+        }
+        if(rendertime <= from.time) { loadpose(d, from); return true; }
+        if(!b.extrapolating)
+        {
+            loadpose(d, from);
+            b.extrapolating = true;
+        }
+        return rendertime - from.time > interpextrap;
+    }
+
     void otherplayers(int curtime)
     {
         loopv(players)
@@ -177,7 +280,8 @@ namespace game
             if(d->state==CS_DEAD && d->ragdoll) moveragdoll(d);
 
             const int lagtime = totalmillis-d->lastupdate;
-            if(!lagtime) continue;
+            const bool interp = interpdelay && d->snapshots.num > 0;
+            if(!lagtime && !interp) continue;
             else if(lagtime>1000 && d->state==CS_ALIVE)
             {
                 d->state = CS_LAGGED;
@@ -186,7 +290,8 @@ namespace game
             if(d->state==CS_ALIVE || d->state==CS_EDITING)
             {
                 crouchplayer(d, 10, false);
-                if(smoothmove && d->smoothmillis>0) predictplayer(d, true);
+                if(interp) { if(!interpolateplayer(d)) moveplayer(d, 1, false); }
+                else if(smoothmove && d->smoothmillis>0) predictplayer(d, true);
                 else moveplayer(d, 1, false);
             }
             else if(d->state==CS_DEAD && !d->ragdoll && lastmillis-d->lastpain<2000) moveplayer(d, 1, true);
@@ -198,10 +303,16 @@ namespace game
         if(!maptime) { maptime = lastmillis; maprealtime = totalmillis; return; }
         if(!curtime) { gets2c(); if(player1->clientnum>=0) c2sinfo(); return; }
 
-        physicsframe();
-        otherplayers(curtime);
-        moveragdolls();
-        lua::call_external("frame_handle", "ii", curtime, lastmillis);
+        {
+            PROFSCOPE("physics");
+            physicsframe();
+            otherplayers(curtime);
+            moveragdolls();
+        }
+        {
+            PROFSCOPE("frame_handle");
+            lua::call_external("frame_handle", "ii", curtime, lastmillis);
+        }
         gets2c();
         bool b;
         lua::pop_external_ret(lua::call_external_ret("entity_is_initialized",
@@ -120,6 +120,54 @@ struct demoheader
 
 #define MAXNAMELEN 15
 
+#ifndef STANDALONE
+// remote player poses as they arrive, replayed a short delay behind real time (see game.cpp)
+struct posesnapshot
+{
+    int time;
+    vec o, vel, falling;
+    float yaw, pitch, roll;
+    uchar physstate;
+};
+
+struct snapshotbuffer
+{
+    enum { MAXSNAPSHOTS = 16 };
+
+    posesnapshot snaps[MAXSNAPSHOTS];
+    int first, num;                 // ring of snapshots, oldest first
+    int lastarrival;
+    float interval, jitter;         // smoothed arrival interval and its mean deviation in ms
+    float delay;                    // interpolation delay in use, eased towards its target
+    int rendertime;                 // time the pose was last sampled at
+    bool extrapolating;
+
+    snapshotbuffer() : lastarrival(0), interval(50), jitter(0), delay(-1) { clear(); }
+
+    void clear()
+    {
+        first = num = 0;
+        rendertime = 0;
+        extrapolating = false;
+    }
+
+    posesnapshot &get(int i) { return snaps[(first + i)%MAXSNAPSHOTS]; }
+    posesnapshot &newest() { return get(num-1); }
+
+    posesnapshot &add()
+    {
+        if(num >= MAXSNAPSHOTS) drop();
+        return get(num++);
+    }
+
+    void drop()
+    {
+        first = (first + 1)%MAXSNAPSHOTS;
+        num--;
+    }
+};
+#endif
+
 struct gameent : dynent
 {
     int weight;                         // affects the effectiveness of hitpush
@@ -140,6 +188,7 @@ struct gameent : dynent
 #ifndef STANDALONE
     vector<modelattach> attachments;
     hashtable<const char*, entlinkpos> attachment_positions;
+    snapshotbuffer snapshots;
 #endif
 
     gameent() : weight(100), clientnum(-1), privilege(PRIV_NONE), lastupdate(0), plag(0), ping(0), lifesequence(0), lastpain(0), edit(NULL), smoothmillis(-1), anim(0), start_time(0), can_move(false), ai(NULL)
@@ -180,6 +229,14 @@ struct gameent : dynent
         turn_move = look_updown_move = 0;
     }
 
+    virtual void resetinterp() // OF: virtual
+    {
+        dynent::resetinterp();
+#ifndef STANDALONE
+        snapshots.clear();
+#endif
+    }
+
     float getheight() // Kripken: Added this
     {
         return aboveeye + eyeheight;
@@ -193,11 +250,34 @@ struct gameent : dynent
     }
 };
 
+// per message type counters for parsepacket and parsemessages, enabled by the netstats var
+enum { MSGSTAT_NATIVE = 0, MSGSTAT_LUA, MSGSTAT_RELAYED };
+
+struct msgstat
+{
+    uint count, lua, relayed;
+    ullong bytes, micros, peak;
+};
+
+struct msgstats
+{
+    vector<msgstat> types;
+
+    void add(int type, int bytes, ullong micros, int kind);
+    void reset() { types.setsize(0); }
+    bool report(const char *title, int n, bool log);
+};
+
 namespace entities
 {
     extern vector<extentity *> ents;
 }
 
+namespace entsched
+{
+    extern void clear();
+}
+
 namespace game
 {
     extern int gamemode;
@@ -210,12 +290,13 @@ namespace game
     extern vector<gameent *> players, clients;
     extern int lastspawnattempt;
     extern int following;
-    extern int smoothmove, smoothdist;
+    extern int smoothmove, smoothdist, interpdelay;
 
     extern bool clientoption(const char *arg);
     extern gameent *getclient(int cn);
     extern gameent *newclient(int cn);
     extern const char *colorname(gameent *d, const char *name = NULL, const char *alt = NULL, const char *color = "");
+    extern bool addsnapshot(gameent *d);
     extern gameent *pointatplayer();
     extern gameent *hudplayer();
     extern gameent *followingplayer();
@@ -235,6 +316,7 @@ namespace game
     extern bool connected, remote, demoplayback;
     extern string servdesc;
     extern vector<uchar> messages;
+    extern msgstats clientmsgstats;
 
     extern int parseplayer(const char *arg);
     extern void ignore(int cn);
@@ -271,6 +353,9 @@ namespace server
     extern void hashpassword(int cn, int sessionid, const char *pwd, char *result, int maxlen = MAXSTRLEN);
     extern int msgsizelookup(int msg);
     extern bool serveroption(const char *arg);
+
+    extern int netstats;
+    extern const char *msgname(int type);
 }
 
 #endif
@@ -0,0 +1,132 @@
+// scheduler.cpp: native run scheduler for scripted entities
+// entities register once with a priority and an optional tick interval and can be put to sleep or
+// woken from script; each frame the script fetches just the due entities in one call instead of
+// walking every entity storage and checking its flags in Lua
+
+#include "game.h"
+
+namespace entsched
+{
+    enum { PRIO_HIGH = 0, PRIO_NORMAL, PRIO_LOW, NUMPRIOS };
+
+    static const int SLEEPFOREVER = INT_MAX;
+
+    struct schedent
+    {
+        int uid, prio, interval;
+        int next, last;             // scheduler time the entity is due at and last ran at
+    };
+
+    static vector<schedent> ents;
+    static hashtable<int, int> slots;   // storage uid -> index into ents
+    static vector<int> due[NUMPRIOS], dispatch;
+    static int schedtime = 0, numdue = 0;
+
+    static schedent *find(int uid)
+    {
+        int idx = slots.find(uid, -1);
+        return idx >= 0 ? &ents[idx] : NULL;
+    }
+
+    // (re)registers an entity; interval 0 runs it every frame, otherwise about every interval ms,
+    // with the phase spread by uid so entities of the same tick group don't all land on one frame
+    void add(int uid, int prio, int interval)
+    {
+        schedent *e = find(uid);
+        if(!e)
+        {
+            slots[uid] = ents.length();
+            e = &ents.add();
+            e->uid = uid;
+            e->last = schedtime;
+            e->next = schedtime + (interval > 0 ? int(uint(uid)%uint(interval)) : 0);
+        }
+        e->prio = clamp(prio, 0, NUMPRIOS-1);
+        e->interval = max(interval, 0);
+    }
+
+    void remove(int uid)
+    {
+        int idx = slots.find(uid, -1);
+        if(idx < 0) return;
+        slots.remove(uid);
+        if(idx < ents.length()-1)
+        {
+            ents[idx] = ents.last();
+            slots[ents[idx].uid] = idx;
+        }
+        ents.pop();
+    }
+
+    void clear()
+    {
+        ents.setsize(0);
+        slots.clear();
+        loopi(NUMPRIOS) due[i].setsize(0);
+        dispatch.setsize(0);
+        schedtime = numdue = 0;
+    }
+
+    // a negative time sleeps until woken
+    void sleep(int uid, int millis)
+    {
+        schedent *e = find(uid);
+        if(e) e->next = millis < 0 ? SLEEPFOREVER : schedtime + millis;
+    }
+
+    void wake(int uid)
+    {
+        schedent *e = find(uid);
+        if(e && e->next > schedtime) e->next = schedtime;
+    }
+
+    // advances the scheduler clock and returns the due entities as (uid, elapsed millis) pairs,
+    // highest priority first; the elapsed time covers every frame since the entity last ran, so
+    // throttled or sleeping entities catch up on their action queues when they do run
+    int *run(int millis, int &count)
+    {
+        schedtime += max(millis, 0);
+        loopv(ents)
+        {
+            schedent &e = ents[i];
+            if(e.next > schedtime) continue;
+            vector<int> &d = due[e.prio];
+            d.add(e.uid);
+            d.add(schedtime - e.last);
+            e.last = schedtime;
+            if(!e.interval) e.next = schedtime;
+            else
+            {
+                e.next += e.interval;
+                if(e.next <= schedtime) e.next = schedtime + e.interval;
+            }
+        }
+        dispatch.setsize(0);
+        loopi(NUMPRIOS)
+        {
+            dispatch.put(due[i].getbuf(), due[i].length());
+            due[i].setsize(0);
+        }
+        count = numdue = dispatch.length()/2;
+        return dispatch.getbuf();
+    }
+
+    void entschedinfo()
+    {
+        int sleeping = 0, throttled = 0;
+        loopv(ents)
+        {
+            if(ents[i].next == SLEEPFOREVER) sleeping++;
+            else if(ents[i].interval) throttled++;
+        }
+        conoutf("%d scheduled entities (%d throttled, %d sleeping), %d due last frame", ents.length(), throttled, sleeping, numdue);
+    }
+    COMMAND(entschedinfo, "");
+
+    CLUAICOMMAND(entsched_add, void, (int uid, int prio, int interval), add(uid, prio, interval));
+    CLUAICOMMAND(entsched_remove, void, (int uid), remove(uid));
+    CLUAICOMMAND(entsched_clear, void, (), clear());
+    CLUAICOMMAND(entsched_sleep, void, (int uid, int millis), sleep(uid, millis));
+    CLUAICOMMAND(entsched_wake, void, (int uid), wake(uid));
+    CLUAICOMMAND(entsched_run, int *, (int millis, int *count), return run(millis, *count););
+}
@@ -15,6 +15,61 @@ namespace game
     const char *gameident() { return "OctaForge"; }
 }
 
+#define MAXMSGSTATS 1024
+
+void msgstats::add(int type, int bytes, ullong micros, int kind)
+{
+    if(type < 0 || type >= MAXMSGSTATS) return;
+    if(type >= types.length())
+    {
+        int old = types.length();
+        memset(types.pad(type+1 - old), 0, (type+1 - old)*sizeof(msgstat));
+    }
+    msgstat &s = types[type];
+    s.count++;
+    if(kind == MSGSTAT_LUA) s.lua++;
+    else if(kind == MSGSTAT_RELAYED) s.relayed++;
+    s.bytes += bytes;
+    s.micros += micros;
+    s.peak = max(s.peak, micros);
+}
+
+static msgstats *sortmsgstats = NULL;
+static bool msgstatcmp(int a, int b)
+{
+    const msgstat &x = sortmsgstats->types[a], &y = sortmsgstats->types[b];
+    return x.micros > y.micros || (x.micros == y.micros && x.bytes > y.bytes);
+}
+
+#define NETSTATOUT(...) do { if(log) logoutf(__VA_ARGS__); else conoutf(__VA_ARGS__); } while(0)
+
+// prints the n message types with the most handler time
+bool msgstats::report(const char *title, int n, bool log)
+{
+    vector<int> order;
+    uint count = 0;
+    ullong bytes = 0, micros = 0;
+    loopv(types) if(types[i].count)
+    {
+        order.add(i);
+        count += types[i].count;
+        bytes += types[i].bytes;
+        micros += types[i].micros;
+    }
+    if(order.empty()) return false;
+    sortmsgstats = this;
+    order.sort(msgstatcmp);
+    NETSTATOUT("%s messages: %u, %.1f KB, %.3f ms handling", title, count, bytes/1024.0f, micros/1000.0f);
+    loopv(order)
+    {
+        if(i >= n) break;
+        const msgstat &s = types[order[i]];
+        NETSTATOUT("  %-18s %8u msgs %9.1f KB %9.3f ms (peak %.3f ms) lua %u relayed %u",
+            server::msgname(order[i]), s.count, s.bytes/1024.0f, s.micros/1000.0f, s.peak/1000.0f, s.lua, s.relayed);
+    }
+    return true;
+}
+
 extern ENetAddress masteraddress;
 
 namespace server
@@ -51,6 +106,62 @@ namespace server
         }
     };
 
+    enum { OUT_EDITS = 0, OUT_ENTITIES, NUMOUTQUEUES };
+
+    // reliable traffic from one kind of update source that a client's link couldn't take yet;
+    // queued packets hold a reference and go out in the order they were queued
+    struct outqueue
+    {
+        struct entry
+        {
+            ENetPacket *packet;
+            int queued;
+        };
+
+        vector<entry> packets;
+        int head, bytes, largest;
+        float priority;
+
+        outqueue() : head(0), bytes(0), largest(0), priority(0) {}
+        ~outqueue() { clear(); }
+
+        bool empty() const { return head >= packets.length(); }
+        int oldest() const { return packets[head].queued; }
+
+        void add(ENetPacket *packet)
+        {
+            entry &e = packets.add();
+            e.packet = packet;
+            e.queued = totalmillis;
+            packet->referenceCount++;
+            bytes += packet->dataLength;
+            largest = max(largest, int(packet->dataLength));
+        }
+
+        // the caller sends the packet and then drops the queue's reference with release()
+        ENetPacket *remove()
+        {
+            ENetPacket *packet = packets[head++].packet;
+            bytes -= packet->dataLength;
+            if(empty()) { packets.setsize(0); head = largest = 0; }
+            else if(head >= 64 && 2*head >= packets.length()) { packets.remove(0, head); head = 0; }
+            return packet;
+        }
+
+        static void release(ENetPacket *packet)
+        {
+            if(--packet->referenceCount <= 0) enet_packet_destroy(packet);
+        }
+
+        void clear()
+        {
+            for(int i = head; i < packets.length(); i++) release(packets[i].packet);
+            packets.setsize(0);
+            head = bytes = largest = 0;
+            priority = 0;
+        }
+    };
+
     extern int gamemillis, nextexceeded;
 
     struct clientinfo
@@ -62,10 +173,12 @@ namespace server
         bool connected, local, timesync;
         int gameoffset, pushed, exceeded;
         servstate state;
-        vector<uchar> position, messages;
+        vector<uchar> position, messages, editmessages;
         uchar *wsdata;
         int wslen;
         vector<clientinfo *> bots;
+        outqueue outqueues[NUMOUTQUEUES];
+        int sendrate, sendcredit, heldcredit;
         int ping, aireinit;
         string clientmap;
         int mapcrc;
@@ -78,6 +191,8 @@ namespace server
         void *authchallenge;
         int authkickvictim;
         char *authkickreason;
+        uint msgcount;
+        ullong msgbytes, msgmicros;
 
         clientinfo() : getdemo(NULL), getmap(NULL), clipboard(NULL), authchallenge(NULL), authkickreason(NULL) { reset(); }
         ~clientinfo() { cleanclipboard(); cleanauth(); }
@@ -162,6 +277,25 @@ namespace server
             if(full) cleanauthkick();
         }
 
+        bool holding() const
+        {
+            loopi(NUMOUTQUEUES) if(!outqueues[i].empty()) return true;
+            return false;
+        }
+
+        int heldbytes() const
+        {
+            int bytes = 0;
+            loopi(NUMOUTQUEUES) bytes += outqueues[i].bytes;
+            return bytes;
+        }
+
+        void cleanoutqueues()
+        {
+            loopi(NUMOUTQUEUES) outqueues[i].clear();
+            sendrate = sendcredit = heldcredit = 0;
+        }
+
         void reset()
         {
             name[0] = 0;
@@ -170,11 +304,15 @@ namespace server
             connectauth = 0;
             position.setsize(0);
             messages.setsize(0);
+            editmessages.setsize(0);
             ping = 0;
             aireinit = 0;
             needclipboard = 0;
+            msgcount = 0;
+            msgbytes = msgmicros = 0;
             cleanclipboard();
             cleanauth();
+            cleanoutqueues();
             mapchange();
         }
     };
@@ -458,6 +596,82 @@ namespace server
         return msg >= 0 && msg < NUMMSG ? sizetable[msg] : -1;
     }
 
+    VAR(netstats, 0, 0, 1);
+    VAR(netstatslog, 0, 60, 3600);
+
+    const char *msgname(int type)
+    {
+        static const char * const msgnames[] =
+        {
+            "connect", "servinfo", "welcome", "initclient", "pos", "text", "cdis", "tryspawn", "spawnstate",
+            "spawn", "forcedeath", "mapchange", "mapvote", "ping", "pong", "clientping", "timeup",
+            "forceintermission", "servmsg", "resume", "editmode", "editf", "editt", "editm", "flip", "copy",
+            "paste", "rotate", "replace", "delcube", "calclight", "remip", "editvslot", "undo", "redo", "newmap",
+            "getmap", "sendmap", "clipboard", "editvar", "mastermode", "kick", "clearbans", "currentmaster",
+            "spectator", "setmaster", "listdemos", "senddemolist", "getdemo", "senddemo", "demoplayback",
+            "recorddemo", "stopdemo", "cleardemos", "client", "authtry", "authkick", "authchal", "authans",
+            "reqauth", "pausegame", "gamespeed", "mapcrc", "checkmaps", "servcmd", "demopacket",
+            "activeentsrequest", "allactiveentssent"
+        };
+        if(type >= 0 && type < NUMMSG) return msgnames[type];
+        static string name;
+        formatstring(name, "lua %d", type);
+        return name;
+    }
+
+    static msgstats servermsgstats;
+
+    static void countmsg(clientinfo *ci, int type, int bytes, ullong micros, int kind)
+    {
+        servermsgstats.add(type, bytes, micros, kind);
+        if(!ci) return;
+        ci->msgcount++;
+        ci->msgbytes += bytes;
+        ci->msgmicros += micros;
+    }
+
+    static bool clientmsgcmp(clientinfo *a, clientinfo *b) { return a->msgmicros > b->msgmicros; }
+
+    static bool reportnetstats(int n, bool log)
+    {
+        if(!servermsgstats.report("server", n, log)) return false;
+        vector<clientinfo *> order;
+        loopv(clients) if(clients[i]->msgcount) order.add(clients[i]);
+        order.sort(clientmsgcmp);
+        loopv(order)
+        {
+            if(i >= n) break;
+            clientinfo *ci = order[i];
+            NETSTATOUT("  client %d (%s): %u msgs, %.1f KB, %.3f ms, send %.1f KB/s, %.1f KB held", ci->clientnum, ci->name, ci->msgcount, ci->msgbytes/1024.0f, ci->msgmicros/1000.0f, ci->sendrate/1024.0f, ci->heldbytes()/1024.0f);
+        }
+        return true;
+    }
+
+    void shownetstats(int *n)
+    {
+        int top = *n > 0 ? *n : 10;
+        bool found = reportnetstats(top, false);
+#ifndef STANDALONE
+        if(game::clientmsgstats.report("client", top, false)) found = true;
+#endif
+        if(!found) conoutf(CON_ERROR, "no message statistics (set netstats 1)");
+    }
+    COMMAND(shownetstats, "i");
+
+    void resetnetstats()
+    {
+        servermsgstats.reset();
+        loopv(clients)
+        {
+            clients[i]->msgcount = 0;
+            clients[i]->msgbytes = clients[i]->msgmicros = 0;
+        }
+#ifndef STANDALONE
+        game::clientmsgstats.reset();
+#endif
+    }
+    COMMAND(resetnetstats, "");
+
     const char *modename(int n, const char *unknown)
     {
         if(m_valid(n)) return gamemodes[n - STARTGAMEMODE].name;
@@ -1064,6 +1278,134 @@ namespace server
         sendpacket(-1, 0, p.finalize(), ci.ownernum);
     }
 
+    // outbound budgeting: positions and ordinary relayed messages always go out as soon as they're built,
+    // but edit traffic and scripted entity messages are held back per client once its link is full, so
+    // big map edits and entity syncs can't crowd movement updates out of the connection
+    VAR(sendratemin, 1, 16, 1<<16);       // KB/s any client is assumed to take
+    VAR(sendratemax, 0, 0, 1<<16);        // KB/s cap per client, 0 to go by the link estimate alone
+    VAR(sendburst, 40, 200, 2000);        // ms worth of unused budget a client can bank
+    VAR(sendreserve, 1, 25, 100);         // percent of each tick's budget held traffic gets even if movement used it up
+    VAR(sendstaleness, 1, 250, 10000);    // ms a held back packet waits to double its queue's priority
+    VAR(sendeditpriority, 1, 2, 100);
+    VAR(sendentpriority, 1, 1, 100);
+
+    // bytes per second the link is believed to take: ENet's congestion window over the measured
+    // round trip, scaled down by its packet throttle and capped by what the client asked for
+    static int estimatesendrate(ENetPeer *peer)
+    {
+        ullong rtt = max(peer->roundTripTime + peer->roundTripTimeVariance, 1u),
+               rate = ullong(peer->windowSize)*peer->packetThrottle/ENET_PEER_PACKET_THROTTLE_SCALE*1000/rtt;
+        if(peer->incomingBandwidth) rate = min(rate, ullong(peer->incomingBandwidth));
+        if(sendratemax) rate = min(rate, ullong(sendratemax)*1024);
+        return int(clamp(rate, ullong(sendratemin)*1024, ullong(INT_MAX/4)));
+    }
+
+    static void updatesendbudget(clientinfo &ci, int millis)
+    {
+        ENetPeer *peer = getclientpeer(ci.clientnum);
+        if(!peer) { ci.sendrate = ci.sendcredit = ci.heldcredit = 0; return; }
+        int rate = estimatesendrate(peer);
+        ci.sendrate = ci.sendrate ? (3*ci.sendrate + rate)/4 : rate;
+        int burst = max(int(ullong(ci.sendrate)*sendburst/1000), getservermtu()),
+            refill = int(min(ullong(ci.sendrate)*millis/1000, ullong(burst)));
+        ci.sendcredit = min(ci.sendcredit + refill, burst);
+        // movement is never held back and can overdraw the shared budget on its own, so a share of
+        // every tick is set aside that only held traffic spends, or it could wait indefinitely; it
+        // covers at least a full packet, whatever the rate, so the biggest held one still fits
+        int reserve = max(getservermtu(), 1);
+        loopi(NUMOUTQUEUES) reserve = max(reserve, ci.outqueues[i].largest);
+        ci.heldcredit = max(refill*sendreserve/100, reserve);
+    }
+
+    static inline bool cansend(clientinfo &ci, ENetPeer *peer)
+    {
+        return !peer || ((ci.sendcredit > 0 || ci.heldcredit > 0) && peer->reliableDataInTransit < peer->windowSize);
+    }
+
+    static inline void chargeheld(clientinfo &ci, ENetPacket *packet)
+    {
+        ci.sendcredit -= packet->dataLength;
+        ci.heldcredit -= packet->dataLength;
+    }
+
+    static void sendqueued(clientinfo &ci, int queue, ENetPacket *packet)
+    {
+        if(!ci.holding() && cansend(ci, getclientpeer(ci.clientnum)))
+        {
+            chargeheld(ci, packet);
+            sendpacket(ci.clientnum, 1, packet);
+        }
+        else ci.outqueues[queue].add(packet);
+    }
+
+    // same contract as sendpacket(): the caller still owns the packet if nothing took a reference
+    static void sendqueued(int cn, int queue, ENetPacket *packet, int exclude = -1)
+    {
+        if(cn < 0)
+        {
+            recordpacket(1, packet->data, packet->dataLength);
+            loopv(clients) if(clients[i]->clientnum != exclude) sendqueued(*clients[i], queue, packet);
+            return;
+        }
+        clientinfo *ci = getinfo(cn);
+        if(ci && ci->connected) sendqueued(*ci, queue, packet);
+        else sendpacket(cn, 1, packet);
+    }
+
+    static float sendrelevance(clientinfo &ci, int queue)
+    {
+        switch(queue)
+        {
+            // someone editing alongside needs the map in sync before building on it
+            case OUT_EDITS: return sendeditpriority * (ci.state.state==CS_EDITING ? 2 : 1);
+            case OUT_ENTITIES: return sendentpriority;
+        }
+        return 1;
+    }
+
+    // every tick each backed up queue accumulates priority from its relevance to the client and how
+    // long its oldest packet has waited; queues are drained fullest first while budget lasts and a
+    // queue that got to send starts accumulating again from zero, so no source starves another;
+    // a forced flush goes queue by queue instead, edits first, so a new map they carry is never
+    // overtaken by entity messages queued after it
+    static bool sendheld(clientinfo &ci, bool force = false)
+    {
+        if(!ci.holding()) return false;
+        ENetPeer *peer = getclientpeer(ci.clientnum);
+        loopi(NUMOUTQUEUES)
+        {
+            outqueue &q = ci.outqueues[i];
+            if(!q.empty()) q.priority += sendrelevance(ci, i)*(1 + float(totalmillis - q.oldest())/sendstaleness);
+        }
+        bool sent = false;
+        for(;;)
+        {
+            outqueue *best = NULL;
+            loopi(NUMOUTQUEUES) if(!ci.outqueues[i].empty() && (!best || (!force && ci.outqueues[i].priority > best->priority))) best = &ci.outqueues[i];
+            if(!best || (!force && !cansend(ci, peer))) break;
+            while(!best->empty() && (force || cansend(ci, peer)))
+            {
+                ENetPacket *packet = best->remove();
+                chargeheld(ci, packet);
+                sendpacket(ci.clientnum, 1, packet);
+                outqueue::release(packet);
+            }
+            best->priority = 0;
+            sent = true;
+        }
+        return sent;
+    }
+
+    // delivers everything held back, for points that held traffic must not be overtaken at,
+    // such as a client leaving or the map changing
+    static void flushheld()
+    {
+        loopv(clients) sendheld(*clients[i], true);
+    }
+
+    // set when a client's N_NEWMAP is waiting in its edit messages for the next worldstate
+    static bool newmapqueued = false;
+
     static void sendpositions(worldstate &ws, ucharbuf &wsbuf)
     {
         if(wsbuf.empty()) return;
@@ -1078,6 +1420,7 @@ namespace server
             if(ci.wsdata >= wsbuf.buf) { data = ci.wsdata + ci.wslen; size -= ci.wslen; }
             if(size <= 0) continue;
             ENetPacket *packet = enet_packet_create(data, size, ENET_PACKET_FLAG_NO_ALLOCATE);
+            ci.sendcredit -= size;
             sendpacket(ci.clientnum, 0, packet);
             if(packet->referenceCount) { ws.uses++; packet->freeCallback = cleanworldstate; }
             else enet_packet_destroy(packet);
@@ -1097,7 +1440,7 @@ namespace server
         else ci.wslen += len;
     }
 
-    static void sendmessages(worldstate &ws, ucharbuf &wsbuf)
+    static void sendmessages(worldstate &ws, ucharbuf &wsbuf, int queue = -1)
     {
         if(wsbuf.empty()) return;
         int wslen = wsbuf.length();
@@ -1110,24 +1453,29 @@ namespace server
             int size = wslen;
             if(ci.wsdata >= wsbuf.buf) { data = ci.wsdata + ci.wslen; size -= ci.wslen; }
             if(size <= 0) continue;
-            ENetPacket *packet = enet_packet_create(data, size, (reliablemessages ? ENET_PACKET_FLAG_RELIABLE : 0) | ENET_PACKET_FLAG_NO_ALLOCATE);
-            sendpacket(ci.clientnum, 1, packet);
+            ENetPacket *packet = enet_packet_create(data, size, (reliablemessages || queue >= 0 ? ENET_PACKET_FLAG_RELIABLE : 0) | ENET_PACKET_FLAG_NO_ALLOCATE);
+            if(queue >= 0) sendqueued(ci, queue, packet);
+            else
+            {
+                ci.sendcredit -= size;
+                sendpacket(ci.clientnum, 1, packet);
+            }
             if(packet->referenceCount) { ws.uses++; packet->freeCallback = cleanworldstate; }
             else enet_packet_destroy(packet);
         }
         wsbuf.offset(wsbuf.length());
     }
 
-    static inline void addmessages(worldstate &ws, ucharbuf &wsbuf, int mtu, clientinfo &bi, clientinfo &ci)
+    static inline void addmessages(worldstate &ws, ucharbuf &wsbuf, int mtu, clientinfo &bi, clientinfo &ci, vector<uchar> &messages, int queue = -1)
     {
-        if(bi.messages.empty()) return;
-        if(wsbuf.length() + 10 + bi.messages.length() > mtu) sendmessages(ws, wsbuf);
+        if(messages.empty()) return;
+        if(wsbuf.length() + 10 + messages.length() > mtu) sendmessages(ws, wsbuf, queue);
         int offset = wsbuf.length();
         putint(wsbuf, N_CLIENT);
         putint(wsbuf, bi.clientnum);
-        putuint(wsbuf, bi.messages.length());
-        wsbuf.put(bi.messages.getbuf(), bi.messages.length());
-        bi.messages.setsize(0);
+        putuint(wsbuf, messages.length());
+        wsbuf.put(messages.getbuf(), messages.length());
+        messages.setsize(0);
         int len = wsbuf.length() - offset;
         if(ci.wsdata < wsbuf.buf) { ci.wsdata = &wsbuf.buf[offset]; ci.wslen = len; }
         else ci.wslen += len;
@@ -1143,6 +1491,7 @@ namespace server
             ci.wsdata = NULL;
             wsmax += ci.position.length();
             if(ci.messages.length()) wsmax += 10 + ci.messages.length();
+            if(ci.editmessages.length()) wsmax += 10 + ci.editmessages.length();
         }
         if(wsmax <= 0)
         {
@@ -1164,11 +1513,23 @@ namespace server
         loopv(clients)
         {
             clientinfo &ci = *clients[i];
-            addmessages(ws, wsbuf, mtu, ci, ci);
-            loopvj(ci.bots) addmessages(ws, wsbuf, mtu, *ci.bots[j], ci);
+            addmessages(ws, wsbuf, mtu, ci, ci, ci.messages);
+            loopvj(ci.bots) addmessages(ws, wsbuf, mtu, *ci.bots[j], ci, ci.bots[j]->messages);
         }
         sendmessages(ws, wsbuf);
         reliablemessages = false;
+        loopv(clients)
+        {
+            clientinfo &ci = *clients[i];
+            addmessages(ws, wsbuf, mtu, ci, ci, ci.editmessages, OUT_EDITS);
+        }
+        sendmessages(ws, wsbuf, OUT_EDITS);
+        // a new map wipes the entities clients have, so it goes out now instead of being held
+        if(newmapqueued)
+        {
+            newmapqueued = false;
+            flushheld();
+        }
         if(ws.uses) return true;
         ws.cleanup();
         worldstates.drop();
@@ -1180,7 +1541,9 @@ namespace server
         if(clients.empty() || (!hasnonlocalclients() && !demorecord)) return false;
         enet_uint32 curtime = enet_time_get()-lastsend;
         if(curtime<40 && !force) return false;
+        loopv(clients) updatesendbudget(*clients[i], curtime);
         bool flush = buildworldstate();
+        loopv(clients) if(sendheld(*clients[i])) flush = true;
         lastsend += curtime - (curtime%40);
         return flush;
     }
@@ -1348,6 +1711,7 @@ namespace server
 
         if(!m_mp(gamemode)) kicknonlocalclients(DISC_LOCAL);
 
+        flushheld();
         sendf(-1, 1, "risii", N_MAPCHANGE, smapname, gamemode, 1);
 
         loopv(clients)
@@ -1476,6 +1840,13 @@ namespace server
 
     void serverupdate()
     {
+        static int lastnetstatslog = 0;
+        if(netstats && netstatslog && totalmillis - lastnetstatslog >= netstatslog*1000)
+        {
+            lastnetstatslog = totalmillis;
+            reportnetstats(10, true);
+        }
+
         if(shouldstep && !gamepaused)
         {
             gamemillis += curtime;
@@ -1636,6 +2007,8 @@ namespace server
         {
             if(ci->privilege) setmaster(ci, false);
             ci->state.timeplayed += lastmillis - ci->state.lasttimeplayed;
+            ci->cleanoutqueues();
+            flushheld();
             sendf(-1, 1, "ri2", N_CDIS, n);
             clients.removeobj(ci);
             if(!numclients(-1, false, true)) noclients(); // bans clear when server empties
@@ -1857,7 +2230,7 @@ namespace server
             if(e.clientnum != ci->clientnum && e.needclipboard - ci->lastclipboard >= 0)
             {
                 if(!flushed) { flushserver(true); flushed = true; }
-                sendpacket(e.clientnum, 1, ci->clipboard);
+                sendqueued(e, OUT_EDITS, ci->clipboard);
             }
         }
     }
@@ -1958,10 +2331,12 @@ namespace server
 
         if(p.packet->flags&ENET_PACKET_FLAG_RELIABLE) reliablemessages = true;
         #define QUEUE_AI clientinfo *cm = cq;
-        #define QUEUE_MSG { if(cm && (!cm->local || demorecord || hasnonlocalclients())) while(curmsg<p.length()) cm->messages.add(p.buf[curmsg++]); }
+        #define QUEUE_MSG { if(cm && (!cm->local || demorecord || hasnonlocalclients())) { msgkind = MSGSTAT_RELAYED; while(curmsg<p.length()) cm->messages.add(p.buf[curmsg++]); } }
+        #define QUEUE_EDIT { if(cm && (!cm->local || demorecord || hasnonlocalclients())) { msgkind = MSGSTAT_RELAYED; while(curmsg<p.length()) cm->editmessages.add(p.buf[curmsg++]); } }
         #define QUEUE_BUF(body) { \
             if(cm && (!cm->local || demorecord || hasnonlocalclients())) \
             { \
+                msgkind = MSGSTAT_RELAYED; \
                 curmsg = p.length(); \
                 { body; } \
             } \
@@ -1969,8 +2344,11 @@ namespace server
         #define QUEUE_INT(n) QUEUE_BUF(putint(cm->messages, n))
         #define QUEUE_UINT(n) QUEUE_BUF(putuint(cm->messages, n))
         #define QUEUE_STR(text) QUEUE_BUF(sendstring(text, cm->messages))
-        int curmsg;
-        while((curmsg = p.length()) < p.maxlen) switch(type = checktype(getint(p), ci))
+        #define BEGIN_MSG (msgstart = curmsg, msgkind = MSGSTAT_NATIVE, msgbegin = netstats ? profmicros() : 0, true)
+        #define END_MSG (netstats ? countmsg(ci, type, p.length() - msgstart, profmicros() - msgbegin, msgkind) : (void)0)
+        int curmsg, msgstart = 0, msgkind = MSGSTAT_NATIVE;
+        ullong msgbegin = 0;
+        for(; (curmsg = p.length()) < p.maxlen && BEGIN_MSG; END_MSG) switch(type = checktype(getint(p), ci))
         {
             case N_POS:
             {
@@ -2002,6 +2380,7 @@ namespace server
                             cp->setexceeded();
                         cp->position.setsize(0);
                         while(curmsg<p.length()) cp->position.add(p.buf[curmsg++]);
+                        msgkind = MSGSTAT_RELAYED;
                     }
                     cp->state.o = pos;
                     cp->gameclip = (flags&0x80)!=0;
@@ -2108,7 +2487,7 @@ namespace server
                     case ID_FVAR: getfloat(p); break;
                     case ID_SVAR: getstring(text, p);
                 }
-                if(ci && ci->state.state!=CS_SPECTATOR) QUEUE_MSG;
+                if(ci && ci->state.state!=CS_SPECTATOR) QUEUE_EDIT;
                 break;
             }
 
@@ -2249,7 +2628,10 @@ namespace server
                     resetitems();
                     notgotitems = false;
                 }
-                QUEUE_MSG;
+                // whatever was held back before belongs to the old map and has to arrive first
+                flushheld();
+                QUEUE_EDIT;
+                newmapqueued = true;
                 break;
             }
 
@@ -2372,7 +2754,7 @@ namespace server
                 int extra = lilswap(*(const ushort *)p.pad(2));
                 if(p.remaining() < extra) { disconnect_client(sender, DISC_MSGERR); return; }                
                 p.pad(extra); 
-                if(ci && ci->state.state!=CS_SPECTATOR) QUEUE_MSG;
+                if(ci && ci->state.state!=CS_SPECTATOR) QUEUE_EDIT;
                 break;
             }
   
@@ -2392,14 +2774,16 @@ namespace server
                 putint(q, unpacklen);
                 putint(q, packlen);
                 if(packlen > 0) p.get(q.subbuf(packlen).buf, packlen);
-                sendpacket(-1, 1, q.finalize(), ci->clientnum);
+                sendqueued(-1, OUT_EDITS, q.finalize(), ci->clientnum);
                 break;
             }
 
             case N_ACTIVEENTSREQUEST: {
 #ifdef STANDALONE
                 assert(lua::call_external("entities_send_all", "i", sender));
-                sendf(sender, 1, "ri", N_ALLACTIVEENTSSENT);
+                packetbuf q(16, ENET_PACKET_FLAG_RELIABLE);
+                putint(q, N_ALLACTIVEENTSSENT);
+                sendqueued(sender, OUT_ENTITIES, q.finalize());
                 assert(lua::call_external("event_player_login", "i", sender));
 #else
                 string pcclass;
@@ -2430,7 +2814,8 @@ namespace server
                 bool hashandler = false;
                 lua::pop_external_ret(lua::call_external_ret("message_receive", "iiip",
                     "b", type, -1, sender, (void*)&p, &hashandler));
-                if (!hashandler) {
+                if(hashandler) msgkind = MSGSTAT_LUA;
+                else {
                     logger::log(logger::DEBUG, "Relaying Sauer protocol message: %d", type);
 
                     int size = server::msgsizelookup(type);
@@ -2438,7 +2823,7 @@ namespace server
                     loopi(size-1) getint(p);
                     if(ci) switch(msgfilter[type])
                     {
-                        case 2: case 3: if(ci->state.state != CS_SPECTATOR) QUEUE_MSG; break;
+                        case 2: case 3: if(ci->state.state != CS_SPECTATOR) QUEUE_EDIT; break;
                         default: if(cq && (ci != cq || ci->state.state!=CS_SPECTATOR)) { QUEUE_AI; QUEUE_MSG; } break;
                     }
 
@@ -2447,6 +2832,8 @@ namespace server
                 break;
             }
         }
+        #undef BEGIN_MSG
+        #undef END_MSG
     }
 
     int laninfoport() { return OCTAFORGE_LANINFO_PORT; }
@@ -2503,7 +2890,7 @@ namespace server
         va_end(args);
         ENetPacket *packet = p.finalize();
         p.packet = NULL;
-        sendpacket(cn, 1, packet, exclude);
+        sendqueued(cn, OUT_ENTITIES, packet, exclude);
         if(!packet->referenceCount) enet_packet_destroy(packet);
     })
 }
@@ -0,0 +1,385 @@
+// swarm.cpp: synthetic load test, runs a listen server in-process and drives simulated clients against it
+// the clients speak the same protocol as game/client.cpp (intro, positions, messages, pings) but carry
+// no world, so hundreds of them fit in one process; results are written as one json object per line
+
+#include "game.h"
+
+// engine entry points the dedicated server's main uses, not exported to standalone builds
+extern void initserver(bool listen, bool dedicated);
+extern void serverslice(bool dedicated, uint timeout);
+extern bool serveroption(char *opt);
+
+namespace swarm
+{
+    enum { SC_CONNECTING = 0, SC_INFO, SC_PLAYING, SC_GONE };
+
+    struct swarmclient
+    {
+        int num, state, clientnum, lifesequence;
+        ENetPeer *peer;
+        ullong connectstart;
+        int lastupdate, lastping, lastedit, lasttext;
+        float angle, radius, speed, height;
+        vec o, vel;
+        float yaw;
+
+        swarmclient(int num) : num(num), state(SC_CONNECTING), clientnum(-1), lifesequence(0), peer(NULL), connectstart(0),
+            lastupdate(0), lastping(0), lastedit(0), lasttext(0), angle(0), radius(0), speed(0), height(0), o(0, 0, 0), vel(0, 0, 0), yaw(0) {}
+    };
+
+    static vector<swarmclient *> swarmclients;
+    static ENetHost *swarmhost = NULL;
+    static ENetAddress swarmaddress;
+
+    // knobs, all overridable from the command line
+    static int numbots = 64, joinrate = 20, duration = 30, updaterate = 40, editrate = 0, textrate = 0;
+
+    // stats for the current interval and the whole run
+    static vector<uint> ticktimes, intervalticks;
+    static vector<int> jointimes, pings, intervalpings;
+    static int joined = 0, dropped = 0, posreceived = 0;
+
+    static double percentile(vector<uint> &v, double p)
+    {
+        if(v.empty()) return 0;
+        v.sort();
+        return v[clamp(int(p*(v.length()-1) + 0.5), 0, v.length()-1)];
+    }
+
+    static double percentile(vector<int> &v, double p)
+    {
+        if(v.empty()) return 0;
+        v.sort();
+        return v[clamp(int(p*(v.length()-1) + 0.5), 0, v.length()-1)];
+    }
+
+    static void connectclient()
+    {
+        swarmclient *c = new swarmclient(swarmclients.length());
+        // every client walks its own circle around the middle of a 1024 unit map
+        c->angle = rndscale(2*M_PI);
+        c->radius = 32 + rndscale(448);
+        c->speed = (25 + rndscale(50))/c->radius;
+        c->height = 512 + rnd(64);
+        c->connectstart = profmicros();
+        c->peer = enet_host_connect(swarmhost, &swarmaddress, server::numchannels(), 0);
+        if(!c->peer) { c->state = SC_GONE; dropped++; }
+        else c->peer->data = c;
+        swarmclients.add(c);
+    }
+
+    // mirrors the encoding of game::sendposition for a walking, non-falling player
+    static void putposition(packetbuf &q, swarmclient &c)
+    {
+        putint(q, N_POS);
+        putuint(q, c.clientnum);
+        q.put(uchar(PHYS_FLOOR | ((c.lifesequence&1)<<3) | (1<<4)));
+        ivec o = ivec(vec(c.o).mul(DMF));
+        uint vel = min(int(c.vel.magnitude()*DVELF), 0xFFFF);
+        uint flags = 0;
+        loopk(3) if(o[k] < 0 || o[k] > 0xFFFF) flags |= 1<<k;
+        if(vel > 0xFF) flags |= 1<<3;
+        putuint(q, flags);
+        loopk(3)
+        {
+            q.put(o[k]&0xFF);
+            q.put((o[k]>>8)&0xFF);
+            if(o[k] < 0 || o[k] > 0xFFFF) q.put((o[k]>>16)&0xFF);
+        }
+        uint dir = (c.yaw < 0 ? 360 + int(c.yaw)%360 : int(c.yaw)%360) + 90*360;
+        q.put(dir&0xFF);
+        q.put((dir>>8)&0xFF);
+        q.put(90);
+        q.put(vel&0xFF);
+        if(vel > 0xFF) q.put((vel>>8)&0xFF);
+        q.put(dir&0xFF);
+        q.put((dir>>8)&0xFF);
+    }
+
+    static void updateclient(swarmclient &c, int millis)
+    {
+        if(c.state != SC_PLAYING || millis - c.lastupdate < updaterate) return;
+        float secs = (millis - c.lastupdate)/1000.0f;
+        c.lastupdate = millis;
+        c.angle += c.speed*secs;
+        c.o = vec(512 + cosf(c.angle)*c.radius, 512 + sinf(c.angle)*c.radius, c.height);
+        c.vel = vec(-sinf(c.angle), cosf(c.angle), 0).mul(c.speed*c.radius);
+        c.yaw = c.angle/RAD + 180;
+
+        packetbuf q(100);
+        putposition(q, c);
+        enet_peer_send(c.peer, 0, q.finalize());
+
+        packetbuf p(MAXTRANS);
+        if(editrate && millis - c.lastedit >= editrate)
+        {
+            // a single cube face push, the most common edit a mapper sends
+            p.reliable();
+            int sel[13] = { 512 + (c.num%32)*8, 512 + (c.num/32)*8, 512, 1, 1, 1, 8, 4, 0, 0, 0, 0, 0 };
+            putint(p, N_EDITF);
+            loopi(13) putint(p, sel[i]);
+            putint(p, c.num&1 ? 1 : -1);
+            putint(p, 1);
+            c.lastedit = millis;
+        }
+        if(textrate && millis - c.lasttext >= textrate)
+        {
+            p.reliable();
+            putint(p, N_TEXT);
+            defformatstring(text, "swarm %d at %d", c.num, millis);
+            sendstring(text, p);
+            c.lasttext = millis;
+        }
+        if(millis - c.lastping > 250)
+        {
+            putint(p, N_PING);
+            putint(p, millis);
+            c.lastping = millis;
+        }
+        if(p.length()) enet_peer_send(c.peer, 1, p.finalize());
+    }
+
+    static void sendintro(swarmclient &c)
+    {
+        packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+        putint(p, N_CONNECT);
+        defformatstring(name, "swarm%d", c.num);
+        sendstring(name, p);
+        putint(p, 0);
+        putint(p, 0);
+        sendstring("", p);
+        sendstring("", p);
+        sendstring("", p);
+        enet_peer_send(c.peer, 1, p.finalize());
+    }
+
+    // joins the game the way game::startmap does; edit mode makes the server relay positions without a spawn
+    static void startplaying(swarmclient &c, int millis)
+    {
+        c.state = SC_PLAYING;
+        c.lastupdate = c.lastping = millis;
+        c.lastedit = millis - rnd(max(editrate, 1));
+        c.lasttext = millis - rnd(max(textrate, 1));
+        packetbuf p(MAXTRANS, ENET_PACKET_FLAG_RELIABLE);
+        putint(p, N_ACTIVEENTSREQUEST);
+        putint(p, N_EDITMODE);
+        putint(p, 1);
+        putint(p, N_TRYSPAWN);
+        enet_peer_send(c.peer, 1, p.finalize());
+    }
+
+    // only the leading message of each packet is looked at: the server sends the ones we care about on their own
+    static void parsepacket(swarmclient &c, int chan, ENetPacket *packet, int millis)
+    {
+        ucharbuf p(packet->data, packet->dataLength);
+        if(chan == 0) { posreceived++; return; }
+        if(chan != 1) return;
+        switch(getint(p))
+        {
+            case N_SERVINFO:
+                c.clientnum = getint(p);
+                c.state = SC_INFO;
+                sendintro(c);
+                break;
+
+            case N_WELCOME:
+                if(c.state != SC_INFO) break;
+                jointimes.add(int((profmicros() - c.connectstart)/1000));
+                joined++;
+                startplaying(c, millis);
+                break;
+
+            case N_SPAWNSTATE:
+            {
+                if(getint(p) != c.clientnum) break;
+                c.lifesequence = getint(p);
+                packetbuf q(16, ENET_PACKET_FLAG_RELIABLE);
+                putint(q, N_SPAWN);
+                putint(q, c.lifesequence);
+                putint(q, 0);
+                enet_peer_send(c.peer, 1, q.finalize());
+                break;
+            }
+
+            case N_PONG:
+            {
+                int ping = millis - getint(p);
+                pings.add(ping);
+                intervalpings.add(ping);
+                break;
+            }
+        }
+    }
+
+    static void serviceclients(int millis)
+    {
+        ENetEvent event;
+        while(enet_host_service(swarmhost, &event, 0) > 0)
+        {
+            swarmclient *c = (swarmclient *)event.peer->data;
+            switch(event.type)
+            {
+                case ENET_EVENT_TYPE_RECEIVE:
+                    if(c && c->state != SC_GONE) parsepacket(*c, event.channelID, event.packet, millis);
+                    enet_packet_destroy(event.packet);
+                    break;
+
+                case ENET_EVENT_TYPE_DISCONNECT:
+                    if(c && c->state != SC_GONE) { c->state = SC_GONE; dropped++; }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    static int numplaying()
+    {
+        int n = 0;
+        loopv(swarmclients) if(swarmclients[i]->state == SC_PLAYING) n++;
+        return n;
+    }
+
+    static void packetloss(float &loss, uint &lost, uint &sent)
+    {
+        loss = 0;
+        lost = sent = 0;
+        int n = 0;
+        loopv(swarmclients)
+        {
+            swarmclient &c = *swarmclients[i];
+            if(c.state == SC_GONE || !c.peer) continue;
+            loss += c.peer->packetLoss/float(ENET_PEER_PACKET_LOSS_SCALE);
+            lost += c.peer->packetsLost;
+            sent += c.peer->packetsSent;
+            n++;
+        }
+        if(n) loss /= n;
+    }
+
+    static void writeinterval(FILE *out, int secs, uint sentbytes, uint recvbytes)
+    {
+        int n = numplaying();
+        float loss;
+        uint lost, sent;
+        packetloss(loss, lost, sent);
+        fprintf(out, "{\"t\":%d,\"clients\":%d,\"ticks\":%d,\"tick_p50_us\":%.0f,\"tick_p99_us\":%.0f,\"tick_max_us\":%.0f,"
+                     "\"up_kbps_per_client\":%.2f,\"down_kbps_per_client\":%.2f,\"ping_p50_ms\":%.0f,\"loss\":%.4f}\n",
+            secs, n, intervalticks.length(), percentile(intervalticks, 0.5), percentile(intervalticks, 0.99), percentile(intervalticks, 1),
+            n ? sentbytes/1024.0f/n : 0.0f, n ? recvbytes/1024.0f/n : 0.0f, percentile(intervalpings, 0.5), loss);
+        fflush(out);
+        intervalticks.setsize(0);
+        intervalpings.setsize(0);
+    }
+
+    static void writesummary(FILE *out, int secs, uint sentbytes, uint recvbytes)
+    {
+        int n = max(numplaying(), 1);
+        float loss;
+        uint lost, sent;
+        packetloss(loss, lost, sent);
+        fprintf(out, "{\"summary\":true,\"seconds\":%d,\"requested\":%d,\"joined\":%d,\"dropped\":%d,"
+                     "\"join_p50_ms\":%.0f,\"join_p95_ms\":%.0f,\"join_max_ms\":%.0f,"
+                     "\"tick_p50_us\":%.0f,\"tick_p99_us\":%.0f,\"tick_max_us\":%.0f,"
+                     "\"up_kbps_per_client\":%.2f,\"down_kbps_per_client\":%.2f,\"positions_received\":%d,"
+                     "\"ping_p50_ms\":%.0f,\"ping_p99_ms\":%.0f,\"loss\":%.4f,\"packets_lost\":%u,\"packets_sent\":%u}\n",
+            secs, swarmclients.length(), joined, dropped,
+            percentile(jointimes, 0.5), percentile(jointimes, 0.95), percentile(jointimes, 1),
+            percentile(ticktimes, 0.5), percentile(ticktimes, 0.99), percentile(ticktimes, 1),
+            sentbytes/1024.0f/n/max(secs, 1), recvbytes/1024.0f/n/max(secs, 1), posreceived,
+            percentile(pings, 0.5), percentile(pings, 0.99), loss, lost, sent);
+        fflush(out);
+    }
+
+    static void run(FILE *out)
+    {
+        swarmhost = enet_host_create(NULL, numbots, server::numchannels(), 0, 0);
+        if(!swarmhost) fatal("could not create swarm host");
+        enet_address_set_host(&swarmaddress, "127.0.0.1");
+        swarmaddress.port = getvar("serverport");
+
+        int start = int(enet_time_get()), lastinterval = start, lastjoin = start;
+        uint intervalsent = 0, intervalrecv = 0;
+        for(;;)
+        {
+            int millis = int(enet_time_get());
+            if(millis - start >= duration*1000) break;
+
+            int joins = swarmclients.length() < numbots ? (millis - lastjoin)*joinrate/1000 : 0;
+            if(joins > 0)
+            {
+                loopi(min(joins, numbots - swarmclients.length())) connectclient();
+                lastjoin = millis;
+            }
+            loopv(swarmclients) updateclient(*swarmclients[i], millis);
+            enet_host_flush(swarmhost);
+
+            ullong tickstart = profmicros();
+            profframe();
+            serverslice(true, 0);
+            uint ticktime = uint(profmicros() - tickstart);
+            ticktimes.add(ticktime);
+            intervalticks.add(ticktime);
+
+            serviceclients(millis);
+
+            if(millis - lastinterval >= 1000)
+            {
+                writeinterval(out, (millis - start)/1000, swarmhost->totalSentData - intervalsent, swarmhost->totalReceivedData - intervalrecv);
+                intervalsent = swarmhost->totalSentData;
+                intervalrecv = swarmhost->totalReceivedData;
+                lastinterval = millis;
+            }
+
+            // idle until incoming traffic or the next millisecond, like the dedicated loop's service timeout
+            enet_uint32 cond = ENET_SOCKET_WAIT_RECEIVE;
+            enet_socket_wait(swarmhost->socket, &cond, 1);
+        }
+        writesummary(out, duration, swarmhost->totalSentData, swarmhost->totalReceivedData);
+
+        loopv(swarmclients) if(swarmclients[i]->state != SC_GONE) enet_peer_disconnect(swarmclients[i]->peer, DISC_NONE);
+        enet_host_flush(swarmhost);
+        loopi(10) serverslice(true, 1);
+        enet_host_destroy(swarmhost);
+        swarmhost = NULL;
+        swarmclients.deletecontents();
+    }
+}
+
+// usage: swarm [-n<clients>] [-j<joins/sec>] [-t<seconds>] [-r<update ms>] [-e<edit ms>] [-m<text ms>] [-o<output>] [server options...]
+int main(int argc, char **argv)
+{
+    using namespace swarm;
+    setlogfile(NULL);
+    if(enet_initialize()<0) fatal("Unable to initialise network module");
+    atexit(enet_deinitialize);
+    enet_time_set(0);
+    FILE *out = stdout;
+    vector<const char *> gameargs;
+    for(int i = 1; i<argc; i++)
+    {
+        const char *arg = argv[i]+2;
+        if(argv[i][0]=='-') switch(argv[i][1])
+        {
+            case 'n': numbots = clamp(atoi(arg), 1, int(MAXCLIENTS)); continue;
+            case 'j': joinrate = max(atoi(arg), 1); continue;
+            case 't': duration = max(atoi(arg), 1); continue;
+            case 'r': updaterate = max(atoi(arg), 1); continue;
+            case 'e': editrate = max(atoi(arg), 0); continue;
+            case 'm': textrate = max(atoi(arg), 0); continue;
+            case 'o': if(!(out = fopen(arg, "w"))) fatal("could not write %s", arg); continue;
+        }
+        if(argv[i][0]!='-' || !serveroption(argv[i])) gameargs.add(argv[i]);
+    }
+    game::parseoptions(gameargs);
+    seedMT(0x5A4D);
+    setvar("maxclients", numbots);
+    lua::init();
+    initserver(true, false);
+    swarm::run(out);
+    if(out != stdout) fclose(out);
+    lua::close();
+    closelogfile();
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
 /*
- * of_logger.cpp, version 1
+ * of_logger.cpp, version 2
  * Logging facilities for OctaForge.
  *
  * author: q66 <quaker66@gmail.com>
@@ -9,6 +9,10 @@
 #include "cube.h"
 #include "engine.h"
 
+#ifndef WIN32
+#include <sys/time.h>
+#endif
+
 namespace logger
 {
     int current_indent = 0;
@@ -45,53 +49,326 @@ namespace logger
         return (level >= current_level);
     }
 
-    void log(loglevel level, const char *fmt, ...)
+    static ullong getmicros()
     {
-        assert (current_level >= 0 && current_level < LEVELNUM);
-        if (!should_log(level)) return;
+#ifdef WIN32
+        static LARGE_INTEGER freq = { { 0, 0 } };
+        if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return ullong(now.QuadPart) * 1000000 / ullong(freq.QuadPart);
+#else
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return ullong(tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+    }
 
-        const char *level_s = names[level];
+    /* Records are formatted by the caller straight into a fixed ring of
+     * slots and written out by a background thread, so logging never waits
+     * on stdout or the log file. The ring is a bounded lock-free MPSC queue:
+     * producers claim a slot by advancing the head with a CAS and publish it
+     * through the slot's sequence number. When it is full the record is
+     * dropped and counted rather than blocking the caller.
+     */
+    #define LOGRINGSIZE  1024
+    #define LOGRECORDLEN 512
 
-        for (int i = 0; i < current_indent; i++)
-            printf("    ");
+    enum { LOGFMT_TEXT = 0, LOGFMT_JSON, LOGFMT_BINARY };
 
-        char sbuf[512];
-        char *buf = sbuf;
-        va_list ap;
-#if defined(WIN32) && !defined(__GNUC__)
-        va_start(ap, fmt);
-        size_t len = _vscprintf(fmt, ap);
-        if (len >= sizeof(sbuf)) {
-            buf = new char[len + 1];
+    struct logrecord
+    {
+        SDL_atomic_t seq;
+        uint millis;
+        signed char level;
+        uchar indent;
+        ushort len;
+        char msg[LOGRECORDLEN];
+    };
+
+    static logrecord ring[LOGRINGSIZE];
+    static SDL_atomic_t ringhead, ringtail, droppedrecords;
+    static ullong logstartmicros = 0;
+    static volatile bool writerrunning = false, writerquit = false, writerdiscard = false;
+    static bool ringinit = false;
+
+    VARF(logasync, 0, 1, 1, { if (logasync) startwriter(); else stopwriter(); });
+    VARF(logformat, 0, 0, 2, { if (writing()) { stopwriter(); startwriter(); } });
+    VAR(lograte, 0, 50, 100000); /* records per second per call site, 0 = unlimited */
+
+    static logrecord *claimrecord()
+    {
+        uint pos = uint(SDL_AtomicGet(&ringhead));
+        for (;;)
+        {
+            logrecord &r = ring[pos % LOGRINGSIZE];
+            int diff = int(uint(SDL_AtomicGet(&r.seq)) - pos);
+            if (!diff)
+            {
+                if (SDL_AtomicCAS(&ringhead, int(pos), int(pos + 1)))
+                    return &r;
+            }
+            else if (diff < 0)
+            {
+                SDL_AtomicAdd(&droppedrecords, 1);
+                return NULL;
+            }
+            pos = uint(SDL_AtomicGet(&ringhead));
         }
-        _vsnprintf(buf, len + 1, fmt, ap);
-        va_end(ap);
-#else
-        va_start(ap, fmt);
-        size_t len = vsnprintf(sbuf, sizeof(sbuf), fmt, ap);
-        va_end(ap);
-        if (len >= sizeof(sbuf)) {
-            buf = new char[len + 1];
-            va_start(ap, fmt);
-            vsnprintf(buf, len + 1, fmt, ap);
-            va_end(ap);
+    }
+
+    static void publishrecord(logrecord &r, int level)
+    {
+        r.millis = uint((getmicros() - logstartmicros) / 1000);
+        r.level  = level;
+        r.indent = uchar(min(current_indent, 255));
+        SDL_AtomicAdd(&r.seq, 1);
+    }
+
+    bool post(int level, const char *fmt, va_list args)
+    {
+        if (!writerrunning) return false;
+        logrecord *r = claimrecord();
+        if (!r) return true;
+        int len = vsnprintf(r->msg, sizeof(r->msg), fmt, args);
+        r->len = ushort(clamp(len, 0, int(sizeof(r->msg)) - 1));
+        publishrecord(*r, level);
+        return true;
+    }
+
+    static bool postmsg(int level, const char *msg)
+    {
+        if (!writerrunning) return false;
+        logrecord *r = claimrecord();
+        if (!r) return true;
+        copystring(r->msg, msg, sizeof(r->msg));
+        r->len = ushort(strlen(r->msg));
+        publishrecord(*r, level);
+        return true;
+    }
+
+    bool postline(const char *line)
+    {
+        return postmsg(LOGPLAIN, line);
+    }
+
+    static void writeutf8(FILE *f, const char *s, size_t len, bool json)
+    {
+        uchar ubuf[LOGRECORDLEN * 3];
+        size_t n = encodeutf8(ubuf, sizeof(ubuf), (const uchar *)s, len);
+        if (!json)
+        {
+            fwrite(ubuf, 1, n, f);
+            return;
         }
-#endif
+        for (size_t i = 0; i < n; i++)
+        {
+            uchar c = ubuf[i];
+            if (c == '"' || c == '\\') { fputc('\\', f); fputc(c, f); }
+            else if (c == '\n') fputs("\\n", f);
+            else if (c == '\t') fputs("\\t", f);
+            else if (c < 0x20) fprintf(f, "\\u%04x", c);
+            else fputc(c, f);
+        }
+    }
+
+    static void writerecord(FILE *f, const logrecord &r)
+    {
+        const char *level_s = r.level >= 0 && r.level < LEVELNUM ? names[int(r.level)] : "LOG";
+        switch (logformat)
+        {
+            case LOGFMT_JSON:
+                fprintf(f, "{\"time\":%u,\"level\":\"%s\",\"indent\":%d,\"msg\":\"",
+                    r.millis, level_s, r.indent);
+                writeutf8(f, r.msg, r.len, true);
+                fputs("\"}\n", f);
+                break;
+
+            /* raw records: millis (u32), level (s8), indent (u8), length (u16), message bytes */
+            case LOGFMT_BINARY:
+            {
+                uchar hdr[8];
+                uint millis = lilswap(r.millis);
+                ushort len  = lilswap(r.len);
+                memcpy(&hdr[0], &millis, 4);
+                hdr[4] = uchar(r.level);
+                hdr[5] = r.indent;
+                memcpy(&hdr[6], &len, 2);
+                fwrite(hdr, 1, sizeof(hdr), f);
+                fwrite(r.msg, 1, r.len, f);
+                break;
+            }
+
+            default:
+                for (int i = 0; i < r.indent; i++) fputs("    ", f);
+                if (r.level != LOGPLAIN) fprintf(f, "[[%s]] - ", level_s);
+                writeutf8(f, r.msg, r.len, false);
+                fputc('\n', f);
+                break;
+        }
+    }
+
+    static bool drainrecords()
+    {
+        FILE *f = getlogfile();
+        bool wrote = false;
+        for (;;)
+        {
+            uint tail = uint(SDL_AtomicGet(&ringtail));
+            logrecord &r = ring[tail % LOGRINGSIZE];
+            if (int(uint(SDL_AtomicGet(&r.seq)) - (tail + 1)) < 0) break;
+            if (f && !writerdiscard) writerecord(f, r);
+            SDL_AtomicSet(&r.seq, int(tail + LOGRINGSIZE));
+            SDL_AtomicSet(&ringtail, int(tail + 1));
+            wrote = true;
+        }
+        if (writerdiscard) return wrote;
+        uint dropped = uint(SDL_AtomicSet(&droppedrecords, 0));
+        if (dropped && f)
+        {
+            logrecord r;
+            r.millis = uint((getmicros() - logstartmicros) / 1000);
+            r.level  = WARNING;
+            r.indent = 0;
+            r.len    = snprintf(r.msg, sizeof(r.msg), "log ring full, %u records dropped", dropped);
+            writerecord(f, r);
+        }
+        if (wrote && f) fflush(f);
+        return wrote;
+    }
+
+    static SDL_Thread *writerthread = NULL;
 
+    static int writerloop(void *)
+    {
+        while (!writerquit) SDL_Delay(drainrecords() ? 1 : 5);
+        drainrecords();
+        return 0;
+    }
+
+    bool writing() { return writerrunning; }
+
+    void startwriter()
+    {
+        if (writerrunning || !logasync || !getlogfile()) return;
+        if (!ringinit)
+        {
+            for (int i = 0; i < LOGRINGSIZE; i++) SDL_AtomicSet(&ring[i].seq, i);
+            logstartmicros = getmicros();
+            ringinit = true;
+        }
+        FILE *f = getlogfile();
+        if (logformat == LOGFMT_BINARY)
+        {
+            fwrite("OFLG", 1, 4, f);
+            fflush(f);
+        }
+        writerquit = false;
+        writerthread = SDL_CreateThread(writerloop, "log writer", NULL);
+        if (!writerthread) return;
+        writerrunning = true;
+    }
+
+    void stopwriter()
+    {
+        if (!writerrunning) return;
+        writerrunning = false;
+        writerquit = true;
+        SDL_WaitThread(writerthread, NULL);
+        writerthread = NULL;
+    }
+
+    /* Per call site rate limiting. Sites are keyed by the address of the
+     * format string and hashed into a small table; collisions just share a
+     * budget. Updates are not atomic, logging from several threads at once
+     * can only make the counts slightly off. Errors are never limited.
+     */
+    #define LOGSITES 256
+
+    struct ratesite
+    {
+        uint key, second, count, suppressed;
+    };
+    static ratesite ratesites[LOGSITES];
+
+    static bool ratelimited(uint key, loglevel level)
+    {
+        if (!lograte) return false;
+        ratesite &s = ratesites[(key ^ (key >> 8)) % LOGSITES];
+        uint second = uint(getmicros() / 1000000);
+        if (s.key != key || s.second != second)
+        {
+            if (s.key == key && s.suppressed)
+            {
+                uint suppressed = s.suppressed;
+                s.suppressed = 0;
+                logoutf("[[%s]] - (%u similar messages suppressed)", names[level], suppressed);
+            }
+            s.key = key;
+            s.second = second;
+            s.count = 0;
+            s.suppressed = 0;
+        }
+        if (++s.count <= uint(lograte)) return false;
+        s.suppressed++;
+        return true;
+    }
+
+    static void logv(loglevel level, uint site, const char *fmt, va_list ap)
+    {
+        if (level != ERROR && ratelimited(site, level)) return;
+
+        char buf[LOGRECORDLEN];
+        if (level == ERROR)
+        {
+            vformatstring(buf, fmt, ap, sizeof(buf));
 #ifndef STANDALONE
-        if (level == ERROR) {
-            conoutf(CON_ERROR, "[[%s]] - %s", level_s, buf);
+            /* errors are shown on the console too, the log gets its own record below */
+            char line[LOGRECORDLEN + 16];
+            formatstring(line, "[[%s]] - %s", names[level], buf);
+            conline(CON_ERROR, line);
+#endif
+            if (postmsg(level, buf)) return;
         }
         else
-#endif
-        logoutf("[[%s]] - %s", level_s, buf);
-        if (buf != sbuf) {
-            delete[] buf;
+        {
+            if (post(level, fmt, ap)) return;
+            vformatstring(buf, fmt, ap, sizeof(buf));
         }
 
+        for (int i = 0; i < current_indent; i++)
+            printf("    ");
+
+        logoutf("[[%s]] - %s", names[level], buf);
+
         fflush(stdout);
     }
 
+    void log(loglevel level, const char *fmt, ...)
+    {
+        assert (current_level >= 0 && current_level < LEVELNUM);
+        if (!should_log(level)) return;
+
+        /* sites that pass a whole message through "%s" would all share the
+         * budget of that one literal, so key them by the message instead */
+        va_list ap;
+        va_start(ap, fmt);
+        uint site = strcmp(fmt, "%s") ? uint(size_t(fmt)) : hthash(va_arg(ap, const char *));
+        va_end(ap);
+
+        va_start(ap, fmt);
+        logv(level, site, fmt, ap);
+        va_end(ap);
+    }
+
+    static void logsite(loglevel level, uint site, const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        logv(level, site, fmt, ap);
+        va_end(ap);
+    }
+
     logindent::logindent(loglevel level)
     {
         if (should_log(level))
@@ -107,8 +384,39 @@ namespace logger
         if (done) current_indent--;
     }
 
+    /* measures the cost of a filtered out call and of a call that makes it
+     * into the ring (the writer discards the records while this runs) */
+    ICOMMAND(logbench, "i", (int *n), {
+        if (!writing()) { conoutf(CON_ERROR, "logbench needs the asynchronous writer (logasync 1)"); return; }
+        int iters = *n > 0 ? *n : 100000;
+        loglevel oldlevel = current_level;
+        int oldrate = lograte;
+        lograte = 0;
+
+        current_level = OFF;
+        ullong start = getmicros();
+        for (int i = 0; i < iters; i++) log(DEBUG, "logbench %d", i);
+        ullong disabled = getmicros() - start;
+
+        current_level = INFO;
+        writerdiscard = true;
+        int pending = SDL_AtomicSet(&droppedrecords, 0);
+        start = getmicros();
+        for (int i = 0; i < iters; i++) log(INFO, "logbench %d: %s", i, "enabled call");
+        ullong enabled = getmicros() - start;
+        while (SDL_AtomicGet(&ringhead) != SDL_AtomicGet(&ringtail) && writerrunning) SDL_Delay(1);
+        uint dropped = uint(SDL_AtomicSet(&droppedrecords, 0));
+        if (pending) SDL_AtomicAdd(&droppedrecords, pending);
+        writerdiscard = false;
+
+        current_level = oldlevel;
+        lograte = oldrate;
+        conoutf("logbench: %d calls, disabled %.1f ns/call, enabled %.1f ns/call, %u dropped",
+            iters, disabled * 1000.0 / iters, enabled * 1000.0 / iters, dropped);
+    });
+
     CLUAICOMMAND(log, void, (int level, const char *msg), {
-        log((loglevel)level, "%s", msg);
+        if (should_log((loglevel)level)) logsite((loglevel)level, hthash(msg), "%s", msg);
     });
 
     CLUAICOMMAND(should_log, bool, (int level), {
@@ -19,6 +19,7 @@
 namespace logger
 {
     #define LEVELNUM 6
+    #define LOGPLAIN -1 /* level of records posted through logoutf */
 
     enum loglevel
     {
@@ -36,6 +37,15 @@ namespace logger
     bool should_log     (loglevel    level);
     void log            (loglevel    level, const char *fmt, ...);
 
+    /* asynchronous output: records go through a lock-free ring to a writer
+     * thread; post returns false when the writer is not running, in which
+     * case the caller writes synchronously (args are left untouched) */
+    void startwriter();
+    void stopwriter ();
+    bool writing    ();
+    bool post       (int level, const char *fmt, va_list args);
+    bool postline   (const char *line);
+
     extern loglevel    current_level;
     extern loglevel    numbers[LEVELNUM];
     extern const char *names  [LEVELNUM];
@@ -6,6 +6,10 @@
 
 #include "of_lua.h"
 
+extern "C" {
+    #include "luajit.h"
+}
+
 void deleteparticles();
 void deletestains();
 void clearanims();
@@ -13,6 +17,9 @@ void clearanims();
 namespace lua
 {
     static int load_file(lua_State *L, const char *fname);
+    static void prof_attach();
+    static void prof_detach();
+    static void gc_detach();
 
     lua_State *L = NULL;
     static string mod_dir = "";
@@ -444,17 +451,8 @@ namespace lua
         { NULL,         NULL}
     };
 
-    void init(const char *dir)
-    {
-        if (L) return;
-        copystring(mod_dir, dir);
-
-        L = luaL_newstate();
-        lua_atpanic(L, panic);
-        luaL_openlibs(L);
-
+    static void setup_path(lua_State *L) {
         lua_getglobal(L, "package");
-
         /* home directory paths */
 #ifndef WIN32
         lua_pushfstring(L, ";%smedia/?/init.oct", homedir);
@@ -500,6 +498,224 @@ namespace lua
 
         lua_concat  (L, 24);
         lua_setfield(L, -2, "path"); lua_pop(L, 1);
+    }
+
+    /* startup precompilation: every .oct file under media/scripts is read
+     * up front and compiled to bytecode by a pool of worker threads, each
+     * running the OctaScript compiler in its own lua_State, while the main
+     * state is set up; the module loader then takes the bytecode for any
+     * file whose chunk name and source match instead of compiling it again
+     */
+
+    VAR(luacompilethreads, 0, 0, 64);
+
+    struct precompiled {
+        char *chunk, *src, *bcode;
+        size_t srclen, bclen;
+    };
+
+    static vector<precompiled> precomp;
+    static hashtable<const char *, int> precomp_idx;
+    static SDL_atomic_t precomp_next;
+    static bool precomp_debug = false;
+    static ullong precomp_startmicros = 0;
+    static vector<SDL_Thread *> precomp_threads;
+
+    static char *precomp_read(const char *fname, size_t &len) {
+        FILE *f = fopen(fname, "rb");
+        if (!f) return NULL;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (size <= 0) {
+            fclose(f);
+            return NULL;
+        }
+        char *buf = new char[size];
+        len = fread(buf, 1, size, f);
+        fclose(f);
+        if (len != size_t(size)) {
+            delete[] buf;
+            return NULL;
+        }
+        return buf;
+    }
+
+    /* chunk names are built the way package.searchpath forms file names:
+     * the directory of the path template, then the module path; the chunk
+     * prefix includes the trailing separator */
+    static void precomp_scan(const char *dir, const char *chunk) {
+        vector<char *> files, dirs;
+        listdir(dir, false, "oct", files, FTYPE_FILE);
+        loopv(files) {
+            defformatstring(fname, "%s%c%s.oct", dir, PATHDIV, files[i]);
+            precompiled p;
+            p.src = precomp_read(fname, p.srclen);
+            if (!p.src) continue;
+            defformatstring(cname, "%s%s.oct", chunk, files[i]);
+            p.chunk = newstring(cname);
+            p.bcode = NULL;
+            p.bclen = 0;
+            precomp.add(p);
+        }
+        listdir(dir, false, NULL, dirs, FTYPE_DIR);
+        loopv(dirs) {
+            if (dirs[i][0] == '.') continue;
+            defformatstring(subdir, "%s%c%s", dir, PATHDIV, dirs[i]);
+            defformatstring(subchunk, "%s%s%c", chunk, dirs[i], PATHDIV);
+            precomp_scan(subdir, subchunk);
+        }
+        files.deletearrays();
+        dirs.deletearrays();
+    }
+
+    static bool precomp_cmp(const precompiled &a, const precompiled &b) {
+        return a.srclen > b.srclen;
+    }
+
+    static void precomp_compile(lua_State *L, precompiled &p) {
+        lua_pushvalue(L, 1);
+        lua_pushstring(L, p.chunk);
+        lua_pushlstring(L, p.src, p.srclen);
+        lua_pushvalue(L, 2);
+        if (lua_pcall(L, 3, 1, 0)) {
+            /* leave it to the main state to report the error */
+            lua_pop(L, 1);
+            return;
+        }
+        size_t len;
+        const char *bc = lua_tolstring(L, -1, &len);
+        if (bc) {
+            p.bcode = new char[len];
+            memcpy(p.bcode, bc, len);
+            p.bclen = len;
+        }
+        lua_pop(L, 1);
+    }
+
+    /* parse and generate in one go, mirroring compile() in octascript.std */
+    static const char precomp_driver[] =
+        "local parser, generator = ...\n"
+        "return function(chunk, src, env)\n"
+        "    return generator(parser.parse(chunk, src, env), chunk)\n"
+        "end\n";
+
+    static int precomp_worker(void *)
+    {
+        lua_State *L = luaL_newstate();
+        if (!L) return 0;
+        luaL_openlibs(L);
+        setup_path(L);
+        luaL_loadstring(L, precomp_driver);
+        lua_getglobal(L, "require");
+        lua_pushliteral(L, "octascript.parser");
+        int err = lua_pcall(L, 1, 1, 0);
+        if (!err) {
+            lua_getglobal(L, "require");
+            lua_pushliteral(L, "octascript.generator");
+            err = lua_pcall(L, 1, 1, 0);
+        }
+        if (!err) err = lua_pcall(L, 2, 1, 0);
+        if (!err) {
+            /* 1: compile, 2: conditional environment */
+            lua_createtable(L, 0, 2);
+            lua_pushboolean(L, precomp_debug);
+            lua_setfield(L, -2, "debug");
+#ifndef STANDALONE
+            lua_pushboolean(L, false);
+#else
+            lua_pushboolean(L, true);
+#endif
+            lua_setfield(L, -2, "server");
+            for (;;) {
+                int i = SDL_AtomicAdd(&precomp_next, 1);
+                if (i >= precomp.length()) break;
+                precomp_compile(L, precomp[i]);
+            }
+        }
+        lua_close(L);
+        return 0;
+    }
+
+    static void precomp_start() {
+        SDL_AtomicSet(&precomp_next, 0);
+        precomp_startmicros = profmicros();
+        defformatstring(rootdir, "media%cscripts", PATHDIV);
+        precomp_scan(rootdir, "@./media/scripts/");
+        if (homedir[0]) {
+            defformatstring(dir, "%s%s", homedir, rootdir);
+            defformatstring(chunk, "@%s%c", dir, PATHDIV);
+            precomp_scan(dir, chunk);
+        }
+        if (precomp.empty()) return;
+        precomp.sort(precomp_cmp);
+        loopv(precomp) precomp_idx[precomp[i].chunk] = i;
+        precomp_debug = logger::should_log(logger::loglevel(1));
+        int numthreads = luacompilethreads;
+        if (numthreads <= 0) numthreads = SDL_GetCPUCount();
+        numthreads = clamp(numthreads, 1, min(precomp.length(), 64));
+        loopi(numthreads) {
+            SDL_Thread *t = SDL_CreateThread(precomp_worker, "lua precompiler", NULL);
+            if (t) precomp_threads.add(t);
+        }
+    }
+
+    static void precomp_finish() {
+        if (precomp_threads.empty()) return;
+        loopv(precomp_threads) SDL_WaitThread(precomp_threads[i], NULL);
+        int compiled = 0;
+        loopv(precomp) if (precomp[i].bcode) ++compiled;
+        logger::log(logger::INFO, "Precompiled %d/%d OctaScript files on %d "
+            "threads in %.1f ms", compiled, precomp.length(),
+            precomp_threads.length(),
+            (profmicros() - precomp_startmicros) / 1000.0);
+        precomp_threads.setsize(0);
+    }
+
+    static void precomp_clear() {
+        precomp_finish();
+        loopv(precomp) {
+            delete[] precomp[i].chunk;
+            delete[] precomp[i].src;
+            delete[] precomp[i].bcode;
+        }
+        precomp.setsize(0);
+        precomp_idx.clear();
+    }
+
+    static const precompiled *precomp_find(const char *chunk, const char *src,
+    size_t len) {
+        int idx = precomp_idx.find(chunk, -1);
+        if (idx < 0) return NULL;
+        const precompiled &p = precomp[idx];
+        if (!p.bcode || p.srclen != len || memcmp(p.src, src, len)) {
+            return NULL;
+        }
+        return &p;
+    }
+
+    /* package.bcache for the module loader: (chunkname, source) -> bytecode */
+    static int precomp_lookup(lua_State *L) {
+        size_t len;
+        const char *chunk = luaL_checkstring(L, 1);
+        const char *src = luaL_checklstring(L, 2, &len);
+        const precompiled *p = precomp_find(chunk, src, len);
+        if (!p) return 0;
+        lua_pushlstring(L, p->bcode, p->bclen);
+        return 1;
+    }
+
+    void init(const char *dir)
+    {
+        if (L) return;
+        copystring(mod_dir, dir);
+        precomp_start();
+
+        L = luaL_newstate();
+        lua_atpanic(L, panic);
+        luaL_openlibs(L);
+
+        setup_path(L);
 
         /* stream functions */
         luaL_newmetatable(L, "Stream");
@@ -509,6 +725,7 @@ namespace lua
         lua_pop          (L, 1);
 
         setup_binds();
+        prof_attach();
     }
 
     void load_module(const char *name)
@@ -618,6 +835,12 @@ namespace lua
         lua_setfield(L, LUA_REGISTRYINDEX, "octascript_compile");
         lua_getfield(L, -1, "env");
         lua_setfield(L, LUA_REGISTRYINDEX, "octascript_env");
+        lua_getfield(L, -1, "reload");
+        lua_setfield(L, LUA_REGISTRYINDEX, "octascript_reload");
+        precomp_finish();
+        lua_getfield(L, -1, "set_bytecode_cache");
+        lua_pushcfunction(L, precomp_lookup);
+        lua_call(L, 1, 0);
         lua_pop(L, 2);
 
         load_module("init");
@@ -630,16 +853,46 @@ namespace lua
         clearanims();
 #endif
         external_handler = LUA_REFNIL;
+        prof_detach();
+        gc_detach();
         lua_close(L);
         L = NULL;
+        precomp_clear();
+        entsched::clear();
         init();
 #ifndef STANDALONE
         lua::execfile("config/ui.oct");
 #endif
     }
 
+    /* reloads changed modules (or the given one) that support it through
+     * __reload in place, keeping the state, entities and registered
+     * externals alive as opposed to reset()
+     */
+    static void luareload(char *name) {
+        if (!L) return;
+        lua_getfield(L, LUA_REGISTRYINDEX, "octascript_reload");
+        if (*name) lua_pushstring(L, name);
+        else       lua_pushnil(L);
+        if (lua_pcall(L, 1, 2, 0)) {
+            conoutf(CON_ERROR, "%s", lua_tostring(L, -1));
+            lua_pop(L, 1);
+            return;
+        }
+        int n = lua_tointeger(L, -2);
+        if (lua_isstring(L, -1)) {
+            conoutf(CON_ERROR, "%s", lua_tostring(L, -1));
+        }
+        conoutf("reloaded %d Lua module%s", n, n != 1 ? "s" : "");
+        lua_pop(L, 2);
+    }
+    COMMAND(luareload, "s");
+
     void close() {
+        prof_detach();
+        gc_detach();
         lua_close(L);
+        precomp_clear();
         delete funs;
         delete cfuns;
     }
@@ -696,11 +949,18 @@ namespace lua
             buf.advance(asize);
             delete f;
         }
-        lua_getfield(L, LUA_REGISTRYINDEX, "octascript_compile");
-        lua_pushvalue(L, fnameidx);
-        lua_pushlstring(L, buf.getbuf(), buf.length());
-        int ret = lua_pcall(L, 2, 1, 0);
-        if (ret) return ret;
+        const precompiled *p = precomp_find(lua_tostring(L, fnameidx),
+            buf.getbuf(), buf.length());
+        int ret = 0;
+        if (p) {
+            lua_pushlstring(L, p->bcode, p->bclen);
+        } else {
+            lua_getfield(L, LUA_REGISTRYINDEX, "octascript_compile");
+            lua_pushvalue(L, fnameidx);
+            lua_pushlstring(L, buf.getbuf(), buf.length());
+            ret = lua_pcall(L, 2, 1, 0);
+            if (ret) return ret;
+        }
         reads rd;
         const char *lstr = lua_tolstring(L, -1, &rd.size);
         char *dups = new char[rd.size];
@@ -772,4 +1032,329 @@ namespace lua
 
     CLUAICOMMAND(raw_alloc, void *, (size_t nbytes), return (void*) new uchar[nbytes];)
     CLUAICOMMAND(raw_free, void, (void *ptr), delete[] (uchar*)ptr;)
+
+    /* frame-paced garbage collection: with a budget set and frames being
+     * limited, the automatic collector is stopped and the engine runs
+     * incremental steps from its idle time (gcidle), once per frame and for
+     * at most luagcbudget microseconds; a new cycle starts once the heap grew
+     * by luagcpause percent over what the last cycle left alive. At every
+     * frame boundary (gccheck) a heap past luagcemergency percent of that is
+     * collected in full, and a frame that had no idle time to give (no fps
+     * limit) hands collection back to the automatic collector
+     */
+
+    static void gc_update();
+    VARF(luagcbudget, 0, 1000, 100000, gc_update());
+    VAR(luagcstepsize, 1, 16, 1024);
+    VAR(luagcpause, 100, 200, 1000);
+    VAR(luagcemergency, 100, 400, 10000);
+
+    static lua_State *gc_state = NULL;
+    static bool gc_incycle = false, gc_stopped = false, gc_idled = false;
+    static int gc_live = 0, gc_target = 0;
+    static int gc_cycles = 0, gc_emergencies = 0, gc_frames = 0;
+    static ullong gc_micros = 0, gc_peakmicros = 0;
+
+    static int gc_heapkb() {
+        return lua_gc(L, LUA_GCCOUNT, 0);
+    }
+
+    static void gc_settarget() {
+        gc_live = gc_heapkb();
+        gc_target = max(gc_live * luagcpause / 100, 1024);
+    }
+
+    static void gc_stop(bool stop) {
+        if (gc_stopped == stop) return;
+        lua_gc(L, stop ? LUA_GCSTOP : LUA_GCRESTART, 0);
+        gc_stopped = stop;
+    }
+
+    /* the state is about to go away, pacing is re-armed for the next one */
+    static void gc_detach() {
+        gc_state = NULL;
+        gc_incycle = gc_stopped = gc_idled = false;
+        gc_live = gc_target = 0;
+    }
+
+    static void gc_update() {
+        if (!L) return;
+        if (!luagcbudget) {
+            if (gc_state == L) gc_stop(false);
+            gc_detach();
+            return;
+        }
+        if (gc_state == L) return;
+        gc_detach();
+        gc_state = L;
+        gc_settarget();
+    }
+
+    void gccheck() {
+        if (!L || !luagcbudget) return;
+        if (gc_state != L) gc_update();
+        if (!gc_idled) gc_stop(false);
+        gc_idled = false;
+        if (!gc_stopped) return;
+        if (gc_heapkb() < max(gc_live * luagcemergency / 100, gc_target)) {
+            return;
+        }
+        PROFSCOPE("lua_gc");
+        ullong start = profmicros();
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        /* a full collection re-arms the automatic collector */
+        lua_gc(L, LUA_GCSTOP, 0);
+        gc_incycle = false;
+        ++gc_emergencies;
+        ++gc_cycles;
+        gc_settarget();
+        ullong spent = profmicros() - start;
+        gc_micros += spent;
+        gc_peakmicros = max(gc_peakmicros, spent);
+    }
+
+    /* returns the number of microseconds spent */
+    int gcidle() {
+        if (!L || !luagcbudget) return 0;
+        if (gc_state != L) gc_update();
+        PROFSCOPE("lua_gc");
+        ullong start = profmicros();
+        gc_idled = true;
+        gc_stop(true);
+        if (gc_incycle || gc_heapkb() >= gc_target) {
+            gc_incycle = true;
+            ullong end = start + luagcbudget;
+            do {
+                if (lua_gc(L, LUA_GCSTEP, luagcstepsize)) {
+                    gc_incycle = false;
+                    ++gc_cycles;
+                    gc_settarget();
+                    break;
+                }
+            } while (profmicros() < end);
+            /* stepping moves the threshold and so restarts the collector */
+            lua_gc(L, LUA_GCSTOP, 0);
+        }
+        ullong spent = profmicros() - start;
+        gc_micros += spent;
+        gc_peakmicros = max(gc_peakmicros, spent);
+        ++gc_frames;
+        return int(spent);
+    }
+
+    static void luagcstats() {
+        if (!L) return;
+        conoutf("Lua heap %.1f KB (%.1f KB target), %s", gc_heapkb() +
+            lua_gc(L, LUA_GCCOUNTB, 0) / 1024.0f, float(gc_target),
+            gc_stopped ? "frame paced" : "automatic");
+        if (!gc_frames) return;
+        conoutf("%d cycles (%d emergency) over %d frames, %.3f ms per frame, "
+            "peak %.3f ms", gc_cycles, gc_emergencies, gc_frames,
+            gc_micros / 1000.0 / gc_frames, gc_peakmicros / 1000.0);
+        gc_cycles = gc_emergencies = gc_frames = 0;
+        gc_micros = gc_peakmicros = 0;
+    }
+    COMMAND(luagcstats, "");
+
+    /* sampling profiler: samples are aggregated as folded stacks
+     * ("outer:line;inner:line") keyed by chunk name and current line, which
+     * the OctaScript compiler maps back to the .oct source; with LuaJIT 2.1
+     * the VM's own profiler is used, older versions fall back to a count hook
+     * that samples once per interval and keeps the JIT from compiling traces
+     */
+
+    static void prof_reset();
+    VARF(luaprofiler, 0, 0, 1, { prof_detach(); prof_attach(); });
+    VARF(luaprofinterval, 1, 1, 1000, { if (luaprofiler) { prof_detach(); prof_attach(); } });
+    VAR(luaprofdepth, 1, 64, 256);
+
+    static hashtable<const char *, int> prof_stacks;
+    static int prof_samples = 0;
+    static bool prof_active = false;
+
+    static void prof_add(const char *stack, size_t len, int samples) {
+        while (len > 0 && stack[len - 1] == ';') --len;
+        if (!len) {
+            stack = "[unknown]";
+            len = strlen(stack);
+        }
+        static vector<char> key;
+        key.setsize(0);
+        key.put(stack, int(len));
+        key.add('\0');
+        int *n = prof_stacks.access(key.getbuf());
+        if (n) *n += samples;
+        else prof_stacks[newstring(key.getbuf())] = samples;
+        prof_samples += samples;
+    }
+
+#if LUAJIT_VERSION_NUM >= 20100
+    static void prof_sample(void *data, lua_State *L, int samples,
+    int vmstate) {
+        (void)data;
+        size_t len;
+        const char *stack = luaJIT_profile_dumpstack(L, "pl;", -luaprofdepth,
+            &len);
+        const char *leaf = NULL;
+        switch (vmstate) {
+            case 'C': leaf = "[C]"; break;
+            case 'G': leaf = "[gc]"; break;
+            case 'J': leaf = "[jit]"; break;
+        }
+        if (!leaf) {
+            prof_add(stack, len, samples);
+            return;
+        }
+        vector<char> buf;
+        buf.put(stack, int(len));
+        buf.put(leaf, int(strlen(leaf)));
+        prof_add(buf.getbuf(), buf.length(), samples);
+    }
+#else
+    static ullong prof_next = 0;
+
+    static void prof_sample(lua_State *L, lua_Debug *ar) {
+        (void)ar;
+        ullong now = profmicros();
+        if (now < prof_next) return;
+        prof_next = now + ullong(luaprofinterval) * 1000;
+        lua_Debug info;
+        int depth = 0;
+        while (depth < luaprofdepth && lua_getstack(L, depth, &info)) ++depth;
+        vector<char> buf;
+        for (int i = depth - 1; i >= 0; --i) {
+            lua_getstack(L, i, &info);
+            lua_getinfo(L, "Sl", &info);
+            string frame;
+            if (info.currentline > 0) {
+                formatstring(frame, "%s:%d;", info.short_src, info.currentline);
+            } else if (*info.what == 'C') {
+                copystring(frame, "[C];");
+            } else {
+                formatstring(frame, "%s:%d;", info.short_src, info.linedefined);
+            }
+            buf.put(frame, int(strlen(frame)));
+        }
+        prof_add(buf.getbuf(), buf.length(), 1);
+    }
+#endif
+
+    static void prof_attach() {
+        if (!L || !luaprofiler || prof_active) return;
+#if LUAJIT_VERSION_NUM >= 20100
+        defformatstring(mode, "li%d", luaprofinterval);
+        luaJIT_profile_start(L, mode, prof_sample, NULL);
+#else
+        prof_next = 0;
+        lua_sethook(L, prof_sample, LUA_MASKCOUNT, 1000);
+#endif
+        prof_active = true;
+    }
+
+    static void prof_detach() {
+        if (!L || !prof_active) return;
+#if LUAJIT_VERSION_NUM >= 20100
+        luaJIT_profile_stop(L);
+#else
+        lua_sethook(L, NULL, 0, 0);
+#endif
+        prof_active = false;
+    }
+
+    static void prof_reset() {
+        enumeratekt(prof_stacks, const char *, stack, int, n, {
+            (void)n;
+            delete[] stack;
+        });
+        prof_stacks.clear();
+        prof_samples = 0;
+    }
+
+    /* writes the samples in the folded format taken by flamegraph.pl and
+     * speedscope, one "frame;frame;frame count" line per distinct stack
+     */
+    static void luaprofdump(char *file) {
+        if (!prof_samples) {
+            conoutf(CON_ERROR, "no Lua profiling data (set luaprofiler 1)");
+            return;
+        }
+        const char *fname = *file ? file : "luaprof.folded";
+        stream *f = openutf8file(path(fname, true), "w");
+        if (!f) {
+            conoutf(CON_ERROR, "could not write Lua profile: %s", fname);
+            return;
+        }
+        enumeratekt(prof_stacks, const char *, stack, int, n, {
+            f->printf("%s %d\n", stack, n);
+        });
+        delete f;
+        conoutf("wrote %d Lua stacks (%d samples) to %s",
+            prof_stacks.numelems, prof_samples, fname);
+    }
+    COMMAND(luaprofdump, "s");
+
+    struct prof_line {
+        const char *name;
+        int len, self, total;
+    };
+
+    static bool prof_line_cmp(const prof_line &a, const prof_line &b) {
+        if (a.self != b.self) return a.self > b.self;
+        return a.total > b.total;
+    }
+
+    static prof_line &prof_get_line(vector<prof_line> &lines,
+    const char *name, int len) {
+        loopv(lines) {
+            prof_line &l = lines[i];
+            if (l.len == len && !strncmp(l.name, name, len)) return l;
+        }
+        prof_line &l = lines.add();
+        l.name = name;
+        l.len = len;
+        l.self = l.total = 0;
+        return l;
+    }
+
+    /* prints the n source lines with the most samples at the top of the stack,
+     * along with the share of samples they appear anywhere in the stack
+     */
+    static void luaproftop(int *n) {
+        if (!prof_samples) {
+            conoutf(CON_ERROR, "no Lua profiling data (set luaprofiler 1)");
+            return;
+        }
+        vector<prof_line> lines;
+        vector<int> seen;
+        enumeratekt(prof_stacks, const char *, stack, int, count, {
+            seen.setsize(0);
+            for (const char *p = stack;;) {
+                const char *end = strchr(p, ';');
+                int len = end ? int(end - p) : int(strlen(p));
+                prof_line &l = prof_get_line(lines, p, len);
+                int idx = int(&l - lines.getbuf());
+                if (seen.find(idx) < 0) {
+                    seen.add(idx);
+                    l.total += count;
+                }
+                if (!end) {
+                    l.self += count;
+                    break;
+                }
+                p = end + 1;
+            }
+        });
+        lines.sort(prof_line_cmp);
+        int top = min(*n > 0 ? *n : 20, lines.length());
+        conoutf("Lua profile, %d samples:", prof_samples);
+        loopi(top) {
+            prof_line &l = lines[i];
+            conoutf("%5.1f%% self %5.1f%% total  %.*s",
+                l.self * 100.0f / prof_samples, l.total * 100.0f / prof_samples,
+                l.len, l.name);
+        }
+    }
+    COMMAND(luaproftop, "i");
+
+    ICOMMAND(luaprofreset, "", (), prof_reset());
 } /* end namespace lua */
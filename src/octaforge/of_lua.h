@@ -23,6 +23,9 @@ namespace lua
     void pop_external_ret(int n);
 
     bool execfile(const char *cfgfile, bool msg = true);
+
+    void gccheck();
+    int gcidle();
 }
 
 #define LUACOMMAND(name, fun) \
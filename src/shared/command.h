@@ -2,6 +2,7 @@
 
 enum { VAL_NULL = 0, VAL_INT, VAL_FLOAT, VAL_STR, VAL_ANY, VAL_CODE, VAL_MACRO, VAL_IDENT, VAL_CSTR, VAL_CANY, VAL_WORD, VAL_POP, VAL_COND };
 
+// the compiled op layout is part of the cubescript cache format, see CSCACHE_VERSION in command.cpp
 enum
 {
     CODE_START = 0,
@@ -45,11 +46,12 @@ enum
 
 enum { ID_VAR, ID_FVAR, ID_SVAR, ID_COMMAND, ID_ALIAS, ID_LOCAL, ID_DO, ID_DOARGS, ID_IF, ID_RESULT, ID_NOT, ID_AND, ID_OR };
 
-/* OF: IDF_ALLOC, IDF_SIGNAL, IDF_SAFE, IDF_TRUSTED */
+/* OF: IDF_ALLOC, IDF_SIGNAL, IDF_SAFE, IDF_TRUSTED, IDF_SYNC, IDF_QUEUED */
 enum { IDF_PERSIST  = 1<<0, IDF_OVERRIDE   = 1<<1, IDF_HEX     = 1<<2,
        IDF_READONLY = 1<<3, IDF_OVERRIDDEN = 1<<4, IDF_UNKNOWN = 1<<5,
        IDF_ARG      = 1<<6, IDF_ALLOC      = 1<<7, IDF_SIGNAL  = 1<<8,
-       IDF_SAFE     = 1<<9, IDF_TRUSTED    = 1<<10 };
+       IDF_SAFE     = 1<<9, IDF_TRUSTED    = 1<<10, IDF_SYNC   = 1<<11,
+       IDF_QUEUED   = 1<<12 };
 
 struct ident;
 
@@ -66,6 +66,9 @@ extern "C" {
 #include <zlib.h>
 
 #include "tools.h"
+#ifdef STANDALONE
+#include "threads.h"
+#endif
 #include "geom.h"
 #include "ents.h"
 #include "command.h"
@@ -82,7 +82,7 @@ struct physent                                  // base entity type, can be affe
                blocked(false)
                { reset(); }
 
-    void resetinterp()
+    virtual void resetinterp() // OF: virtual
     {
         newpos = o;
         deltapos = vec(0, 0, 0);
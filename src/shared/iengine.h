@@ -124,6 +124,7 @@ extern void setvarchecked(ident *id, int val);
 extern void setfvarchecked(ident *id, float val);
 extern void setsvarchecked(ident *id, const char *val);
 extern void touchvar(const char *name);
+extern void flushvarchanges();
 extern int getvar(const char *name);
 extern int getvarmin(const char *name);
 extern int getvarmax(const char *name);
@@ -133,6 +134,14 @@ extern float getfvarmax(const char *name);
 extern const char *getsvar(const char *name);
 extern bool identexists(const char *name);
 extern ident *getident(const char *name);
+extern int getidentid(const char *name);
+extern ident *getidentbyid(int sym);
+extern void setvarbyid(int sym, int i, bool dofunc = true, bool doclamp = true);
+extern void setfvarbyid(int sym, float f, bool dofunc = true, bool doclamp = true);
+extern void setsvarbyid(int sym, const char *str, bool dofunc = true);
+extern int getvarbyid(int sym);
+extern float getfvarbyid(int sym);
+extern const char *getsvarbyid(int sym);
 extern ident *newident(const char *name, int flags = 0);
 extern ident *readident(const char *name);
 extern ident *writeident(const char *name, int flags = 0);
@@ -207,6 +216,24 @@ extern void closelogfile();
 extern void logoutfv(const char *fmt, va_list args);
 extern void logoutf(const char *fmt, ...) PRINTFARGS(1, 2);
 
+// profiler
+extern int profiler;
+extern int profbegin(const char *name);
+extern void profend(int idx);
+extern void profframe();
+extern ullong profmicros();
+
+struct profscope
+{
+    int idx;
+
+    profscope(const char *name) : idx(profiler ? profbegin(name) : -1) {}
+    ~profscope() { if(idx >= 0) profend(idx); }
+};
+#define PROFSCOPE__(name, line) profscope profscope##line(name)
+#define PROFSCOPE_(name, line) PROFSCOPE__(name, line)
+#define PROFSCOPE(name) PROFSCOPE_(name, __LINE__)
+
 // octa
 extern int lookupmaterial(const vec &o);
 
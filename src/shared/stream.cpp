@@ -229,6 +229,8 @@ done:
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <dirent.h>
 #endif
 
@@ -1223,6 +1225,29 @@ stream *openfile(const char *filename, const char *mode)
     return openrawfile(filename, mode);
 }
 
+// size and modification time of a file as openfile would find it, cheap enough to validate caches against
+bool getfileinfo(const char *filename, llong &size, llong &modtime)
+{
+#ifndef STANDALONE
+    uint zipsize, ziptime;
+    if(getzipfileinfo(filename, zipsize, ziptime)) { size = zipsize; modtime = ziptime; return true; }
+#endif
+    const char *found = findfile(filename, "rb");
+    if(!found) return false;
+#ifdef WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if(!GetFileAttributesEx(found, GetFileExInfoStandard, &attr)) return false;
+    size = (llong(attr.nFileSizeHigh)<<32) | attr.nFileSizeLow;
+    modtime = (llong(attr.ftLastWriteTime.dwHighDateTime)<<32) | attr.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat info;
+    if(stat(found, &info) < 0) return false;
+    size = info.st_size;
+    modtime = info.st_mtime;
+#endif
+    return true;
+}
+
 stream *opentempfile(const char *name, const char *mode)
 {
     const char *found = findfile(name, mode);
@@ -1272,3 +1297,46 @@ char *loadfile(const char *fn, size_t *size, bool utf8)
     if(size!=NULL) *size = len;
     return buf;
 }
+
+// maps a file copy-on-write so callers may patch it in place without touching the file on disk
+// files inside zip packages can't be mapped, callers should fall back to loadfile/openfile then
+void *mapfile(const char *fn, size_t *size)
+{
+#ifndef STANDALONE
+    if(findzipfile(fn)) return NULL;
+#endif
+    const char *found = findfile(fn, "rb");
+    if(!found) return NULL;
+#ifdef WIN32
+    HANDLE file = CreateFile(found, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return NULL;
+    DWORD len = GetFileSize(file, NULL);
+    HANDLE mapping = len && len != INVALID_FILE_SIZE ? CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL) : NULL;
+    CloseHandle(file);
+    if(!mapping) return NULL;
+    void *buf = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if(!buf) return NULL;
+#else
+    int fd = open(found, O_RDONLY);
+    if(fd < 0) return NULL;
+    struct stat info;
+    if(fstat(fd, &info) < 0 || info.st_size <= 0) { close(fd); return NULL; }
+    size_t len = info.st_size;
+    void *buf = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(buf == MAP_FAILED) return NULL;
+#endif
+    if(size) *size = len;
+    return buf;
+}
+
+void unmapfile(void *buf, size_t size)
+{
+    if(!buf) return;
+#ifdef WIN32
+    UnmapViewOfFile(buf);
+#else
+    munmap(buf, size);
+#endif
+}
@@ -0,0 +1,119 @@
+// threads.h: the subset of SDL's thread and atomic API used by code shared with the dedicated server
+// the server does not link SDL, so it gets these stand-ins instead and the shared code makes the same calls in both builds
+
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef int (*SDL_ThreadFunction)(void *data);
+
+struct SDL_Thread
+{
+    SDL_ThreadFunction fn;
+    void *data;
+    int status;
+#ifdef WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+};
+
+#ifdef WIN32
+static inline DWORD WINAPI SDL_RunThread(LPVOID data)
+#else
+static inline void *SDL_RunThread(void *data)
+#endif
+{
+    SDL_Thread *t = (SDL_Thread *)data;
+    t->status = t->fn(t->data);
+    return 0;
+}
+
+static inline SDL_Thread *SDL_CreateThread(SDL_ThreadFunction fn, const char *name, void *data)
+{
+    SDL_Thread *t = new SDL_Thread;
+    t->fn = fn;
+    t->data = data;
+    t->status = 0;
+#ifdef WIN32
+    t->handle = CreateThread(NULL, 0, SDL_RunThread, t, 0, NULL);
+    if(!t->handle) { delete t; return NULL; }
+#else
+    if(pthread_create(&t->handle, NULL, SDL_RunThread, t)) { delete t; return NULL; }
+#endif
+    return t;
+}
+
+static inline void SDL_WaitThread(SDL_Thread *t, int *status)
+{
+    if(!t) return;
+#ifdef WIN32
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#else
+    pthread_join(t->handle, NULL);
+#endif
+    if(status) *status = t->status;
+    delete t;
+}
+
+static inline void SDL_Delay(uint ms)
+{
+#ifdef WIN32
+    Sleep(ms);
+#else
+    usleep(ms*1000);
+#endif
+}
+
+static inline int SDL_GetCPUCount()
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return max(int(info.dwNumberOfProcessors), 1);
+#else
+    return max(int(sysconf(_SC_NPROCESSORS_ONLN)), 1);
+#endif
+}
+
+enum SDL_bool { SDL_FALSE = 0, SDL_TRUE = 1 };
+
+struct SDL_atomic_t { int value; };
+typedef int SDL_SpinLock;
+
+#ifdef __GNUC__
+#define SDL_MemoryBarrierRelease() __sync_synchronize()
+#define SDL_MemoryBarrierAcquire() __sync_synchronize()
+
+static inline SDL_bool SDL_AtomicCAS(SDL_atomic_t *a, int oldval, int newval) { return __sync_bool_compare_and_swap(&a->value, oldval, newval) ? SDL_TRUE : SDL_FALSE; }
+static inline SDL_bool SDL_AtomicCASPtr(void **a, void *oldval, void *newval) { return __sync_bool_compare_and_swap(a, oldval, newval) ? SDL_TRUE : SDL_FALSE; }
+static inline int SDL_AtomicAdd(SDL_atomic_t *a, int v) { return __sync_fetch_and_add(&a->value, v); }
+static inline int SDL_AtomicSet(SDL_atomic_t *a, int v) { __sync_synchronize(); return __sync_lock_test_and_set(&a->value, v); }
+static inline int SDL_AtomicGet(SDL_atomic_t *a) { return __sync_fetch_and_add(&a->value, 0); }
+static inline SDL_bool SDL_AtomicTryLock(SDL_SpinLock *lock) { return __sync_lock_test_and_set(lock, 1) ? SDL_FALSE : SDL_TRUE; }
+static inline void SDL_AtomicUnlock(SDL_SpinLock *lock) { __sync_lock_release(lock); }
+#else
+#define SDL_MemoryBarrierRelease() MemoryBarrier()
+#define SDL_MemoryBarrierAcquire() MemoryBarrier()
+
+static inline SDL_bool SDL_AtomicCAS(SDL_atomic_t *a, int oldval, int newval) { return InterlockedCompareExchange((volatile LONG *)&a->value, newval, oldval) == oldval ? SDL_TRUE : SDL_FALSE; }
+static inline SDL_bool SDL_AtomicCASPtr(void **a, void *oldval, void *newval) { return InterlockedCompareExchangePointer(a, newval, oldval) == oldval ? SDL_TRUE : SDL_FALSE; }
+static inline int SDL_AtomicAdd(SDL_atomic_t *a, int v) { return InterlockedExchangeAdd((volatile LONG *)&a->value, v); }
+static inline int SDL_AtomicSet(SDL_atomic_t *a, int v) { return InterlockedExchange((volatile LONG *)&a->value, v); }
+static inline int SDL_AtomicGet(SDL_atomic_t *a) { return InterlockedExchangeAdd((volatile LONG *)&a->value, 0); }
+static inline SDL_bool SDL_AtomicTryLock(SDL_SpinLock *lock) { return InterlockedExchange((volatile LONG *)lock, 1) ? SDL_FALSE : SDL_TRUE; }
+static inline void SDL_AtomicUnlock(SDL_SpinLock *lock) { InterlockedExchange((volatile LONG *)lock, 0); }
+#endif
+
+static inline void SDL_AtomicLock(SDL_SpinLock *lock)
+{
+    while(!SDL_AtomicTryLock(lock)) SDL_Delay(0);
+}
+
+#endif
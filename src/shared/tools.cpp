@@ -20,6 +20,40 @@ void operator delete(void *p) { if(p) free(p); }
 
 void operator delete[](void *p) { if(p) free(p); }
 
+////////////////////////// memory accounting ////////////////////////////////////////
+
+#ifdef MEMSTATS
+const char * const memtagnames[MEM_NUMTAGS] = { "misc", "octree", "va", "texture", "model", "undo", "pvs", "particles", "sound" };
+
+static llong memcurbytes[MEM_NUMTAGS], mempeakbytes[MEM_NUMTAGS];
+static SDL_SpinLock memlock = 0;
+
+// containers are used from worker threads too, and SDL has no 64 bit atomics, so the counters sit behind a spinlock
+void memtrack(int tag, llong size)
+{
+    SDL_AtomicLock(&memlock);
+    llong cur = memcurbytes[tag] += size;
+    if(cur > mempeakbytes[tag]) mempeakbytes[tag] = cur;
+    SDL_AtomicUnlock(&memlock);
+}
+
+llong memcurrent(int tag)
+{
+    SDL_AtomicLock(&memlock);
+    llong cur = memcurbytes[tag];
+    SDL_AtomicUnlock(&memlock);
+    return cur;
+}
+
+llong mempeak(int tag)
+{
+    SDL_AtomicLock(&memlock);
+    llong peak = mempeakbytes[tag];
+    SDL_AtomicUnlock(&memlock);
+    return peak;
+}
+#endif
+
 ////////////////////////// strings ////////////////////////////////////////
 
 static string tmpstr[4];
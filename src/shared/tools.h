@@ -33,6 +33,12 @@ typedef unsigned long long int ullong;
 #define UNUSED
 #endif
 
+#ifdef _MSC_VER
+#define THREADLOCAL __declspec(thread)
+#else
+#define THREADLOCAL __thread
+#endif
+
 inline void *operator new(size_t, void *p) { return p; }
 inline void *operator new[](size_t, void *p) { return p; }
 inline void operator delete(void *, void *) {}
@@ -597,23 +603,59 @@ static inline bool htcmp(GLuint x, GLuint y)
 }
 #endif
 
+// memory accounting: container storage and the major new/delete sites are counted per subsystem tag;
+// without MEMSTATS defined the macros expand to nothing and the containers carry no tag
+enum
+{
+    MEM_MISC = 0, MEM_OCTREE, MEM_VA, MEM_TEXTURE, MEM_MODEL, MEM_UNDO, MEM_PVS, MEM_PARTICLES, MEM_SOUND,
+    MEM_NUMTAGS
+};
+
+#ifdef MEMSTATS
+extern const char * const memtagnames[MEM_NUMTAGS];
+extern void memtrack(int tag, llong size);
+extern llong memcurrent(int tag);
+extern llong mempeak(int tag);
+#define MEMTRACK(tag, size) memtrack(tag, llong(size))
+#define MEMTAG(c, tag) (c).setmemtag(tag)
+#else
+#define MEMTRACK(tag, size)
+#define MEMTAG(c, tag)
+#endif
+
 template <class T> struct vector
 {
     static const int MINSIZE = 8;
 
     T *buf;
     int alen, ulen;
+#ifdef MEMSTATS
+    uchar memtag;
+
+    void setmemtag(int tag)
+    {
+        MEMTRACK(memtag, -llong(alen)*sizeof(T));
+        memtag = tag;
+        MEMTRACK(memtag, llong(alen)*sizeof(T));
+    }
+#endif
 
     vector() : buf(NULL), alen(0), ulen(0)
     {
+#ifdef MEMSTATS
+        memtag = MEM_MISC;
+#endif
     }
 
     vector(const vector &v) : buf(NULL), alen(0), ulen(0)
     {
+#ifdef MEMSTATS
+        memtag = v.memtag;
+#endif
         *this = v;
     }
 
-    ~vector() { shrink(0); if(buf) delete[] (uchar *)buf; }
+    ~vector() { shrink(0); if(buf) { MEMTRACK(memtag, -llong(alen)*sizeof(T)); delete[] (uchar *)buf; } }
 
     vector<T> &operator=(const vector<T> &v)
     {
@@ -648,6 +690,13 @@ template <class T> struct vector
     {
         if(!ulen)
         {
+#ifdef MEMSTATS
+            if(memtag != v.memtag)
+            {
+                MEMTRACK(memtag, (llong(v.alen) - alen)*sizeof(T));
+                MEMTRACK(v.memtag, (llong(alen) - v.alen)*sizeof(T));
+            }
+#endif
             swap(buf, v.buf);
             swap(ulen, v.ulen);
             swap(alen, v.alen);
@@ -674,7 +723,7 @@ template <class T> struct vector
     T &operator[](int i) { ASSERT(i>=0 && i<ulen); return buf[i]; }
     const T &operator[](int i) const { ASSERT(i >= 0 && i<ulen); return buf[i]; }
 
-    T *disown() { T *r = buf; buf = NULL; alen = ulen = 0; return r; }
+    T *disown() { T *r = buf; MEMTRACK(memtag, -llong(alen)*sizeof(T)); buf = NULL; alen = ulen = 0; return r; }
 
     void shrink(int i) { ASSERT(i<=ulen); if(isclass<T>::no) ulen = i; else while(ulen>i) drop(); }
     void setsize(int i) { ASSERT(i<=ulen); ulen = i; }
@@ -701,6 +750,7 @@ template <class T> struct vector
         if(!alen) alen = max(MINSIZE, sz);
         else while(alen < sz) alen += alen/2;
         if(alen <= olen) return;
+        MEMTRACK(memtag, (llong(alen) - olen)*sizeof(T));
         uchar *newbuf = new uchar[alen*sizeof(T)];
         if(olen > 0)
         {
@@ -923,6 +973,25 @@ template<class H, class E, class K, class T> struct hashbase
 
     enum { DEFAULTSIZE = 1<<10 };
 
+#ifdef MEMSTATS
+    uchar memtag;
+
+    llong membytes() const
+    {
+        llong bytes = llong(size)*sizeof(chain *);
+        for(chainchunk *c = chunks; c; c = c->next) bytes += sizeof(chainchunk);
+        return bytes;
+    }
+
+    void setmemtag(int tag)
+    {
+        llong bytes = membytes();
+        MEMTRACK(memtag, -bytes);
+        memtag = tag;
+        MEMTRACK(memtag, bytes);
+    }
+#endif
+
     hashbase(int size = DEFAULTSIZE)
       : size(size)
     {
@@ -931,10 +1000,15 @@ template<class H, class E, class K, class T> struct hashbase
         unused = NULL;
         chains = new chain *[size];
         memset(chains, 0, size*sizeof(chain *));
+#ifdef MEMSTATS
+        memtag = MEM_MISC;
+        MEMTRACK(memtag, llong(size)*sizeof(chain *));
+#endif
     }
 
     ~hashbase()
     {
+        MEMTRACK(memtag, -llong(size)*sizeof(chain *));
         DELETEA(chains);
         deletechunks();
     }
@@ -944,6 +1018,7 @@ template<class H, class E, class K, class T> struct hashbase
         if(!unused)
         {
             chainchunk *chunk = new chainchunk;
+            MEMTRACK(memtag, sizeof(chainchunk));
             chunk->next = chunks;
             chunks = chunk;
             loopi(CHUNKSIZE-1) chunk->chains[i].next = &chunk->chains[i+1];
@@ -1056,6 +1131,7 @@ template<class H, class E, class K, class T> struct hashbase
         for(chainchunk *nextchunk; chunks; chunks = nextchunk)
         {
             nextchunk = chunks->next;
+            MEMTRACK(memtag, -llong(sizeof(chainchunk)));
             delete chunks;
         }
     }
@@ -1352,6 +1428,7 @@ extern const char *sethomedir(const char *dir);
 extern const char *addpackagedir(const char *dir);
 extern const char *findfile(const char *filename, const char *mode);
 extern bool findzipfile(const char *filename);
+extern bool getzipfileinfo(const char *filename, uint &size, uint &modtime);
 extern stream *openrawfile(const char *filename, const char *mode);
 extern stream *openzipfile(const char *filename, const char *mode);
 extern stream *openfile(const char *filename, const char *mode);
@@ -1359,6 +1436,9 @@ extern stream *opentempfile(const char *filename, const char *mode);
 extern stream *opengzfile(const char *filename, const char *mode, stream *file = NULL, int level = Z_BEST_COMPRESSION);
 extern stream *openutf8file(const char *filename, const char *mode, stream *file = NULL);
 extern char *loadfile(const char *fn, size_t *size, bool utf8 = true);
+extern void *mapfile(const char *fn, size_t *size);
+extern void unmapfile(void *buf, size_t size);
+extern bool getfileinfo(const char *filename, llong &size, llong &modtime);
 extern bool listdir(const char *dir, bool rel, const char *ext, vector<char *> &files, int filter = FTYPE_FILE|FTYPE_DIR);
 extern int listfiles(const char *dir, const char *ext, vector<char *> &files, int filter = FTYPE_FILE|FTYPE_DIR,
     int flags = LIST_ROOT|LIST_HOMEDIR|LIST_PACKAGE|LIST_ZIP);
@@ -38,9 +38,9 @@ struct zipdirectoryheader
 struct zipfile
 {
     char *name;
-    uint header, offset, size, compressedsize;
+    uint header, offset, size, compressedsize, modtime;
 
-    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0)
+    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0), modtime(0)
     {
     }
     ~zipfile()
@@ -159,6 +159,7 @@ static bool readzipdirectory(const char *archname, FILE *f, int entries, int off
         f.header = hdr.offset;
         f.size = hdr.uncompressedsize;
         f.compressedsize = hdr.compression ? hdr.compressedsize : 0;
+        f.modtime = (uint(hdr.moddate)<<16) | hdr.modtime;
 #ifndef STANDALONE
         if(dbgzip) conoutf(CON_DEBUG, "%s: file %s, size %d, compress %d, flags %x", archname, name, hdr.uncompressedsize, hdr.compression, hdr.flags);
 #endif
@@ -549,6 +550,19 @@ bool findzipfile(const char *name)
     return false;
 }
 
+bool getzipfileinfo(const char *name, uint &size, uint &modtime)
+{
+    loopvrev(archives)
+    {
+        zipfile *f = archives[i]->files.access(name);
+        if(!f) continue;
+        size = f->size;
+        modtime = f->modtime;
+        return true;
+    }
+    return false;
+}
+
 int listzipfiles(const char *dir, const char *ext, vector<char *> &files)
 {
     size_t extsize = ext ? strlen(ext)+1 : 0, dirsize = strlen(dir);